@@ -0,0 +1,44 @@
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+# Design points: the classic five stages, then one stage split at a time, then everything split
+CONFIGS = ['if=1', 'if=2', 'ex=2', 'mem=2', 'mul=3', 'if=2,ex=2,mem=2', 'if=2,ex=2,mem=2,mul=4', 'if=3,ex=3,mem=3,mul=6']
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Report how CPI scales with pipeline depth (-P) on the benchmark workloads.')
+    parser.add_argument('--sim', default='./mips_sim', help='simulator binary (default: ./mips_sim)')
+    parser.add_argument('--workloads', default='bench/workloads', help='directory of workload images')
+    parser.add_argument('--filter', default='small', help='only run workloads whose name contains this string (default: small)')
+    parser.add_argument('--modes', default='1,2', help='pipelined modes to run (default: 1,2)')
+    parser.add_argument('configs', nargs='*', default=CONFIGS, help='-P configurations to compare')
+    args = parser.parse_args()
+
+    workloads = sorted(name[:-4] for name in os.listdir(args.workloads) if name.endswith('.txt') and args.filter in name)
+    if not workloads:
+        sys.exit(f'No workloads in {args.workloads}')
+
+    print(f"{'workload':<20} {'mode':>4} {'stages':<24} {'depth':>5} {'cycles':>12} {'stalls':>10} {'CPI':>8}")
+    for workload in workloads:
+        for mode in args.modes.split(','):
+            for config in args.configs:
+                result = run(args.sim, os.path.join(args.workloads, workload + '.txt'), mode, config)
+                print(f"{workload:<20} {mode:>4} {config:<24} {result['depth']:>5} {result['cycles']:>12} {result['stalls']:>10} "
+                      f"{result['cpi']:>8.4f}", flush=True)
+
+
+def run(sim, image, mode, config):
+    process = subprocess.run([sim, '-f', image, '-m', mode, '-P', config], capture_output=True, text=True)
+    if process.returncode != 0:
+        sys.exit(f'{image} mode {mode} -P {config} failed: {process.stderr.strip()}')
+    return {'cycles': int(re.search(r'Total clock cycles: (\d+)', process.stdout).group(1)),
+            'stalls': int(re.search(r'Total Stalls: (\d+)', process.stdout).group(1)),
+            'depth': int(re.search(r'\((\d+) stages\)', process.stdout).group(1)),
+            'cpi': float(re.search(r'CPI: ([\d.]+)', process.stdout).group(1))}
+
+
+if __name__ == '__main__':
+    main()
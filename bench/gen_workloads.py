@@ -0,0 +1,139 @@
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from encode_instr import encode_instruction  # noqa: E402
+
+# Approximate instructions executed by each size of a workload
+SIZES = {'small': 50_000, 'medium': 500_000, 'large': 5_000_000}
+
+COUNTER = 'R30'  # Loop counter, kept out of the workload bodies
+DATA = 4096      # Byte address of the data arrays
+ARRAY_WORDS = 64
+ARRAY_A = [i + 1 for i in range(ARRAY_WORDS)]            # mem_kernel inputs, at DATA and DATA + 256
+ARRAY_B = [1000 - 7 * i for i in range(ARRAY_WORDS)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate the benchmark workload images.')
+    parser.add_argument('directory', help='output directory')
+    parser.add_argument('--check', metavar='SIM', help='run mem_kernel_small on this simulator and check the sums it stores')
+    args = parser.parse_args()
+
+    os.makedirs(args.directory, exist_ok=True)
+    for name, workload in WORKLOADS.items():
+        for size, instructions in SIZES.items():
+            setup, body, data = workload()
+            program = loop((setup, body), instructions)
+            with open(os.path.join(args.directory, f'{name}_{size}.txt'), 'w') as file:
+                for instruction in program:
+                    file.write(encode_instruction(instruction) + '\n')
+                if data:
+                    # Data words follow the code, zero-padded up to DATA
+                    file.write('00000000\n' * (DATA // 4 - len(program)))
+                    for word in data:
+                        file.write(f'{word & 0xFFFFFFFF:08X}\n')
+
+    if args.check and not check_mem_kernel(args.check, os.path.join(args.directory, 'mem_kernel_small.txt')):
+        sys.exit(1)
+
+
+def check_mem_kernel(sim, image):
+    """Run mem_kernel in every mode and check that its output array holds the sums of its inputs."""
+    expected = {DATA + 512 + 4 * i: a + b for i, (a, b) in enumerate(zip(ARRAY_A, ARRAY_B))}
+    for mode in (0, 1, 2):
+        process = subprocess.run([sim, '-f', image, '-m', str(mode)], capture_output=True, text=True)
+        if process.returncode != 0:
+            print(f'{image} mode {mode} failed: {process.stderr.strip()}', file=sys.stderr)
+            return False
+        memory = process.stdout.rsplit('\nMemory:\n', 1)[-1]
+        words = {int(address): int(value) for address, value in re.findall(r'\[\s*(\d+):(-?\d+)\]', memory)}
+        if words != expected:
+            wrong = sorted(set(words.items()) ^ set(expected.items()))[:4]
+            print(f'{image} mode {mode}: stored words differ from the array sums, e.g. {wrong}', file=sys.stderr)
+            return False
+    print(f'{image}: array sums correct in modes 0 to 2')
+    return True
+
+
+def loop(body, instructions):
+    """Run body enough times to execute about the given number of instructions, then halt."""
+    setup, body = body
+    iterations = max(1, instructions // (len(body) + 3))
+    # The counter is set with two immediates: 16-bit immediates cannot hold the large sizes
+    high, low = divmod(iterations, 1024)
+    program = setup + [f'ADDI {COUNTER} R0 {high}', f'MULI {COUNTER} {COUNTER} 1024', f'ADDI {COUNTER} {COUNTER} {low}']
+    start = len(program)
+    program += body
+    program.append(f'SUBI {COUNTER} {COUNTER} 1')
+    program.append(f'BZ R0 {COUNTER} 2')  # Leave the loop
+    program.append(f'BEQ R0 R0 {start - len(program)}')
+    program.append('HALT')
+    return program
+
+
+def alu_chain():
+    """Long straight-line ALU code with no dependence closer than four instructions: no stalls."""
+    ops = ['ADD', 'SUB', 'XOR', 'OR', 'AND', 'MUL']
+    setup = [f'ADDI R{r} R0 {r * 3 + 1}' for r in range(1, 13)]
+    body = []
+    for i in range(60):
+        rd, rs, rt = 1 + i % 12, 1 + (i + 4) % 12, 1 + (i + 8) % 12
+        if i % 3 == 2:
+            body.append(f'ADDI R{rd} R{rs} {i}')
+        else:
+            body.append(f'{ops[i % len(ops)]} R{rd} R{rs} R{rt}')
+    return setup, body, []
+
+
+def raw_dense():
+    """Every instruction reads the result of the one before it."""
+    setup = ['ADDI R1 R0 1', 'ADDI R2 R0 3']
+    body = []
+    for i in range(30):
+        body.append('ADD R3 R1 R2' if i % 3 == 0 else 'XORI R3 R3 5' if i % 3 == 1 else 'SUB R1 R3 R2')
+    return setup, body, []
+
+
+def branch_loop():
+    """Tight loops of BZ and BEQ, taken and not taken."""
+    setup = ['ADDI R1 R0 0']
+    body = [
+        'ANDI R2 R1 1',
+        'ADDI R1 R1 1',
+        'BZ R0 R2 2',      # Taken every other iteration
+        'ADDI R3 R3 1',
+        'BEQ R0 R0 1',     # Always taken, to the next instruction
+        'ORI R4 R1 2',
+        'BEQ R4 R0 2',     # Never taken
+        'XOR R5 R4 R1',
+    ]
+    return setup, body, []
+
+
+def mem_kernel():
+    """Load/store kernel: c[i] = a[i] + b[i] over 64-word arrays, 8 words per iteration. R10 is the base pointer."""
+    setup = [f'ADDI R10 R0 {DATA}']
+    body = []
+    for i in range(8):
+        offset = i * 4
+        body += [f'LDW R{1 + i % 4} R10 {offset}', f'LDW R{5 + i % 4} R10 {offset + 256}', f'ADD R{11 + i % 4} R{1 + i % 4} R{5 + i % 4}',
+                 f'STW R{11 + i % 4} R10 {offset + 512}']
+    body += ['ADDI R10 R10 32', 'ANDI R10 R10 255', f'ADDI R10 R10 {DATA}']
+    # c starts as zeros inside the image, so the dump of modified words covers it
+    return setup, body, ARRAY_A + ARRAY_B + [0] * ARRAY_WORDS
+
+
+WORKLOADS = {
+    'alu_chain': alu_chain,
+    'raw_dense': raw_dense,
+    'branch_loop': branch_loop,
+    'mem_kernel': mem_kernel,
+}
+
+
+if __name__ == '__main__':
+    main()
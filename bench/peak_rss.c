@@ -0,0 +1,40 @@
+/**
+ * @file  peak_rss.c
+ * @brief Run a command and print its peak resident set size, like /usr/bin/time -f %M. The command is
+ * started with a real fork() from this small process: a child spawned straight from the benchmark script
+ * would report the script's own peak RSS if it were larger.
+ * @copyright Copyright (c) 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s command [args...]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return EXIT_FAILURE;
+  }
+  if (pid == 0) {
+    execvp(argv[1], &argv[1]);
+    perror(argv[1]);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    perror("wait4");
+    return EXIT_FAILURE;
+  }
+  fprintf(stderr, "peak_rss_kb %ld\n", usage.ru_maxrss);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
@@ -0,0 +1,109 @@
+import argparse
+import os
+import re
+import subprocess
+import sys
+import time
+
+MODES = [0, 1, 2]
+COLUMNS = ['workload', 'mode', 'cycles', 'instructions', 'ns/cycle', 'Minstr/s', 'peak_rss_kb']
+REGRESSION = 0.05   # Slowdown (or RSS growth) flagged when comparing with the baseline
+RSS_SLACK_KB = 512  # RSS growth below this is noise, whatever its percentage
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run the benchmark workloads in every mode and report simulator throughput.')
+    parser.add_argument('--sim', default='./mips_sim', help='simulator binary (default: ./mips_sim)')
+    parser.add_argument('--peak-rss', default='bench/peak_rss', help='peak RSS launcher built from bench/peak_rss.c')
+    parser.add_argument('--workloads', default='bench/workloads', help='directory of workload images')
+    parser.add_argument('--output', default='bench/results.txt', help='results file (default: bench/results.txt)')
+    parser.add_argument('--baseline', default='bench/baseline.txt', help='results to compare with, if the file exists')
+    parser.add_argument('--repeat', type=int, default=3, help='runs per measurement; the fastest is kept (default: 3)')
+    parser.add_argument('--filter', default='', help='only run workloads whose name contains this string')
+    args = parser.parse_args()
+
+    workloads = sorted(name[:-4] for name in os.listdir(args.workloads) if name.endswith('.txt') and args.filter in name)
+    if not workloads:
+        sys.exit(f'No workloads in {args.workloads}')
+
+    results = []
+    for workload in workloads:
+        for mode in MODES:
+            result = measure(args.sim, os.path.join(args.workloads, workload + '.txt'), mode, args.repeat, args.peak_rss)
+            result['workload'] = workload
+            result['mode'] = mode
+            results.append(result)
+            print(format_row(result), flush=True)
+
+    write_results(args.output, results)
+    print(f'Results written to {args.output}')
+    if os.path.exists(args.baseline) and os.path.abspath(args.baseline) != os.path.abspath(args.output):
+        compare(read_results(args.baseline), results, args.baseline)
+
+
+def measure(sim, image, mode, repeat, peak_rss):
+    """Run a workload; keep the fastest wall time and the largest peak RSS."""
+    best = None
+    rss = 0
+    for _ in range(repeat):
+        start = time.perf_counter()
+        process = subprocess.run([peak_rss, sim, '-f', image, '-m', str(mode)], capture_output=True, text=True)
+        elapsed = time.perf_counter() - start
+        if process.returncode != 0:
+            sys.exit(f'{image} mode {mode} failed: {process.stderr.strip()}')
+
+        best = elapsed if best is None else min(best, elapsed)
+        rss = max(rss, int(re.search(r'peak_rss_kb (\d+)', process.stderr).group(1)))
+
+    cycles = int(re.search(r'Total clock cycles: (\d+)', process.stdout).group(1))
+    instructions = int(re.search(r'\\ Total: (\d+)', process.stdout).group(1))
+    return {'cycles': cycles, 'instructions': instructions, 'ns/cycle': best * 1e9 / cycles,
+            'Minstr/s': instructions / best / 1e6, 'peak_rss_kb': rss}
+
+
+def format_row(result):
+    return (f"{result['workload']:<20} {result['mode']:>4} {result['cycles']:>12} {result['instructions']:>12} "
+            f"{result['ns/cycle']:>10.2f} {result['Minstr/s']:>10.2f} {result['peak_rss_kb']:>12}")
+
+
+def write_results(filename, results):
+    with open(filename, 'w') as file:
+        file.write('# ' + ' '.join(COLUMNS) + '\n')
+        for result in results:
+            file.write(format_row(result) + '\n')
+
+
+def read_results(filename):
+    results = {}
+    with open(filename) as file:
+        for line in file:
+            if line.startswith('#') or not line.strip():
+                continue
+            fields = line.split()
+            result = dict(zip(COLUMNS, fields))
+            for column in COLUMNS[1:]:
+                result[column] = float(result[column])
+            results[(result['workload'], int(result['mode']))] = result
+    return results
+
+
+def compare(baseline, results, baseline_name):
+    print(f'\nCompared with {baseline_name} (! marks a change over {REGRESSION:.0%}):')
+    print(f"{'workload':<20} {'mode':>4} {'ns/cycle':>10} {'change':>8} {'peak_rss_kb':>12} {'change':>8}")
+    regressions = 0
+    for result in results:
+        old = baseline.get((result['workload'], result['mode']))
+        if old is None:
+            continue
+        time_change = result['ns/cycle'] / old['ns/cycle'] - 1
+        rss_change = result['peak_rss_kb'] / old['peak_rss_kb'] - 1
+        flags = ('!' if time_change > REGRESSION else ' ') + ('!' if rss_change > REGRESSION and result['peak_rss_kb'] - old['peak_rss_kb'] > RSS_SLACK_KB else ' ')
+        regressions += flags != '  '
+        note = '  simulated cycles changed' if (result['cycles'], result['instructions']) != (old['cycles'], old['instructions']) else ''
+        print(f"{result['workload']:<20} {result['mode']:>4} {result['ns/cycle']:>10.2f} {time_change:>+7.1%}{flags[0]} "
+              f"{result['peak_rss_kb']:>12} {rss_change:>+7.1%}{flags[1]}{note}")
+    print(f'{regressions} regression(s)')
+
+
+if __name__ == '__main__':
+    main()
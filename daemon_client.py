@@ -0,0 +1,99 @@
+import argparse
+import json
+import socket
+import struct
+import sys
+import threading
+import time
+
+# Must match include/daemon.h
+REQUEST = struct.Struct('=4sBBBxII')
+RESULT = struct.Struct('=4sIIII5IBB2x32i')
+REQUEST_MAGIC = b'MSJ1'
+RESULT_MAGIC = b'MSR1'
+REPLY_BINARY = 0
+REPLY_JSON = 1
+
+ENGINES = {'pipeline': 0, 'functional': 1, 'jit': 2}
+STATUS_NAMES = ['ok', 'file_error', 'invalid_opcode', 'cycle_limit', 'checkpoint_error', 'image_error',
+                'diverged', 'bad_request']
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Send memory images to a simulation daemon started with mips_sim -d and print one JSON line of results per job.')
+    parser.add_argument('socket', help='socket the daemon listens on')
+    parser.add_argument('images', nargs='+', help='memory images (text or binary)')
+    parser.add_argument('-m', '--mode', type=int, default=0, help='0: non-pipelined, 1: pipelined without forwarding, 2: pipelined with forwarding')
+    parser.add_argument('-e', '--engine', choices=ENGINES, default='pipeline', help='simulation engine (default: pipeline)')
+    parser.add_argument('-c', '--cycles', type=int, default=0, help='cycle limit (default: none)')
+    parser.add_argument('-r', '--repeat', type=int, default=1, help='send every image this many times')
+    parser.add_argument('--binary', action='store_true', help='ask for binary results and convert them here')
+    args = parser.parse_args()
+
+    images = []
+    for name in args.images:
+        with open(name, 'rb') as f:
+            images.append((name, f.read()))
+    jobs = [image for _ in range(args.repeat) for image in images]
+    reply = REPLY_BINARY if args.binary else REPLY_JSON
+
+    conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    conn.connect(args.socket)
+    start = time.perf_counter()
+
+    # Jobs are sent from a second thread so that neither side blocks on a full socket buffer
+    def send_jobs():
+        for _, data in jobs:
+            conn.sendall(REQUEST.pack(REQUEST_MAGIC, args.mode, ENGINES[args.engine], reply, args.cycles, len(data)) + data)
+        conn.shutdown(socket.SHUT_WR)
+
+    sender = threading.Thread(target=send_jobs)
+    sender.start()
+
+    replies = conn.makefile('rb')
+    answered = 0
+    for name, _ in jobs:
+        if args.binary:
+            record = replies.read(RESULT.size)
+            if len(record) < RESULT.size:
+                break
+            print(json.dumps(decode_result(name, record)))
+        else:
+            line = replies.readline()
+            if not line:
+                break
+            result = json.loads(line)
+            print(json.dumps({'image': name, **result}))
+        answered += 1
+
+    sender.join()
+    conn.close()
+    elapsed = time.perf_counter() - start
+    print(f'{answered} of {len(jobs)} jobs answered in {elapsed:.3f} s ({answered / elapsed:.1f} jobs/s)', file=sys.stderr)
+    if answered < len(jobs):
+        sys.exit(1)
+
+
+def decode_result(name, record):
+    fields = RESULT.unpack(record)
+    if fields[0] != RESULT_MAGIC:
+        sys.exit(f'Bad result from daemon for {name}')
+    status, cycles, stalls, pc = fields[1:5]
+    total, arithmetic, logical, memory, control = fields[5:10]
+    halted, cached = fields[10:12]
+    return {
+        'image': name,
+        'status': STATUS_NAMES[status] if status < len(STATUS_NAMES) else 'unknown',
+        'cycles': cycles,
+        'stalls': stalls,
+        'final_pc': pc,
+        'halted': bool(halted),
+        'cached': bool(cached),
+        'counts': {'total': total, 'arithmetic': arithmetic, 'logical': logical, 'memory': memory, 'control': control},
+        'registers': list(fields[12:]),
+    }
+
+
+if __name__ == '__main__':
+    main()
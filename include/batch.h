@@ -0,0 +1,37 @@
+/**
+ * @file  batch.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "common.h"
+#include "mips.h"
+
+typedef struct {
+  char *image;
+  Mode mode;
+  Engine engine;
+  SimStatus status;
+  char error[128];
+  uint32_t cycles;
+  uint32_t stalls;
+  uint32_t pc;
+  bool halted;
+  InstructionCount counts;
+} BatchJob;
+
+typedef struct {
+  BatchJob *jobs;
+  size_t num_jobs;
+  size_t capacity;
+} Batch;
+
+bool load_manifest(Batch *batch, const char *filename);
+bool run_batch(Batch *batch, int num_workers, uint32_t cycle_limit);
+bool write_batch_results(Batch *batch, const char *filename);
+void destroy_batch(Batch *batch);
+void write_json_string(FILE *file, const char *str);
+
+#endif
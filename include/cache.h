@@ -0,0 +1,68 @@
+/**
+ * @file  cache.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "common.h"
+#include "mips.h"
+
+#define CACHE_REPORT_PCS 10  // PCs listed in the per-PC miss report
+
+typedef enum { REPLACE_LRU, REPLACE_FIFO, REPLACE_RANDOM } ReplacementPolicy;
+
+typedef enum {
+  WRITE_BACK,    // Stores allocate on a miss and mark the line dirty; dirty victims are written back
+  WRITE_THROUGH  // Stores go to memory through a write buffer and do not allocate
+} WritePolicy;
+
+typedef struct {
+  uint32_t size;         // Bytes
+  uint32_t assoc;        // Ways per set
+  uint32_t line_size;    // Bytes
+  ReplacementPolicy policy;
+  uint32_t hit_latency;  // Cycles of an access that hits (1: no stall)
+  uint32_t miss_penalty; // Cycles a miss (or the write-back of a dirty victim) adds
+  WritePolicy write_policy;
+} CacheConfig;
+
+typedef struct {
+  uint32_t tag;    // Line address (address >> offset bits)
+  uint32_t stamp;  // Last use (LRU) or fill (FIFO)
+  bool valid;
+  bool dirty;
+} CacheLine;
+
+/* Access and miss counts of the instruction at one PC */
+typedef struct {
+  uint32_t accesses;
+  uint32_t misses;
+} CachePCStats;
+
+/* Timing model only: the data always comes from the simulator's memory */
+typedef struct Cache {
+  const char *name;
+  CacheConfig config;
+  CacheLine *lines;  // num_sets * assoc, set by set
+  uint32_t num_sets;
+  uint32_t offset_bits;
+  uint32_t random_state;
+  CacheLine *last_line;  // Line of the last access, checked first
+  uint64_t accesses;  // Also the clock of the line stamps
+  uint64_t writes;
+  uint64_t read_misses;
+  uint64_t write_misses;
+  uint64_t writebacks;
+  uint64_t miss_cycles;  // Cycles added by misses and write-backs
+  CachePCStats *pcs;     // Indexed by PC / 4: accesses always come from an instruction of the program
+  uint32_t num_pcs;
+} Cache;
+
+Cache *create_cache(const char *name, const char *spec, uint32_t num_pcs);
+void destroy_cache(Cache *cache);
+uint32_t cache_access(Cache *cache, uint32_t pc, uint32_t address, bool is_write);
+void print_cache_stats(Cache *cache, MIPSSim *mips, FILE *file);
+
+#endif
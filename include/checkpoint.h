@@ -0,0 +1,78 @@
+/**
+ * @file  checkpoint.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "common.h"
+#include "mips.h"
+
+#define CHECKPOINT_MAGIC "MIPSCKPT"
+#define CHECKPOINT_VERSION 4
+#define CHECKPOINT_PAGE_WORDS MEMORY_PAGE_WORDS
+#define CHECKPOINT_PAGE_BYTES (CHECKPOINT_PAGE_WORDS * 4)
+#define CHECKPOINT_NO_SLOT 0xFF
+
+/*
+ * File layout:
+ *   CheckpointHeader
+ *   CheckpointPage[num_pages]        (page index and dirty bitmap)
+ *   padding up to pages_offset       (a multiple of CHECKPOINT_PAGE_BYTES)
+ *   int32_t[num_pages][page_words]   (memory words, one page after another)
+ */
+
+typedef struct {
+  int32_t instruction;
+  uint32_t pc;
+  uint8_t stage;
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t rs;
+  uint8_t rt;
+  uint8_t rd;
+  int16_t imm;
+  int32_t alu_out;
+  int32_t mdr;
+  int32_t forward_values[2];  // Indexed by ForwardTarget
+  uint8_t forwarded;          // Bit set for each forwarded operand
+  uint8_t ex_cycles;
+  uint8_t invalid;  // Undecodable word held until EX (split EX), zero in earlier checkpoints
+  uint8_t reserved;
+} CheckpointInstr;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t mode;
+  uint32_t pc;
+  uint32_t clock;
+  uint32_t memory_size;
+  uint8_t halt;
+  uint8_t done;
+  uint8_t is_pipelined;
+  uint8_t is_stalled;
+  uint32_t total_stalls;
+  InstructionCount counts;
+  int32_t registers[32];
+  uint32_t registers_modified;  // Bit i set if register i is modified
+  PipelineConfig pipeline;                 // Physical stages the slots below are laid out for
+  uint8_t stage_slot[PIPELINE_MAX_DEPTH];  // Slot held by each physical stage, CHECKPOINT_NO_SLOT if empty
+  uint8_t reserved[2];
+  CheckpointInstr slots[PIPELINE_SLOTS];
+  uint32_t num_pages;
+  uint32_t page_words;  // Words per page, must match MEMORY_PAGE_WORDS to restore
+  uint64_t pages_offset;
+} CheckpointHeader;
+
+typedef struct {
+  uint32_t index;  // Page number (word address / CHECKPOINT_PAGE_WORDS)
+  uint32_t reserved;
+  uint64_t modified[CHECKPOINT_PAGE_WORDS / 64];
+} CheckpointPage;
+
+bool save_checkpoint(MIPSSim *mips, const char *filename);
+SimStatus restore_checkpoint(MIPSSim *mips, const char *filename);
+
+#endif
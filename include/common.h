@@ -2,6 +2,7 @@
 #define __COMMON_H__
 
 /*** includes ***/
+#include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <math.h>
@@ -22,7 +23,6 @@
 #endif
 
 #define NUM_STAGES 5
-#define MEMORY_SIZE 1024
 #define INSTR_MASK 0x1F
 
 typedef enum {
@@ -68,13 +68,38 @@ typedef enum {
 } ForwardTarget;
 
 typedef struct {
-  int32_t reg;
+  int32_t reg;  // Forwarded value
   bool is_forwarded;
-  ForwardTarget target;
 } ForwardReg;
 
+typedef struct {
+  int32_t word;
+  Opcode opcode;
+  InstructionType type;
+  uint8_t rs;
+  uint8_t rt;
+  uint8_t rd;
+  int16_t imm;
+  uint32_t reads;  // Bitmask of the registers the instruction reads
+  int8_t writes;   // Register the instruction writes, -1 if none
+  bool valid;
+  bool breakpoint;  // Debugger breakpoint: the entry stays invalid, so every lookup misses and stops (see debugger.c)
+  void *handler;  // Functional engine handler, bound on first execution
+} DecodedInstr;
+
+/* Per-instruction trace data, only filled in while a trace is being recorded */
+typedef struct {
+  uint32_t seq;                 // Fetch order
+  uint32_t cycles[NUM_STAGES];  // Cycle the instruction entered each stage, 0 if it did not
+  uint32_t end_cycle;           // Cycle it was flushed or squashed, 0 if it completes
+  uint16_t stalls;              // Cycles stalled in ID
+  uint8_t flags;
+  uint8_t forward_stage;  // Stage of the instruction an operand was forwarded from
+} InstrTrace;
+
 typedef struct {
   int32_t instruction;
+  uint32_t pc;
   PipelineStage stage;
   InstructionType type;
   Opcode opcode;
@@ -84,7 +109,14 @@ typedef struct {
   int16_t imm;
   int32_t alu_out;
   int32_t mdr;
-  ForwardReg forward_reg;
+  ForwardReg forward_reg[2];  // Operands forwarded to EX, indexed by ForwardTarget
+  uint32_t predicted_pc;    // Address fetched after this instruction
+  uint32_t branch_history;  // Global branch history before this instruction was predicted
+  uint32_t ready_clock;     // Last cycle of the fetch when the I-cache makes it take more than one
+  uint8_t ex_cycles;        // Cycles spent in the last EX stage, the first of which executed it
+  bool invalid;             // Did not decode while an older branch could still squash it: fails in EX instead
+  bool breakpoint;          // Met a breakpoint in the same position: stops in EX instead of ID
+  InstrTrace trace;
 } Instruction;
 
 #endif
\ No newline at end of file
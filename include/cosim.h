@@ -0,0 +1,53 @@
+/**
+ * @file  cosim.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _COSIM_H_
+#define _COSIM_H_
+
+#include "common.h"
+#include "memory.h"
+#include "mips.h"
+
+struct Jit;
+
+#define COSIM_REPORT_SIZE 2048
+
+typedef struct {
+  Engine engine;      // Candidate engine, ENGINE_FUNCTIONAL or ENGINE_JIT
+  uint32_t interval;  // Instructions the reference retires between checks
+} CoSimConfig;
+
+/*
+ * The pipeline model (the reference) runs as usual and calls check_retired() at every writeback. At a
+ * check the candidate engine is run up to the same number of instructions and the two are compared: PC
+ * of the next instruction, registers, and a hash of every store so far, folded in from each memory's log
+ * of stores since the last check. The JIT can only pause at taken branches; when it runs past the
+ * reference, the check waits for the reference to catch up.
+ */
+typedef struct CoSim {
+  CoSimConfig config;
+  MIPSSim *reference;
+  MIPSSim *candidate;
+  struct Jit *jit;              // Candidate's translated code, NULL for the functional engine
+  MemoryLog reference_stores;   // Stores since the last check
+  MemoryLog candidate_stores;
+  uint64_t reference_hash;      // Stores up to the last check
+  uint64_t candidate_hash;
+  uint32_t retired;             // Instructions the reference has written back
+  uint32_t next_check;          // Value of retired at the next check
+  uint32_t matched;             // Value of retired at the last check that matched
+  uint32_t checks;
+  bool diverged;
+  char report[COSIM_REPORT_SIZE];  // What differed, once diverged
+} CoSim;
+
+bool parse_cosim_config(const char *spec, CoSimConfig *config);
+CoSim *create_cosim(MIPSSim *reference, const CoSimConfig *config);
+void check_retired(CoSim *cs);
+void finish_cosim(CoSim *cs);
+void print_cosim_report(CoSim *cs, FILE *file);
+void destroy_cosim(CoSim *cs);
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * @file  daemon.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include "common.h"
+#include "mips.h"
+
+#define DAEMON_REQUEST_MAGIC "MSJ1"
+#define DAEMON_RESULT_MAGIC "MSR1"
+#define DAEMON_MAX_IMAGE_SIZE (64u << 20)  // Larger jobs are rejected and their connection closed
+#define DAEMON_CACHE_ENTRIES 64            // Images kept loaded and decoded, least recently used dropped first
+
+/*
+ * Protocol, in host byte order: a client sends any number of jobs on one connection, each a DaemonRequest
+ * followed by image_size bytes of memory image (text or binary, as with -f). The jobs of a connection run
+ * in order on one worker and are answered in order, each by a DaemonResult or by one line of JSON.
+ */
+
+typedef enum {
+  DAEMON_REPLY_BINARY,
+  DAEMON_REPLY_JSON
+} DaemonReply;
+
+typedef struct {
+  char magic[4];         // DAEMON_REQUEST_MAGIC
+  uint8_t mode;          // 0 to 2
+  uint8_t engine;        // 0 to 2; engines 1 and 2 need mode 0
+  uint8_t reply;         // DaemonReply
+  uint8_t reserved;
+  uint32_t cycle_limit;  // 0 for no limit
+  uint32_t image_size;   // Bytes of image that follow
+} DaemonRequest;
+
+typedef struct {
+  char magic[4];    // DAEMON_RESULT_MAGIC
+  uint32_t status;  // SimStatus
+  uint32_t cycles;
+  uint32_t stalls;
+  uint32_t pc;
+  InstructionCount counts;
+  uint8_t halted;
+  uint8_t cached;  // The image was already loaded and decoded
+  uint8_t reserved[2];
+  int32_t registers[32];
+} DaemonResult;
+
+int run_daemon(const char *path, int num_workers);
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ * @file  debugger.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _DEBUGGER_H_
+#define _DEBUGGER_H_
+
+#include "common.h"
+#include "mips.h"
+
+#define DEBUGGER_MAX_BREAKPOINTS 64
+#define DEBUGGER_MAX_WATCHPOINTS 64
+
+typedef enum {
+  WATCH_REGISTER,
+  WATCH_MEMORY
+} WatchKind;
+
+typedef struct {
+  WatchKind kind;
+  uint32_t target;  // Register number, or byte address of a word
+  int32_t value;    // Value when last checked
+} Watchpoint;
+
+/*
+ * A breakpoint marks the decode cache entry of its address, and a store to the word keeps the mark. Such an
+ * entry never becomes valid, so the decode stage always misses on it and stops the cycle there with
+ * SIM_BREAKPOINT, before the instruction executes;
+ * the cycle is completed with finish_cycle() when the program is resumed. With a split EX, an instruction an older
+ * branch may still squash is flagged instead and stops in EX, if it gets there, to be resumed with
+ * finish_from_execute(). Nothing else looks at breakpoints,
+ * so runs without them, or that do not reach them, cost the same as without the debugger. Watchpoints are
+ * checked after every cycle, so the program is stepped cycle by cycle while any is set.
+ */
+typedef struct {
+  MIPSSim *mips;
+  uint32_t breakpoints[DEBUGGER_MAX_BREAKPOINTS];  // Byte addresses
+  uint32_t num_breakpoints;
+  Watchpoint watchpoints[DEBUGGER_MAX_WATCHPOINTS];
+  uint32_t num_watchpoints;
+  Instruction *resumed;  // Instruction resumed from a breakpoint, whose breakpoint stays lifted while it is in ID
+} Debugger;
+
+bool run_debugger(MIPSSim *mips, FILE *input);
+
+#endif
@@ -0,0 +1,15 @@
+/**
+ * @file  decode.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _DECODE_H_
+#define _DECODE_H_
+
+#include "common.h"
+
+bool decode_instruction(int32_t word, DecodedInstr *decoded);
+const DecodedInstr *lookup_decoded(DecodedInstr *entry, int32_t word);
+char *format_instruction(int32_t word, char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * @file  functional.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _FUNCTIONAL_H_
+#define _FUNCTIONAL_H_
+
+#include "common.h"
+#include "mips.h"
+#include "timing.h"
+
+void run_functional(MIPSSim *mips, RetireStream *stream);
+bool run_functional_for(MIPSSim *mips, RetireStream *stream, uint64_t max_instructions);
+
+#endif
@@ -0,0 +1,40 @@
+/**
+ * @file  image.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include "common.h"
+#include "mips.h"
+
+#define IMAGE_MAGIC "MIPSIMG"
+#define IMAGE_VERSION 1
+
+/*
+ * Binary image layout:
+ *   ImageHeader
+ *   ImageSegment[num_segments]
+ *   int32_t words of each segment, at the segment's offset
+ */
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_pc;      // Byte address of the first instruction
+  uint32_t memory_size;   // Words of memory the program uses; execution stops when the PC leaves it
+  uint32_t num_segments;
+} ImageHeader;
+
+typedef struct {
+  uint32_t address;    // Byte address of the first word (word aligned)
+  uint32_t num_words;
+  uint64_t offset;     // File offset of the words
+} ImageSegment;
+
+SimStatus load_memory(MIPSSim *mips, char *filename);
+SimStatus load_image(MIPSSim *mips, const char *name, const void *data, size_t size);
+bool save_image(MIPSSim *mips, const char *filename);
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ * @file  jit.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "common.h"
+#include "mips.h"
+
+#define JIT_BUFFER_SIZE (16u << 20)  // Bytes of translated code; every translation is dropped when it fills up
+#define JIT_MAX_BLOCK_INSTRS 64      // Longer straight-line runs are split into several blocks
+#define JIT_MAX_BLOCKS 65536
+#define JIT_MAX_LINKS (2 * JIT_MAX_BLOCKS)
+
+/* Why translated code returned to the dispatcher */
+typedef enum {
+  JIT_EXIT_CONTINUE,    // Continue at state.pc (chain state.exit_site to it if set)
+  JIT_EXIT_HALT,
+  JIT_EXIT_CYCLE_LIMIT  // A taken branch went past the cycle limit; state.pc is its target
+} JitExit;
+
+/* Counters and exit information, read and written by translated code relative to a base register */
+typedef struct {
+  uint64_t arithmetic;
+  uint64_t logical;
+  uint64_t memory;
+  uint64_t control;
+  uint64_t cycles;        // NOT_PIPED cycles: NOT_PIPED_CYCLES per instruction plus one per taken branch
+  int64_t cycle_budget;   // Cycles left before the cycle limit (INT64_MAX for no limit)
+  uint32_t pc;            // Guest PC to continue at
+  uint8_t *exit_site;     // Exit that can be patched to jump straight to the next block, NULL if none
+} JitState;
+
+struct JitLink;
+
+/* A translated basic block */
+typedef struct JitBlock {
+  uint32_t pc;      // Guest address of the first instruction
+  uint32_t index;   // Word index of the first instruction
+  uint32_t length;  // Instructions translated
+  uint8_t *code;
+  bool valid;                     // Cleared when a store overwrites one of its instructions
+  struct JitBlock *next_in_page;  // Next valid block starting in the same memory page
+  struct JitLink *links;          // Exits linked to this block
+} JitBlock;
+
+/* A block exit patched to jump directly into another block */
+typedef struct JitLink {
+  uint8_t *site;              // jmp rel32 of the exit
+  uint8_t *stub;              // Code the exit jumped to before it was patched
+  JitBlock *target;           // NULL once the link has been undone
+  struct JitLink *next_link;  // Next exit linked to the same block
+} JitLink;
+
+typedef int (*JitEntry)(JitState *state, Value *registers, const uint8_t *code);
+
+typedef struct Jit {
+  JitState state;  // First, so translated code can pass its base register to the helpers as the Jit
+  MIPSSim *mips;
+  uint8_t *buffer;      // Code buffer: entry and exit trampolines, then the blocks; writable only while patched
+  uint8_t *code_start;  // First byte after the trampolines
+  uint8_t *code_end;    // First free byte
+  uint8_t *leave;       // Returns to the dispatcher with the exit reason in eax
+  uint8_t *limit_exit;  // Returns JIT_EXIT_CYCLE_LIMIT
+  JitEntry enter;
+  JitBlock *blocks;
+  uint32_t num_blocks;
+  JitBlock **block_at;     // Block starting at each word of the program, if translated
+  JitBlock **page_blocks;  // Valid blocks starting in each memory page of the program, newest first
+  uint32_t *coverage;      // Valid blocks translated from each word of the program
+  JitLink *links;
+  uint32_t num_links;
+  uint32_t flushes;    // Times every translation was dropped
+  bool checks_budget;  // Taken branches check state.cycle_budget: there is a cycle limit or the run is stepped
+} Jit;
+
+void run_jit(MIPSSim *mips);
+Jit *create_jit(MIPSSim *mips);
+bool run_jit_for(Jit *jit, uint32_t min_instructions);
+void free_jit(Jit *jit);
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * @file  memory.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _MEMORY_H_
+#define _MEMORY_H_
+
+#include "common.h"
+
+/* Pages hold 1 << MEMORY_PAGE_BITS words. Override at build time, e.g. make CFLAGS+=-DMEMORY_PAGE_BITS=12 */
+#ifndef MEMORY_PAGE_BITS
+#define MEMORY_PAGE_BITS 10
+#endif
+#if MEMORY_PAGE_BITS < 6 || MEMORY_PAGE_BITS > 20
+#error "MEMORY_PAGE_BITS must be between 6 and 20"
+#endif
+
+#define MEMORY_PAGE_WORDS (1u << MEMORY_PAGE_BITS)
+#define MEMORY_WORD_MASK (MEMORY_PAGE_WORDS - 1)
+#define MEMORY_INDEX_BITS 30  // Word indexes of a 32-bit byte address space
+#define MEMORY_NUM_PAGES (1u << (MEMORY_INDEX_BITS - MEMORY_PAGE_BITS))
+#define MEMORY_TABLE_BITS ((MEMORY_INDEX_BITS - MEMORY_PAGE_BITS) / 2)
+#define MEMORY_DIR_BITS (MEMORY_INDEX_BITS - MEMORY_PAGE_BITS - MEMORY_TABLE_BITS)
+
+typedef struct MemoryPage {
+  int32_t words[MEMORY_PAGE_WORDS];
+  uint64_t modified[MEMORY_PAGE_WORDS / 64];  // Bit set for every word the program has written
+  DecodedInstr *decoded;                      // Decode cache, allocated when code is first fetched from the page
+  uint32_t index;                             // Page number (word index >> MEMORY_PAGE_BITS)
+  bool is_dirty;
+  struct MemoryPage *next;        // Next allocated page
+  struct MemoryPage *next_dirty;  // Next page with modified words
+} MemoryPage;
+
+/* Words written to a memory, in the order they were written */
+typedef struct MemoryLog {
+  uint32_t *indexes;
+  int32_t *values;
+  uint32_t count;
+  uint32_t capacity;
+} MemoryLog;
+
+/* Two-level page table over the 32-bit address space; pages are allocated when first written */
+typedef struct {
+  MemoryPage **directory[1u << MEMORY_DIR_BITS];
+  MemoryPage *last_page;  // Page of the last access, checked before walking the table
+  MemoryPage *pages;
+  MemoryPage *dirty_pages;
+  uint32_t num_pages;
+  MemoryLog *log;  // Every write is also appended here, NULL unless the memory is shared by cores or co-simulated
+} Memory;
+
+void init_memory(Memory *m);
+void destroy_memory(Memory *m);
+MemoryPage *find_page(Memory *m, uint32_t page_index);
+MemoryPage *get_page(Memory *m, uint32_t page_index);
+void mark_page_dirty(Memory *m, MemoryPage *page);
+void copy_to_memory(Memory *m, uint32_t index, const int32_t *words, uint32_t count);
+DecodedInstr *get_decoded_page(Memory *m, uint32_t index);
+void copy_memory(Memory *dst, const Memory *src);
+void append_memory_log(MemoryLog *log, uint32_t index, int32_t value);
+void apply_memory_log(Memory *m, const MemoryLog *log);
+void destroy_memory_log(MemoryLog *log);
+
+/**
+ * @brief Read a word. Pages that were never written read as zero.
+ *
+ * @param m     Memory
+ * @param index Word index (byte address / 4)
+ * @return Word value
+ */
+static inline int32_t read_memory(Memory *m, uint32_t index) {
+  MemoryPage *page = m->last_page;
+  if (page == NULL || page->index != index >> MEMORY_PAGE_BITS) {
+    page = find_page(m, index >> MEMORY_PAGE_BITS);
+    if (page == NULL) return 0;
+  }
+  return page->words[index & MEMORY_WORD_MASK];
+}
+
+/**
+ * @brief Write a word and mark it modified. A decoded copy of the word is dropped, but a debugger breakpoint
+ * on it is kept.
+ *
+ * @param m     Memory
+ * @param index Word index (byte address / 4)
+ * @param value Word value
+ */
+static inline void write_memory(Memory *m, uint32_t index, int32_t value) {
+  MemoryPage *page = m->last_page;
+  if (page == NULL || page->index != index >> MEMORY_PAGE_BITS) {
+    page = get_page(m, index >> MEMORY_PAGE_BITS);
+  }
+  uint32_t offset = index & MEMORY_WORD_MASK;
+  page->words[offset] = value;
+  page->modified[offset / 64] |= 1ull << (offset % 64);
+  if (!page->is_dirty) mark_page_dirty(m, page);
+  if (page->decoded) page->decoded[offset] = (DecodedInstr){.breakpoint = page->decoded[offset].breakpoint};
+  if (m->log) append_memory_log(m->log, index, value);
+}
+
+#endif
@@ -7,14 +7,40 @@
 #define _MIPS_H_
 
 #include "common.h"
+#include "decode.h"
+#include "memory.h"
 #include "pipeline.h"
 
+struct Cache;
+struct CoSim;
+struct Predictor;
+struct Profiler;
+
 typedef enum {
   NOT_PIPED,
   PIPED_NO_FWD,
-  PIPED_FWD
+  PIPED_FWD,
+  PIPED_SUPERSCALAR  // N-wide issue with forwarding, run by run_superscalar()
 } Mode;
 
+typedef enum {
+  ENGINE_PIPELINE,
+  ENGINE_FUNCTIONAL,
+  ENGINE_JIT  // Functional, on guest blocks translated to x86-64 code
+} Engine;
+
+typedef enum {
+  SIM_OK,
+  SIM_ERR_FILE,
+  SIM_ERR_INVALID_OPCODE,
+  SIM_ERR_CYCLE_LIMIT,
+  SIM_ERR_CHECKPOINT,
+  SIM_ERR_IMAGE,
+  SIM_ERR_DIVERGED,  // Co-simulation found the engines disagree
+  SIM_ERR_REQUEST,   // Invalid daemon job
+  SIM_BREAKPOINT     // Not an error: stopped at a debugger breakpoint in ID, resumed by finish_cycle(), or in EX (see debugger.c)
+} SimStatus;
+
 typedef struct {
   uint32_t total;
   uint32_t arithmetic;
@@ -30,30 +56,50 @@ typedef struct {
 
 typedef struct {
   Value registers[32];
-  Value memory[MEMORY_SIZE];
-  uint32_t memory_size;
+  Memory memory;
+  uint32_t memory_size;  // Words of the loaded program; execution stops when the PC leaves them
   uint32_t pc;
   uint32_t clock;
+  uint32_t fetch_clock;  // Cycle of the latest fetch (0 before the first), and the address it fetched
+  uint32_t fetch_pc;
   Pipeline pipeline;
   bool halt;
   bool done;
   InstructionCount counts;
   Mode mode;
+  uint32_t cycle_limit;  // 0 for no limit
+  SimStatus status;
+  char error[128];
+  struct Predictor *predictor;  // Branch predictor used at fetch, NULL to fetch sequentially (pipelined modes only)
+  struct Profiler *profiler;    // Hazard profile being collected, NULL if profiling is off
+  struct Cache *icache;         // L1 caches timing fetches and loads/stores, NULL for single-cycle memory
+  struct Cache *dcache;
+  struct CoSim *cosim;  // Engine checked against this one at every writeback, NULL if co-simulation is off
 } MIPSSim;
 
+typedef void (*ProcessFn)(MIPSSim *mips);
+
 void init_simulator(MIPSSim *mips, Mode mode);
 void destroy_simulator(MIPSSim *mips);
-void load_memory(MIPSSim *mips, char *filename);
 void fetch_stage(MIPSSim *mips);
 void decode_stage(MIPSSim *mips);
 void execute_stage(MIPSSim *mips);
 void memory_stage(MIPSSim *mips);
 void writeback_stage(MIPSSim *mips);
 void process(MIPSSim *mips);
+void finish_from_execute(MIPSSim *mips);
+void finish_cycle(MIPSSim *mips);
+ProcessFn select_process(Mode mode);
+void run_pipeline(MIPSSim *mips);
+bool run_pipeline_until(MIPSSim *mips, uint32_t stop_clock);
+SimStatus sim_error(MIPSSim *mips, SimStatus status, const char *format, ...);
+const char *status_name(SimStatus status);
 
 uint32_t perform_operation(uint32_t rs, uint32_t rt, Opcode opcode);
 bool control_flow(MIPSSim *mips, Instruction *instr, int32_t rs, int32_t rt);
+void count_instruction(MIPSSim *mips, Opcode opcode);
 void correct_pc(MIPSSim *mips);
+void drain_pipeline(MIPSSim *mips);
 
 void print_registers(MIPSSim *mips);
 void print_memory(MIPSSim *mips);
@@ -0,0 +1,388 @@
+/**
+ * @file  mips_cycle.h
+ * @copyright Copyright (c) 2024
+ *
+ * The cycle loop of the pipeline model, instantiated by mips.c once per Mode: MODE is the mode and
+ * MODE_FN(name) names the instance of a function. Every test of MODE compares constants, so each instance
+ * only keeps the code of its own mode and nothing on the per-cycle path looks at mips->mode.
+ *
+ * No include guard: the file is meant to be included once per mode.
+ */
+
+#if !defined(MODE) || !defined(MODE_FN)
+#error "Define MODE and MODE_FN before including mips_cycle.h"
+#endif
+
+/* Physical stage a stage function works on: without pipelining the single instruction sits in the first */
+#define MODE_STAGE(stage) (MODE == NOT_PIPED ? IF : (stage))
+#define MODE_ADVANCE(p) (MODE == NOT_PIPED ? advance_in_place(p) : advance_stages(p))
+
+/**
+ * @brief Find a pending write the instruction in ID has to wait for: one whose result cannot be forwarded yet
+ * (never, without forwarding). The operand whose value arrives last is reported.
+ *
+ * @param mips      MIPS simulator
+ * @param instr     Instruction in ID
+ * @param check_reg Register causing the stall
+ * @return Pending write, or NULL if the instruction can go
+ */
+static PendingWrite *MODE_FN(find_stall)(MIPSSim *mips, Instruction *instr, int8_t *check_reg) {
+  Pipeline *p = &mips->pipeline;
+  uint32_t sources = source_registers(instr);
+  if ((sources & p->scoreboard.pending) == 0) return NULL;
+
+  PendingWrite *stall = NULL;
+  const uint8_t operands[] = {instr->rs, instr->rt};
+  for (int i = RS; i <= RT; i++) {
+    if (!(sources >> operands[i] & 1)) continue;
+    PendingWrite *write = find_pending_write(p, operands[i]);
+    if (write == NULL || (MODE == PIPED_FWD && p->step >= write->forward_step)) continue;
+    if (stall == NULL || write->ready_step > stall->ready_step) {
+      stall = write;
+      *check_reg = operands[i];
+    }
+  }
+  return stall;
+}
+
+/**
+ * @brief Check for RAW hazards against the scoreboard, and stall the pipeline or forward both operands
+ * independently
+ *
+ * @param mips  MIPS simulator
+ * @param instr Instruction in ID
+ */
+static void MODE_FN(check_hazards)(MIPSSim *mips, Instruction *instr) {
+  Pipeline *p = &mips->pipeline;
+  instr->forward_reg[RS].is_forwarded = false;
+  instr->forward_reg[RT].is_forwarded = false;
+  uint32_t sources = source_registers(instr);
+  if ((sources & p->scoreboard.pending) == 0) return;
+
+  int8_t check_reg;
+  PendingWrite *stall = MODE_FN(find_stall)(mips, instr, &check_reg);
+  if (stall != NULL) {
+    stall_pipeline(p);
+    if (mips->profiler) profile_stall(mips->profiler, instr, stall->producer, check_reg, mips->clock);
+    return;
+  }
+
+  const uint8_t operands[] = {instr->rs, instr->rt};
+  for (int i = RS; i <= RT; i++) {
+    PendingWrite *write = (sources >> operands[i] & 1) ? find_pending_write(p, operands[i]) : NULL;
+    if (write == NULL) continue;
+    Instruction *producer = write->producer;
+    instr->forward_reg[i] = (ForwardReg){.is_forwarded = true, .reg = producer->opcode == LDW ? producer->mdr : producer->alu_out};
+    if (p->tracer) {
+      instr->trace.flags |= TRACE_FORWARDED;
+      instr->trace.forward_stage = producer->stage;
+    }
+  }
+}
+
+/**
+ * @brief Decode the instruction (ID stage)
+ *
+ * @param mips  MIPS simulator
+ */
+static void MODE_FN(decode_stage)(MIPSSim *mips) {
+  Instruction *instr = peek_pipeline_stage(&mips->pipeline, MODE_STAGE(ID));
+  if (instr == NULL || instr->stage != ID) {
+    return;
+  }
+  if (mips->pipeline.tracer) trace_stage(&mips->pipeline, instr, ID, mips->clock);
+
+  DecodedInstr *entries = get_decoded_page(&mips->memory, instr->pc / 4);
+  const DecodedInstr *decoded = lookup_decoded(&entries[(instr->pc / 4) & MEMORY_WORD_MASK], instr->instruction);
+  instr->invalid = instr->breakpoint = false;
+  DecodedInstr uncached;
+  if (decoded == NULL) {
+    // Breakpoints are only looked at on this path, and leave the rest of the cycle to finish_cycle(). With a split
+    // EX an older branch may still squash the instruction: it is decoded anyway and stops, or fails, in EX.
+    bool breakpoint = entries[(instr->pc / 4) & MEMORY_WORD_MASK].breakpoint;
+    if (MODE == NOT_PIPED || !may_be_squashed(&mips->pipeline)) {
+      if (breakpoint) {
+        mips->status = SIM_BREAKPOINT;
+      } else {
+        sim_error(mips, SIM_ERR_INVALID_OPCODE, "Invalid opcode: %08x", instr->instruction);
+      }
+      return;
+    }
+    instr->breakpoint = breakpoint;
+    if (!decode_instruction(instr->instruction, &uncached)) {
+      instr->invalid = true;
+      return;
+    }
+    decoded = &uncached;
+  }
+
+  instr->opcode = decoded->opcode;
+  instr->type = decoded->type;
+  instr->rs = decoded->rs;
+  instr->rt = decoded->rt;
+  instr->rd = decoded->rd;
+  instr->imm = decoded->imm;
+
+  if (instr->type != R_TYPE) {
+    instr->alu_out = (int32_t)(mips->pc - 4) + (instr->imm << 2);
+  }
+
+  if (MODE != NOT_PIPED) MODE_FN(check_hazards)(mips, instr);
+
+  LOG("DECODED: [Instruction %08x] Type: %d, Opcode: %d, Rs: %d, Rt: %d, Rd: %d, Imm: %d, ALU: %d\n", instr->instruction, instr->type, instr->opcode,
+      instr->rs, instr->rt, instr->rd, instr->imm, instr->alu_out);
+}
+
+/**
+ * @brief Execute stage of the pipeline (EX stage)
+ *
+ * @param mips  MIPS simulator
+ */
+static void MODE_FN(execute_stage)(MIPSSim *mips) {
+  Instruction *instr = peek_pipeline_stage(&mips->pipeline, MODE_STAGE(EX));
+  if (instr == NULL || instr->stage != EX) {
+    return;
+  }
+  if (mips->pipeline.tracer) trace_stage(&mips->pipeline, instr, EX, mips->clock);
+  // Held from ID while it could still be squashed (see decode_stage()); the debugger lifts the breakpoint
+  if (instr->breakpoint) {
+    mips->status = SIM_BREAKPOINT;
+    return;
+  }
+  if (instr->invalid) {
+    sim_error(mips, SIM_ERR_INVALID_OPCODE, "Invalid opcode: %08x", instr->instruction);
+    return;
+  }
+
+  // A multi-cycle operation executes in its first cycle and holds EX, and the stages before it, for the others
+  uint8_t cycles = MODE == NOT_PIPED ? 1 : execute_cycles(&mips->pipeline, instr);
+  if (instr->ex_cycles++ > 0) {
+    if (instr->ex_cycles < cycles) mips->pipeline.ex_busy = true;
+    return;
+  }
+  if (cycles > 1) {
+    mips->pipeline.ex_busy = true;
+    delay_write(&mips->pipeline, instr, cycles - 1);
+  }
+
+  if (mips->predictor) {
+    instr->alu_out = (int32_t)instr->pc + (instr->imm << 2);  // The PC has followed the prediction
+  } else if (MODE != NOT_PIPED) {
+    // Relative to the fetch PC, two words past the branch in the five-stage pipeline unless the program ends
+    // first. With split stages bubbles can sit between EX and IF, so that PC is derived from the branch's own
+    uint32_t fetch_pc = mips->pc;
+    if (mips->pipeline.depth != NUM_STAGES) fetch_pc = instr->pc + 8 < mips->memory_size * 4 ? instr->pc + 8 : mips->memory_size * 4;
+    instr->alu_out = (int32_t)(fetch_pc - 8) + (instr->imm << 2);
+  }
+  int32_t rs = instr->forward_reg[RS].is_forwarded ? instr->forward_reg[RS].reg : mips->registers[instr->rs].value;
+  int32_t rt = instr->forward_reg[RT].is_forwarded ? instr->forward_reg[RT].reg : mips->registers[instr->rt].value;
+
+  // Perform the operation based on the instruction type
+  switch (instr->type) {
+    case R_TYPE:  // R-Type instructions (ADD, SUB, MUL, OR, AND, XOR)
+      instr->alu_out = perform_operation(rs, rt, instr->opcode);
+      break;
+    case I_TYPE_IMM:  // I-Type instructions with immediate values (ADDI, SUBI, MULI, ORI, ANDI, XORI)
+      instr->alu_out = perform_operation(rs, instr->imm, instr->opcode);
+      break;
+    case I_TYPE_MEM:  // I-Type memory instructions (LDW, STW)
+      instr->alu_out = rs + instr->imm;
+      break;
+    case J_TYPE:  // J-Type instructions (BZ, BEQ, JR, HALT)
+      if (mips->predictor && instr->opcode != HALT) {
+        resolve_branch(mips, instr, rs, rt);
+        break;
+      }
+      bool branch_taken = control_flow(mips, instr, rs, rt);
+      // If branch is taken, flush the pipeline
+      if (branch_taken) {
+        if (MODE != NOT_PIPED) flush_pipeline(&mips->pipeline, EX);
+        if (mips->pipeline.tracer) trace_flush(&mips->pipeline, mips->clock, TRACE_FLUSHED);
+        mips->clock++;
+      }
+      if (mips->profiler) profile_branch(mips->profiler, &mips->pipeline, instr, branch_taken, branch_taken);
+      break;
+    default:
+      break;
+  }
+
+  count_instruction(mips, instr->opcode);
+}
+
+/**
+ * @brief Memory stage of the pipeline (MEM stage)
+ *
+ * @param mips  MIPS simulator
+ */
+static void MODE_FN(memory_stage)(MIPSSim *mips) {
+  Instruction *instr = peek_pipeline_stage(&mips->pipeline, MODE_STAGE(MEM));
+  if (instr == NULL || instr->stage != MEM) {
+    return;
+  }
+  if (mips->pipeline.tracer) trace_stage(&mips->pipeline, instr, MEM, mips->clock);
+
+  memory_access(mips, instr);
+  // The D-cache is blocking: the whole pipeline waits out a slow access
+  if (mips->dcache && instr->type == I_TYPE_MEM) {
+    mips->clock += cache_access(mips->dcache, instr->pc, (uint32_t)instr->alu_out, instr->opcode == STW) - 1;
+  }
+}
+
+/**
+ * @brief Writeback stage of the pipeline (WB stage)
+ *
+ * @param mips  MIPS simulator
+ */
+static void MODE_FN(writeback_stage)(MIPSSim *mips) {
+  Instruction *instr = peek_pipeline_stage(&mips->pipeline, MODE_STAGE(WB));
+  if (instr == NULL || instr->stage != WB) {
+    return;
+  }
+  if (mips->pipeline.tracer) trace_stage(&mips->pipeline, instr, WB, mips->clock);
+
+  write_back(mips, instr);
+  if (mips->cosim) check_retired(mips->cosim);
+}
+
+/**
+ * @brief Second half of a clock cycle: decode, fetch and advance the pipeline. Also completes a cycle that
+ * stopped at a breakpoint in ID, once the breakpoint is lifted.
+ *
+ * @param mips  MIPS simulator
+ */
+static void MODE_FN(finish_cycle)(MIPSSim *mips) {
+  MODE_FN(decode_stage)(mips);
+  if (mips->status != SIM_OK) return;
+  fetch_stage(mips);
+  mips->done = MODE_ADVANCE(&mips->pipeline);
+
+  // If not pipelined and the PC is within the memory bounds, keep processing
+  if (MODE == NOT_PIPED && mips->pc / 4 < mips->memory_size) mips->done = false;
+}
+
+/**
+ * @brief The clock cycle from EX on. Also completes a cycle that stopped at a breakpoint in EX, once the
+ * breakpoint is lifted.
+ *
+ * @param mips  MIPS simulator
+ */
+static void MODE_FN(finish_from_execute)(MIPSSim *mips) {
+  MODE_FN(execute_stage)(mips);
+  if (mips->status != SIM_OK) return;
+  if (mips->halt) {
+    if (MODE != NOT_PIPED && mips->pipeline.depth != NUM_STAGES) finish_halt(mips);
+    return;
+  }
+  MODE_FN(finish_cycle)(mips);
+}
+
+/**
+ * @brief Process the next clock cycle of the simulator
+ *
+ * @param mips  MIPS simulator
+ */
+static void MODE_FN(process)(MIPSSim *mips) {
+  LOG("-> CLK: %d, PC: %d\n", mips->clock, mips->pc);
+  if (mips->pipeline.tracer) trace_stages(&mips->pipeline, mips->clock);
+  MODE_FN(writeback_stage)(mips);
+  MODE_FN(memory_stage)(mips);
+  MODE_FN(finish_from_execute)(mips);
+}
+
+/**
+ * @brief Check whether the next cycle is a repeat of a RAW stall: EX holds only bubbles, nothing can be
+ * fetched and the stalled instruction in ID still has a hazard it cannot forward
+ *
+ * @param mips       MIPS simulator, whose last cycle stalled
+ * @param check_reg  Register the stall waits on
+ * @return Instruction the stall waits on, or NULL if the next cycle does not stall again
+ */
+static Instruction *MODE_FN(stall_continues)(MIPSSim *mips, int8_t *check_reg) {
+  Pipeline *p = &mips->pipeline;
+  Instruction *instr = peek_pipeline_stage(p, ID);
+  if (!pipeline_range_empty(p, p->first[EX], p->work[EX]) || instr == NULL || instr->stage != ID) return NULL;
+  if (peek_pipeline_stage(p, IF) == NULL && mips->pc / 4 < mips->memory_size) return NULL;
+
+  PendingWrite *write = MODE_FN(find_stall)(mips, instr, check_reg);
+  return write != NULL ? write->producer : NULL;
+}
+
+/**
+ * @brief Skip cycles whose outcome is already known, with the same effect on the state, clock and stall
+ * count as stepping through them: a whole non-pipelined instruction, or the remaining cycles of a RAW stall,
+ * in which only MEM and WB work. Stops short of stop_clock and the cycle limit so they are hit exactly.
+ *
+ * @param mips        MIPS simulator
+ * @param stop_clock  Clock value the run pauses at (0 for none)
+ * @param stalled     Whether the last cycle stalled
+ * @return true if cycles were skipped, false if the next cycle needs process()
+ */
+static bool MODE_FN(skip_cycles)(MIPSSim *mips, uint32_t stop_clock, bool stalled) {
+#ifdef DEBUG
+  return false;  // Traces show every cycle
+#endif
+  uint32_t horizon = UINT32_MAX;
+  if (stop_clock) horizon = stop_clock;
+  if (mips->cycle_limit && mips->cycle_limit < horizon) horizon = mips->cycle_limit;
+
+  if (MODE == NOT_PIPED) {
+    // A taken branch adds a cycle to the five stages, and cache misses add their latency
+    uint32_t longest = NUM_STAGES + 1;
+    if (mips->icache) longest += mips->icache->config.hit_latency + mips->icache->config.miss_penalty;
+    if (mips->dcache) longest += mips->dcache->config.hit_latency + 2 * mips->dcache->config.miss_penalty;
+    if (peek_pipeline_stage(&mips->pipeline, IF) != NULL || mips->pc / 4 >= mips->memory_size || horizon < mips->clock + longest) {
+      return false;
+    }
+    run_instruction(mips);
+    return true;
+  }
+
+  uint32_t clock = mips->clock;
+  Instruction *producer;
+  int8_t check_reg;
+  while (stalled && mips->clock < horizon && (producer = MODE_FN(stall_continues)(mips, &check_reg)) != NULL) {
+    if (mips->profiler) profile_stall(mips->profiler, peek_pipeline_stage(&mips->pipeline, ID), producer, check_reg, mips->clock);
+    if (mips->pipeline.tracer) trace_stages(&mips->pipeline, mips->clock);
+    MODE_FN(writeback_stage)(mips);
+    MODE_FN(memory_stage)(mips);
+    stall_pipeline(&mips->pipeline);
+    mips->done = MODE_ADVANCE(&mips->pipeline);
+    mips->clock++;
+  }
+  return mips->clock != clock;
+}
+
+/**
+ * @brief Run the pipeline model until the program halts or drains, or the clock reaches a given cycle
+ *
+ * @param mips        MIPS simulator
+ * @param stop_clock  Clock value to pause at (0 to run to the end)
+ * @return true if the program finished (or failed), false if it was paused at stop_clock
+ */
+static bool MODE_FN(run_until)(MIPSSim *mips, uint32_t stop_clock) {
+  bool stalled = false;
+  while (!mips->done && !mips->halt) {
+    if (stop_clock && mips->clock >= stop_clock) return false;
+    if (!MODE_FN(skip_cycles)(mips, stop_clock, stalled)) {
+      uint32_t stalls = mips->pipeline.total_stalls;
+      MODE_FN(process)(mips);
+      if (mips->status != SIM_OK) return true;
+      mips->clock++;
+#ifdef DEBUG
+      print_pipeline_state(&mips->pipeline);
+#endif
+      stalled = mips->pipeline.total_stalls != stalls;
+    } else if (mips->status != SIM_OK) {
+      return true;
+    }
+    if (mips->cycle_limit && mips->clock > mips->cycle_limit) {
+      sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);
+      return true;
+    }
+  }
+  correct_pc(mips);
+  return true;
+}
+
+#undef MODE_STAGE
+#undef MODE_ADVANCE
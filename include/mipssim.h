@@ -0,0 +1,69 @@
+/**
+ * @file  mipssim.h
+ * @brief Public API of libmipssim: the pipeline model as a library, for hosting many simulations in one process
+ *
+ * Every function reports errors through its return value and nothing is printed. Simulators share no
+ * state, so different threads can each run their own. The library only aborts when the host runs out
+ * of memory while a program is running.
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _MIPSSIM_H_
+#define _MIPSSIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define MIPSSIM_API __attribute__((visibility("default")))
+#else
+#define MIPSSIM_API
+#endif
+
+typedef enum {
+  MIPSSIM_OK,                  // The program can continue
+  MIPSSIM_FINISHED,            // The program halted or ran off the end of its memory
+  MIPSSIM_ERR_ARGUMENT,        // Invalid argument: NULL pointer, mode, register or unaligned address
+  MIPSSIM_ERR_NO_MEMORY,
+  MIPSSIM_ERR_IMAGE,           // Invalid binary image
+  MIPSSIM_ERR_INVALID_OPCODE,  // The program fetched an invalid instruction
+  MIPSSIM_ERR_CYCLE_LIMIT      // The program passed the cycle limit
+} MipsSimStatus;
+
+typedef struct {
+  uint32_t clock;  // Clock cycles so far
+  uint32_t pc;     // Fetch PC (byte address)
+  uint32_t stalls;
+  uint32_t instructions;  // Instructions executed, by class below
+  uint32_t arithmetic;
+  uint32_t logical;
+  uint32_t memory;
+  uint32_t control;
+  bool halted;    // HALT executed
+  bool finished;  // Halted, ran off the end of memory or failed
+} MipsSimStats;
+
+typedef struct MipsSimHandle MipsSimHandle;
+
+MIPSSIM_API MipsSimStatus mipssim_create(const void *image, size_t size, int mode, MipsSimHandle **sim);
+MIPSSIM_API void mipssim_destroy(MipsSimHandle *sim);
+MIPSSIM_API MipsSimStatus mipssim_set_cycle_limit(MipsSimHandle *sim, uint32_t cycles);
+MIPSSIM_API MipsSimStatus mipssim_run(MipsSimHandle *sim);
+MIPSSIM_API MipsSimStatus mipssim_run_cycles(MipsSimHandle *sim, uint32_t cycles);
+MIPSSIM_API MipsSimStatus mipssim_run_until(MipsSimHandle *sim, uint32_t pc);
+MIPSSIM_API MipsSimStatus mipssim_get_stats(const MipsSimHandle *sim, MipsSimStats *stats);
+MIPSSIM_API MipsSimStatus mipssim_read_register(const MipsSimHandle *sim, unsigned reg, int32_t *value);
+MIPSSIM_API MipsSimStatus mipssim_read_memory(MipsSimHandle *sim, uint32_t address, int32_t *value);
+MIPSSIM_API const char *mipssim_error(const MipsSimHandle *sim);
+MIPSSIM_API const char *mipssim_status_name(MipsSimStatus status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * @file  multicore.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _MULTICORE_H_
+#define _MULTICORE_H_
+
+#include <pthread.h>
+
+#include "common.h"
+#include "memory.h"
+#include "mips.h"
+
+#define MULTICORE_MAX_CORES 64
+#define MULTICORE_DEFAULT_QUANTUM 1000
+
+typedef struct {
+  char *image;        // Image file, NULL for the one given with -f
+  uint32_t entry_pc;  // Byte address the core starts at, if has_entry_pc
+  bool has_entry_pc;  // Otherwise the core starts at its image's entry
+} CoreSpec;
+
+typedef struct {
+  CoreSpec cores[MULTICORE_MAX_CORES];
+  uint32_t num_cores;
+  uint32_t quantum;  // Cycles each core runs between synchronisations
+  char *names;       // Copy of the core list, split into the image names
+} MulticoreConfig;
+
+/*
+ * Every core runs on a copy of the shared memory and logs its stores. At the end of each quantum the
+ * logs are replayed into every copy in core order, so a store becomes visible to the other cores at the
+ * next quantum and conflicting stores in one quantum resolve to the highest-numbered core's value.
+ */
+typedef struct {
+  MulticoreConfig config;
+  MIPSSim *cores[MULTICORE_MAX_CORES];
+  MemoryLog logs[MULTICORE_MAX_CORES];  // Stores of each core in the current quantum
+  bool finished[MULTICORE_MAX_CORES];   // Halted, drained or failed
+  uint32_t quanta;                      // Quanta run until every core finished
+  pthread_barrier_t barrier;
+} Multicore;
+
+bool parse_multicore_config(const char *spec, MulticoreConfig *config);
+void free_multicore_config(MulticoreConfig *config);
+SimStatus init_multicore(Multicore *mc, const MulticoreConfig *config, char *image, Mode mode, uint32_t cycle_limit,
+                         const PipelineConfig *pipeline);
+void run_multicore(Multicore *mc);
+void print_multicore_results(Multicore *mc, const char *image);
+void destroy_multicore(Multicore *mc);
+
+#endif
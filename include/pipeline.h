@@ -3,20 +3,117 @@
 
 #include "common.h"
 
+struct Tracer;
+
+/*
+ * Cycles taken by the stages that can be split into several physical stages. The defaults give the
+ * classic five-stage pipeline; override them at build time (make CFLAGS+=-DPIPELINE_MEM_CYCLES=2)
+ * or at startup with -P.
+ */
+#ifndef PIPELINE_IF_CYCLES
+#define PIPELINE_IF_CYCLES 1
+#endif
+#ifndef PIPELINE_EX_CYCLES
+#define PIPELINE_EX_CYCLES 1
+#endif
+#ifndef PIPELINE_MEM_CYCLES
+#define PIPELINE_MEM_CYCLES 1
+#endif
+#ifndef PIPELINE_MUL_CYCLES
+#define PIPELINE_MUL_CYCLES 1  // Cycles MUL and MULI hold the last EX stage
+#endif
+
+#define PIPELINE_MAX_STAGE_CYCLES 4  // Limit for IF, EX and MEM
+#define PIPELINE_MAX_MUL_CYCLES 32
+#define PIPELINE_MAX_DEPTH (2 + 3 * PIPELINE_MAX_STAGE_CYCLES)
+
+#if PIPELINE_IF_CYCLES < 1 || PIPELINE_IF_CYCLES > PIPELINE_MAX_STAGE_CYCLES || PIPELINE_EX_CYCLES < 1 || \
+    PIPELINE_EX_CYCLES > PIPELINE_MAX_STAGE_CYCLES || PIPELINE_MEM_CYCLES < 1 || PIPELINE_MEM_CYCLES > PIPELINE_MAX_STAGE_CYCLES
+#error "PIPELINE_IF_CYCLES, PIPELINE_EX_CYCLES and PIPELINE_MEM_CYCLES must be between 1 and PIPELINE_MAX_STAGE_CYCLES"
+#endif
+#if PIPELINE_MUL_CYCLES < 1 || PIPELINE_MUL_CYCLES > PIPELINE_MAX_MUL_CYCLES
+#error "PIPELINE_MUL_CYCLES must be between 1 and PIPELINE_MAX_MUL_CYCLES"
+#endif
+
+/* At most one instruction per physical stage can be in flight */
+#define PIPELINE_SLOTS PIPELINE_MAX_DEPTH
+
 typedef struct {
-  Instruction *stages[NUM_STAGES];
+  uint8_t cycles[NUM_STAGES];  // Physical stages each stage is split into (always 1 for ID and WB)
+  uint8_t mul_cycles;          // Cycles MUL and MULI spend in the last EX stage
+} PipelineConfig;
+
+/* A register write still on its way to the register file */
+typedef struct {
+  Instruction *producer;  // Youngest instruction past ID that writes the register
+  uint32_t forward_step;  // First step its result can be forwarded
+  uint32_t ready_step;    // First step the register file holds it (the producer has reached WB)
+} PendingWrite;
+
+/* Pending writes by register, so hazard checks cost the same whatever the pipeline holds */
+typedef struct {
+  uint32_t pending;  // Bit r set while writes[r] may still be pending
+  PendingWrite writes[32];
+} Scoreboard;
+
+typedef struct {
+  Instruction *stages[PIPELINE_MAX_DEPTH];  // Physical stages, in program order from the oldest (last) to the youngest
+  PipelineConfig config;
+  uint8_t depth;                     // Physical stages in use (one instruction at a time in stages[0] without pipelining)
+  uint8_t first[NUM_STAGES];         // First physical stage of each stage
+  uint8_t work[NUM_STAGES];          // Physical stage each stage function works on: the first for IF, the last for the others
+  uint8_t kind[PIPELINE_MAX_DEPTH];  // Stage each physical stage belongs to
+  Instruction slots[PIPELINE_SLOTS];
+  Instruction *free_slots[PIPELINE_SLOTS];
+  uint8_t num_free;
   bool is_pipelined;
   bool is_stalled;
+  bool fetch_busy;  // The instruction in IF is still being fetched (I-cache miss) and stays there this cycle
+  bool ex_busy;     // A multi-cycle operation holds the last EX stage, and every stage before it, this cycle
   uint32_t total_stalls;
+  uint32_t step;  // Number of times the pipeline has advanced
+  Scoreboard scoreboard;
+  struct Tracer *tracer;  // Pipeline trace being recorded, NULL if tracing is off
 } Pipeline;
 
 /* Function prototypes */
 void init_pipeline(Pipeline *p, bool is_pipelined);
+void default_pipeline_config(PipelineConfig *config);
+bool is_default_pipeline_config(const PipelineConfig *config);
+bool parse_pipeline_config(const char *spec, PipelineConfig *config);
+void configure_pipeline(Pipeline *p, const PipelineConfig *config);
+void print_pipeline_config(const PipelineConfig *config, FILE *file);
+uint8_t execute_cycles(const Pipeline *p, const Instruction *instr);
+bool pipeline_range_empty(Pipeline *p, uint8_t from, uint8_t to);
+bool may_be_squashed(const Pipeline *p);
 bool advance_pipeline(Pipeline *p);
+bool advance_stages(Pipeline *p);
+bool advance_in_place(Pipeline *p);
+Instruction *alloc_instruction(Pipeline *p);
+void release_instruction(Pipeline *p, Instruction *instr);
 void fetch_instruction(Pipeline *p, Instruction *instr);
 Instruction *peek_pipeline_stage(Pipeline *p, PipelineStage stage);
 void print_pipeline_state(Pipeline *p);
 void flush_pipeline(Pipeline *p, PipelineStage stage);
 void stall_pipeline(Pipeline *p);
+void record_write(Pipeline *p, Instruction *instr, uint8_t position);
+void delay_write(Pipeline *p, const Instruction *instr, uint32_t cycles);
+void rebuild_scoreboard(Pipeline *p);
+
+/**
+ * @brief Find the pending write of a register
+ *
+ * @param p   Pipeline
+ * @param reg Register
+ * @return Pending write, or NULL if the register file already holds the register's latest value
+ */
+static inline PendingWrite *find_pending_write(Pipeline *p, uint8_t reg) {
+  if (!(p->scoreboard.pending >> reg & 1)) return NULL;
+  if (p->step >= p->scoreboard.writes[reg].ready_step) {
+    p->scoreboard.pending &= ~(1u << reg);
+    return NULL;
+  }
+  return &p->scoreboard.writes[reg];
+}
 
 #endif
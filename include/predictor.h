@@ -0,0 +1,45 @@
+/**
+ * @file  predictor.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _PREDICTOR_H_
+#define _PREDICTOR_H_
+
+#include "common.h"
+
+#define PREDICTOR_TABLE_BITS 12  // 2-bit counters of the bimodal and gshare tables (and gshare history bits)
+#define PREDICTOR_BTB_ENTRIES 256  // BTB size of "-B btb" when none is given
+
+typedef enum {
+  PREDICT_NOT_TAKEN,  // Static: always fetch the next instruction
+  PREDICT_BTFN,       // Static: backward branches taken, forward branches not taken
+  PREDICT_BIMODAL,    // 2-bit saturating counters indexed by PC
+  PREDICT_GSHARE,     // 2-bit counters indexed by PC xor global history
+  PREDICT_BTB         // A BTB hit alone predicts taken
+} PredictorKind;
+
+typedef struct {
+  uint32_t pc;  // Branch address, 0xFFFFFFFF if the entry is empty
+  uint32_t target;
+} BTBEntry;
+
+typedef struct Predictor {
+  PredictorKind kind;
+  uint8_t *counters;
+  uint32_t history;       // Global history, updated with each prediction and repaired on mispredictions
+  BTBEntry *btb;          // Direct-mapped; NULL to take BZ/BEQ targets from the fetched word
+  uint32_t btb_entries;
+  uint64_t branches;       // Branches resolved
+  uint64_t mispredictions;
+  uint64_t btb_misses;     // Taken branches the BTB had no target for
+} Predictor;
+
+Predictor *create_predictor(const char *spec);
+void destroy_predictor(Predictor *predictor);
+const char *predictor_name(const Predictor *predictor);
+uint32_t predict_next_pc(Predictor *predictor, uint32_t pc, int32_t word, uint32_t *history);
+void update_predictor(Predictor *predictor, uint32_t pc, uint32_t history, bool taken, uint32_t target, bool mispredicted);
+void print_predictor_stats(const Predictor *predictor, uint32_t instructions, FILE *file);
+
+#endif
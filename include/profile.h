@@ -0,0 +1,53 @@
+/**
+ * @file  profile.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include "common.h"
+#include "mips.h"
+#include "pipeline.h"
+
+#define PROFILE_REPORT_ROWS 20  // Rows of each table in the printed report
+
+typedef enum {
+  PROFILE_HAZARD,  // Stall cycles of a consumer waiting on a producer's register
+  PROFILE_BRANCH   // Executions and flushes of a branch
+} ProfileKind;
+
+typedef struct {
+  ProfileKind kind;
+  uint32_t pc;                   // Consuming instruction, or branch
+  uint32_t producer_pc;          // Hazards only
+  int8_t reg;                    // Register causing the hazard (hazards only)
+  int32_t instruction;           // Words as first seen
+  int32_t producer_instruction;  // Hazards only
+  uint64_t cycles;               // Stall cycles, or cycles lost to flushes
+  uint64_t events;               // Stalls (a run of stall cycles counts once), or pipeline flushes of a branch
+  uint64_t executions;           // Branches only
+  uint64_t taken;                // Branches only
+  uint64_t flushed;              // Instructions flushed (branches only)
+  bool used;
+} ProfileEntry;
+
+/* Open-addressing hash table of entries keyed by kind, PC, producer PC and register */
+typedef struct Profiler {
+  ProfileEntry *entries;
+  uint32_t capacity;
+  uint32_t count;
+  ProfileEntry last_stall;  // Key of the last stall, to tell a new stall from a continuing one
+  uint32_t last_stall_clock;
+  uint64_t stall_cycles;
+  uint64_t flush_cycles;
+} Profiler;
+
+Profiler *create_profiler(void);
+void destroy_profiler(Profiler *profiler);
+void profile_stall(Profiler *profiler, const Instruction *consumer, const Instruction *producer, int8_t reg, uint32_t clock);
+void profile_branch(Profiler *profiler, Pipeline *p, const Instruction *branch, bool taken, bool flush);
+void print_profile(Profiler *profiler, MIPSSim *mips, FILE *file);
+bool write_profile_json(Profiler *profiler, MIPSSim *mips, const char *filename);
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * @file  sampling.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _SAMPLING_H_
+#define _SAMPLING_H_
+
+#include "common.h"
+#include "mips.h"
+
+typedef struct {
+  uint64_t fast_forward;  // Instructions executed functionally between samples
+  uint64_t warmup;        // Instructions simulated in detail before each measurement
+  uint64_t measure;       // Instructions measured per sample
+} SamplingConfig;
+
+typedef struct {
+  uint32_t samples;
+  uint64_t instructions;           // Instructions executed by the whole program
+  uint64_t detailed_instructions;  // Instructions simulated in detail (warm-up and measurement)
+  uint64_t measured_instructions;
+  uint64_t measured_cycles;
+  uint64_t measured_stalls;
+  // Sums of squares and products of the per-sample counts, for the variance of the ratio estimates
+  double instructions_sq, cycles_sq, stalls_sq;
+  double cycles_instructions, stalls_instructions;
+
+  // Estimates for the whole program, with the half-width of their 95% confidence intervals
+  bool exact;  // Every instruction was simulated in detail, so the estimates are the actual counts
+  double cpi, cpi_error;
+  double cycles, cycles_error;
+  double stalls, stalls_error;
+} SamplingResult;
+
+void run_sampled(MIPSSim *mips, const SamplingConfig *config, SamplingResult *result);
+
+#endif
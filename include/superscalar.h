@@ -0,0 +1,55 @@
+/**
+ * @file  superscalar.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _SUPERSCALAR_H_
+#define _SUPERSCALAR_H_
+
+#include "common.h"
+#include "mips.h"
+
+#define SUPERSCALAR_MAX_WIDTH 8
+
+typedef struct {
+  uint32_t width;      // Instructions fetched, issued and retired per cycle
+  uint32_t mem_ports;  // Loads and stores that can issue in the same cycle
+} SuperscalarConfig;
+
+/* Why an issue slot went unused */
+typedef enum {
+  LOST_FRONT_END,   // Nothing to issue: the fetch group was short, flushed, or the program ended
+  LOST_LOAD_USE,    // Waiting on a load still in EX
+  LOST_STORE_DATA,  // Reads the data register of a store still in EX or MEM
+  LOST_GROUP,       // Depends on an older instruction issuing in the same cycle
+  LOST_MEM_PORT,    // Every memory port is taken this cycle
+  NUM_LOST_REASONS
+} LostSlotReason;
+
+typedef struct {
+  uint64_t issued;                                      // Instructions issued, squashed ones included
+  uint64_t squashed;                                    // Issued behind a taken branch in the same group
+  uint64_t issue_cycles[SUPERSCALAR_MAX_WIDTH + 1];     // Cycles by the number of instructions issued
+  uint64_t lost_slots[NUM_LOST_REASONS];
+} SuperscalarResult;
+
+/* Issue groups in flight, each held in program order */
+typedef struct {
+  Instruction *instrs[SUPERSCALAR_MAX_WIDTH];
+  uint32_t count;
+} IssueGroup;
+
+typedef struct {
+  SuperscalarConfig config;
+  IssueGroup stages[NUM_STAGES];
+  Instruction slots[NUM_STAGES * SUPERSCALAR_MAX_WIDTH];
+  Instruction *free_slots[NUM_STAGES * SUPERSCALAR_MAX_WIDTH];
+  uint32_t num_free;
+  SuperscalarResult *result;
+} Superscalar;
+
+bool parse_superscalar_config(const char *spec, SuperscalarConfig *config);
+void run_superscalar(MIPSSim *mips, const SuperscalarConfig *config, SuperscalarResult *result);
+void print_superscalar_stats(MIPSSim *mips, const SuperscalarConfig *config, const SuperscalarResult *result, FILE *file);
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file  timing.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+#include "common.h"
+#include "mips.h"
+
+#define RETIRE_BUFFER_SIZE 4096
+#define MAX_TIMING_MODELS 3
+
+/* One instruction retired by the functional core */
+typedef struct {
+  uint32_t pc;
+  Opcode opcode;
+  InstructionType type;
+  uint8_t rs;
+  uint8_t rt;
+  uint8_t rd;
+  uint32_t reads;  // Bitmask of the registers read
+  int8_t writes;   // Register written, -1 if none
+  bool taken;      // Branch outcome (always true for JR and HALT)
+  int32_t mem_address;
+} RetiredInstr;
+
+/* Instruction that a pipelined timing model still has in EX or MEM */
+typedef struct {
+  uint64_t ex_cycle;
+  int8_t hazard_reg;  // Register check_hazards() treats as the destination, -1 if none
+  InstructionType type;
+  Opcode opcode;
+} TimedInstr;
+
+typedef struct TimingModel TimingModel;
+
+struct TimingModel {
+  const char *name;
+  Mode mode;
+  void (*retire)(TimingModel *model, const RetiredInstr *instr);
+  void (*finish)(TimingModel *model, bool halted);
+
+  /* Results */
+  uint64_t clock;
+  uint64_t stalls;
+
+  /* Model state */
+  uint64_t instructions;
+  uint64_t taken;
+  uint64_t fetch_cycle;
+  uint64_t last_ex_cycle;
+  TimedInstr recent[2];  // [0]: previous instruction, [1]: the one before it
+};
+
+/* Buffers the retired-instruction stream and hands it to every attached timing model */
+typedef struct {
+  RetiredInstr buffer[RETIRE_BUFFER_SIZE];
+  uint32_t count;
+  TimingModel *models[MAX_TIMING_MODELS];
+  int num_models;
+} RetireStream;
+
+void init_timing_model(TimingModel *model, Mode mode);
+void init_retire_stream(RetireStream *stream);
+void attach_timing_model(RetireStream *stream, TimingModel *model);
+void flush_retire_stream(RetireStream *stream);
+void finish_retire_stream(RetireStream *stream, bool halted);
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * @file  trace.h
+ * @copyright Copyright (c) 2024
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "common.h"
+#include "pipeline.h"
+
+#define TRACE_MAGIC "MIPSTRC"
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_RECORDS 32768  // Records written per fwrite (1 MiB)
+#define TRACE_NONE 0xFFFF
+
+/* Record flags */
+#define TRACE_FLUSHED 0x01    // Flushed by a taken branch
+#define TRACE_FORWARDED 0x02  // An operand was forwarded (from forward_stage)
+#define TRACE_SQUASHED 0x04   // Squashed before executing when the pipeline was drained
+#define TRACE_IN_FLIGHT 0x08  // Still in the pipeline when the run ended
+
+/*
+ * File layout:
+ *   TraceHeader
+ *   TraceRecord[]  (one per instruction, in the order they leave the pipeline)
+ */
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t mode;
+} TraceHeader;
+
+typedef struct {
+  uint32_t seq;  // Fetch order
+  uint32_t pc;
+  int32_t instruction;
+  uint32_t fetch_cycle;
+  uint16_t stage_offset[NUM_STAGES - 1];  // Cycles from fetch to entering ID, EX, MEM and WB, TRACE_NONE if not reached
+  uint16_t end_offset;                    // Cycles from fetch to leaving the pipeline
+  uint16_t stalls;
+  uint8_t flags;
+  uint8_t forward_stage;
+  uint8_t reserved[2];
+} TraceRecord;
+
+typedef struct Tracer {
+  FILE *file;
+  TraceRecord *records;
+  uint32_t count;
+  uint32_t next_seq;
+  bool ok;
+} Tracer;
+
+Tracer *open_trace(const char *filename, int mode);
+void trace_instruction(Tracer *tracer, const Instruction *instr);
+void trace_flush(Pipeline *p, uint32_t clock, uint8_t flag);
+void trace_stages(Pipeline *p, uint32_t clock);
+bool close_trace(Tracer *tracer, Pipeline *p, uint32_t clock);
+
+/**
+ * @brief Record the cycle an instruction enters a stage (the first time only)
+ *
+ * @param p     Pipeline, with a tracer attached
+ * @param instr Instruction
+ * @param stage Stage entered
+ * @param clock Current cycle
+ */
+static inline void trace_stage(Pipeline *p, Instruction *instr, PipelineStage stage, uint32_t clock) {
+  if (instr->trace.cycles[stage] == 0) {
+    if (stage == IF) instr->trace.seq = p->tracer->next_seq++;
+    instr->trace.cycles[stage] = clock;
+  }
+}
+
+#endif
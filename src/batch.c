@@ -0,0 +1,338 @@
+/**
+ * @file  batch.c
+ * @brief Batch runner: simulates every job of a manifest on a work-stealing thread pool
+ * @copyright Copyright (c) 2024
+ */
+
+#include "batch.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "functional.h"
+#include "jit.h"
+#include "image.h"
+#include "mips.h"
+
+/* Pending jobs of one worker: the owner takes from the head, thieves take from the tail */
+typedef struct {
+  pthread_mutex_t lock;
+  size_t head;
+  size_t tail;
+} WorkDeque;
+
+typedef struct {
+  Batch *batch;
+  WorkDeque *deques;
+  int num_workers;
+  uint32_t cycle_limit;
+} WorkerPool;
+
+typedef struct {
+  WorkerPool *pool;
+  int id;
+} Worker;
+
+static bool add_job(Batch *batch, const char *image, Mode mode, Engine engine) {
+  if (batch->num_jobs == batch->capacity) {
+    size_t capacity = batch->capacity ? batch->capacity * 2 : 64;
+    BatchJob *jobs = realloc(batch->jobs, capacity * sizeof(BatchJob));
+    if (jobs == NULL) return false;
+    batch->jobs = jobs;
+    batch->capacity = capacity;
+  }
+  BatchJob *job = &batch->jobs[batch->num_jobs++];
+  memset(job, 0, sizeof(BatchJob));
+  job->image = strdup(image);
+  job->mode = mode;
+  job->engine = engine;
+  return job->image != NULL;
+}
+
+/**
+ * @brief Load a batch manifest. Each line is "<image> <mode|all> [engine]"; '#' starts a comment.
+ *
+ * @param batch     Batch to fill
+ * @param filename  Manifest file
+ * @return true on success, false if the manifest cannot be read or has an invalid line
+ */
+bool load_manifest(Batch *batch, const char *filename) {
+  memset(batch, 0, sizeof(Batch));
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    perror("Failed to open manifest");
+    return false;
+  }
+
+  char line[4096];
+  int line_number = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file)) {
+    line_number++;
+    char *comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+
+    char image[4096], mode_str[16] = "";
+    int engine = ENGINE_PIPELINE;
+    int fields = sscanf(line, "%4095s %15s %d", image, mode_str, &engine);
+    if (fields <= 0) continue;  // Blank line
+
+    bool all_modes = strcmp(mode_str, "all") == 0;
+    char *end;
+    long mode = strtol(mode_str, &end, 10);
+    if (fields < 2 || (!all_modes && (*end != '\0' || mode < NOT_PIPED || mode > PIPED_FWD))) {
+      fprintf(stderr, "%s:%d: expected \"<image> <mode|all> [engine]\"\n", filename, line_number);
+      ok = false;
+    } else if (engine < ENGINE_PIPELINE || engine > ENGINE_JIT || (engine != ENGINE_PIPELINE && (all_modes || mode != NOT_PIPED))) {
+      fprintf(stderr, "%s:%d: invalid engine %d (the functional engines only support mode 0)\n", filename, line_number, engine);
+      ok = false;
+    } else if (all_modes) {
+      for (Mode m = NOT_PIPED; m <= PIPED_FWD && ok; m++) ok = add_job(batch, image, m, engine);
+    } else {
+      ok = add_job(batch, image, (Mode)mode, engine);
+    }
+  }
+  fclose(file);
+  return ok;
+}
+
+/**
+ * @brief Run one job to completion on a worker's simulator and record its results
+ *
+ * @param mips        Simulator owned by the worker
+ * @param job         Job to run
+ * @param cycle_limit Cycle limit for the job (0 for no limit)
+ */
+static void run_job(MIPSSim *mips, BatchJob *job, uint32_t cycle_limit) {
+  init_simulator(mips, job->mode);
+  mips->cycle_limit = cycle_limit;
+  if (load_memory(mips, job->image) == SIM_OK) {
+    if (job->engine == ENGINE_FUNCTIONAL) {
+      run_functional(mips, NULL);
+    } else if (job->engine == ENGINE_JIT) {
+      run_jit(mips);
+    } else {
+      run_pipeline(mips);
+    }
+  }
+
+  job->status = mips->status;
+  memcpy(job->error, mips->error, sizeof(job->error));
+  job->cycles = mips->clock;
+  job->stalls = mips->pipeline.total_stalls;
+  job->pc = mips->pc;
+  job->halted = mips->halt;
+  job->counts = mips->counts;
+  destroy_memory(&mips->memory);
+}
+
+/**
+ * @brief Take the next job for a worker: its own deque first, then steal from the others
+ *
+ * @param pool  Worker pool
+ * @param id    Worker id
+ * @param job   Index of the job taken
+ * @return true if a job was taken, false once every deque is empty
+ */
+static bool take_job(WorkerPool *pool, int id, size_t *job) {
+  for (int i = 0; i < pool->num_workers; i++) {
+    WorkDeque *deque = &pool->deques[(id + i) % pool->num_workers];
+    bool taken = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+      *job = (i == 0) ? deque->head++ : --deque->tail;
+      taken = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    if (taken) return true;
+  }
+  return false;
+}
+
+static void *worker_main(void *arg) {
+  Worker *worker = arg;
+  WorkerPool *pool = worker->pool;
+  MIPSSim *mips = malloc(sizeof(MIPSSim));
+  if (mips == NULL) return NULL;
+
+  size_t job;
+  while (take_job(pool, worker->id, &job)) {
+    run_job(mips, &pool->batch->jobs[job], pool->cycle_limit);
+  }
+
+  destroy_simulator(mips);
+  return NULL;
+}
+
+/**
+ * @brief Drop every job not yet taken, so the workers stop after their current one
+ *
+ * @param pool  Worker pool
+ */
+static void cancel_jobs(WorkerPool *pool) {
+  for (int i = 0; i < pool->num_workers; i++) {
+    pthread_mutex_lock(&pool->deques[i].lock);
+    pool->deques[i].tail = pool->deques[i].head;
+    pthread_mutex_unlock(&pool->deques[i].lock);
+  }
+}
+
+/**
+ * @brief Run every job of the batch. Jobs are split evenly between workers, and idle workers steal
+ * from the tail of busy ones. Each worker reuses a single simulator for all of its jobs.
+ *
+ * @param batch       Batch to run
+ * @param num_workers Number of worker threads (0 to use every online CPU)
+ * @param cycle_limit Cycle limit for each job (0 for no limit)
+ * @return true once every job has run, false if the workers could not be started
+ */
+bool run_batch(Batch *batch, int num_workers, uint32_t cycle_limit) {
+  if (num_workers <= 0) num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_workers <= 0) num_workers = 1;
+  if ((size_t)num_workers > batch->num_jobs) num_workers = batch->num_jobs ? (int)batch->num_jobs : 1;
+
+  WorkerPool pool = {.batch = batch, .num_workers = num_workers, .cycle_limit = cycle_limit};
+  pool.deques = calloc(num_workers, sizeof(WorkDeque));
+  Worker *workers = calloc(num_workers, sizeof(Worker));
+  pthread_t *threads = calloc(num_workers, sizeof(pthread_t));
+  if (pool.deques == NULL || workers == NULL || threads == NULL) {
+    fprintf(stderr, "Failed to start batch: out of memory\n");
+    free(threads);
+    free(workers);
+    free(pool.deques);
+    return false;
+  }
+
+  size_t per_worker = batch->num_jobs / num_workers, extra = batch->num_jobs % num_workers, next = 0;
+  for (int i = 0; i < num_workers; i++) {
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+    pool.deques[i].head = next;
+    next += per_worker + ((size_t)i < extra);
+    pool.deques[i].tail = next;
+    workers[i] = (Worker){.pool = &pool, .id = i};
+  }
+
+  // The calling thread acts as worker 0. If a thread cannot be started, the ones already running are
+  // stopped and the batch fails.
+  int started = 1;
+  int error = 0;
+  while (started < num_workers && (error = pthread_create(&threads[started], NULL, worker_main, &workers[started])) == 0) started++;
+  if (error != 0) {
+    fprintf(stderr, "Failed to start batch worker: %s\n", strerror(error));
+    cancel_jobs(&pool);
+  } else {
+    worker_main(&workers[0]);
+  }
+  for (int i = 1; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (int i = 0; i < num_workers; i++) {
+    pthread_mutex_destroy(&pool.deques[i].lock);
+  }
+  free(threads);
+  free(workers);
+  free(pool.deques);
+  return error == 0;
+}
+
+/**
+ * @brief Write a string as a JSON string literal. Control characters are written as \uXXXX escapes.
+ *
+ * @param file  Output file
+ * @param str   String
+ */
+void write_json_string(FILE *file, const char *str) {
+  fputc('"', file);
+  for (; *str; str++) {
+    unsigned char c = *str;
+    if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+      continue;
+    }
+    if (c == '"' || c == '\\') fputc('\\', file);
+    fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+/**
+ * @brief Write a string as a quoted CSV field, doubling the quotes inside it
+ *
+ * @param file  Output file
+ * @param str   String
+ */
+static void write_csv_string(FILE *file, const char *str) {
+  fputc('"', file);
+  for (; *str; str++) {
+    if (*str == '"') fputc('"', file);
+    fputc(*str, file);
+  }
+  fputc('"', file);
+}
+
+/**
+ * @brief Write the results of every job, in manifest order. A filename ending in ".json" gives a JSON
+ * array, anything else gives CSV. "-" writes to stdout.
+ *
+ * @param batch     Batch that has been run
+ * @param filename  Output file
+ * @return true on success, false if the file cannot be written
+ */
+bool write_batch_results(Batch *batch, const char *filename) {
+  bool to_stdout = strcmp(filename, "-") == 0;
+  FILE *file = to_stdout ? stdout : fopen(filename, "w");
+  if (!file) {
+    perror("Failed to open results file");
+    return false;
+  }
+
+  size_t len = strlen(filename);
+  bool json = len >= 5 && strcmp(filename + len - 5, ".json") == 0;
+
+  if (json) {
+    fprintf(file, "[\n");
+  } else {
+    fprintf(file, "image,mode,engine,status,cycles,stalls,final_pc,halted,total,arithmetic,logical,memory,control,error\n");
+  }
+
+  for (size_t i = 0; i < batch->num_jobs; i++) {
+    BatchJob *job = &batch->jobs[i];
+    if (json) {
+      fprintf(file, "  {\"image\": ");
+      write_json_string(file, job->image);
+      fprintf(file, ", \"mode\": %d, \"engine\": %d, \"status\": \"%s\", \"cycles\": %u, \"stalls\": %u, \"final_pc\": %u, ", job->mode,
+              job->engine, status_name(job->status), job->cycles, job->stalls, job->pc);
+      fprintf(file, "\"halted\": %s, \"counts\": {\"total\": %u, \"arithmetic\": %u, \"logical\": %u, \"memory\": %u, \"control\": %u}, ",
+              job->halted ? "true" : "false", job->counts.total, job->counts.arithmetic, job->counts.logical, job->counts.memory,
+              job->counts.control);
+      fprintf(file, "\"error\": ");
+      write_json_string(file, job->error);
+      fprintf(file, "}%s\n", i + 1 < batch->num_jobs ? "," : "");
+    } else {
+      write_csv_string(file, job->image);
+      fprintf(file, ",%d,%d,%s,%u,%u,%u,%d,%u,%u,%u,%u,%u,", job->mode, job->engine, status_name(job->status), job->cycles, job->stalls,
+              job->pc, job->halted, job->counts.total, job->counts.arithmetic, job->counts.logical, job->counts.memory, job->counts.control);
+      write_csv_string(file, job->error);
+      fputc('\n', file);
+    }
+  }
+
+  if (json) fprintf(file, "]\n");
+  if (!to_stdout) fclose(file);
+  return true;
+}
+
+/**
+ * @brief Free the jobs of a batch
+ *
+ * @param batch Batch
+ */
+void destroy_batch(Batch *batch) {
+  for (size_t i = 0; i < batch->num_jobs; i++) {
+    free(batch->jobs[i].image);
+  }
+  free(batch->jobs);
+  memset(batch, 0, sizeof(Batch));
+}
@@ -0,0 +1,240 @@
+/**
+ * @file  cache.c
+ * @brief Set-associative L1 cache timing model: tag lookup, replacement and per-PC hit rates
+ * @copyright Copyright (c) 2024
+ */
+
+#include "cache.h"
+
+#include "common.h"
+#include "decode.h"
+#include "memory.h"
+
+static const char *policy_names[] = {"LRU", "FIFO", "random"};
+
+static bool is_power_of_two(uint32_t n) {
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+/**
+ * @brief Parse a cache description: comma-separated key=value pairs, any of which can be left out
+ *
+ * size=4k,assoc=2,line=16,policy=lru|fifo|random,hit=1,miss=10,write=wb|wt
+ *
+ * @param spec    Description ("" for the defaults above)
+ * @param config  Parsed configuration
+ * @return true if spec is valid
+ */
+static bool parse_cache_spec(const char *spec, CacheConfig *config) {
+  *config = (CacheConfig){.size = 4096, .assoc = 2, .line_size = 16, .policy = REPLACE_LRU, .hit_latency = 1, .miss_penalty = 10,
+                          .write_policy = WRITE_BACK};
+
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer), "%s", spec);
+  char *save = NULL;
+  for (char *item = strtok_r(buffer, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    char *value = strchr(item, '=');
+    if (value == NULL) return false;
+    *value++ = '\0';
+
+    char *end;
+    unsigned long number = strtoul(value, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+      number *= 1024;
+      end++;
+    }
+    bool is_number = end != value && *end == '\0';
+
+    if (strcmp(item, "size") == 0 && is_number) {
+      config->size = number;
+    } else if (strcmp(item, "assoc") == 0 && is_number) {
+      config->assoc = number;
+    } else if (strcmp(item, "line") == 0 && is_number) {
+      config->line_size = number;
+    } else if (strcmp(item, "hit") == 0 && is_number) {
+      config->hit_latency = number;
+    } else if (strcmp(item, "miss") == 0 && is_number) {
+      config->miss_penalty = number;
+    } else if (strcmp(item, "policy") == 0 && strcmp(value, "lru") == 0) {
+      config->policy = REPLACE_LRU;
+    } else if (strcmp(item, "policy") == 0 && strcmp(value, "fifo") == 0) {
+      config->policy = REPLACE_FIFO;
+    } else if (strcmp(item, "policy") == 0 && strcmp(value, "random") == 0) {
+      config->policy = REPLACE_RANDOM;
+    } else if (strcmp(item, "write") == 0 && strcmp(value, "wb") == 0) {
+      config->write_policy = WRITE_BACK;
+    } else if (strcmp(item, "write") == 0 && strcmp(value, "wt") == 0) {
+      config->write_policy = WRITE_THROUGH;
+    } else {
+      return false;
+    }
+  }
+
+  return is_power_of_two(config->line_size) && config->line_size >= 4 && config->assoc > 0 && config->hit_latency > 0 &&
+         config->size % (config->assoc * config->line_size) == 0 && is_power_of_two(config->size / (config->assoc * config->line_size));
+}
+
+/**
+ * @brief Create an empty (cold) cache
+ *
+ * @param name     Name used in reports
+ * @param spec     Configuration, see parse_cache_spec()
+ * @param num_pcs  Words of the program, whose instructions make the accesses
+ * @return Cache, or NULL if spec is invalid
+ */
+Cache *create_cache(const char *name, const char *spec, uint32_t num_pcs) {
+  CacheConfig config;
+  if (!parse_cache_spec(spec, &config)) return NULL;
+
+  Cache *cache = calloc(1, sizeof(Cache));
+  if (cache == NULL) return NULL;
+  cache->name = name;
+  cache->config = config;
+  cache->num_sets = config.size / (config.assoc * config.line_size);
+  cache->offset_bits = __builtin_ctz(config.line_size);
+  cache->random_state = 0x2545F491;
+  cache->lines = calloc(cache->num_sets * config.assoc, sizeof(CacheLine));
+  cache->num_pcs = num_pcs;
+  cache->pcs = calloc(num_pcs + 1, sizeof(CachePCStats));
+  if (cache->lines == NULL || cache->pcs == NULL) {
+    destroy_cache(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+/**
+ * @brief Free a cache
+ *
+ * @param cache Cache
+ */
+void destroy_cache(Cache *cache) {
+  if (cache == NULL) return;
+  free(cache->lines);
+  free(cache->pcs);
+  free(cache);
+}
+
+/**
+ * @brief Choose the line of a set to refill: an invalid line if there is one, otherwise by policy
+ */
+static CacheLine *choose_victim(Cache *cache, CacheLine *set) {
+  uint32_t assoc = cache->config.assoc;
+  CacheLine *victim = &set[0];
+  for (uint32_t way = 0; way < assoc; way++) {
+    if (!set[way].valid) return &set[way];
+    if (set[way].stamp < victim->stamp) victim = &set[way];  // Oldest use (LRU) or fill (FIFO)
+  }
+  if (cache->config.policy == REPLACE_RANDOM) {
+    uint32_t x = cache->random_state;  // xorshift32, seeded the same on every run
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cache->random_state = x;
+    victim = &set[x % assoc];
+  }
+  return victim;
+}
+
+/**
+ * @brief Access the cache and update its contents and counters
+ *
+ * @param cache     Cache
+ * @param pc        Address of the instruction making the access (for the per-PC counts)
+ * @param address   Byte address accessed
+ * @param is_write  true for a store
+ * @return Cycles the access takes (hit latency, plus the miss penalty for a refill and for a dirty victim)
+ */
+uint32_t cache_access(Cache *cache, uint32_t pc, uint32_t address, bool is_write) {
+  uint32_t tag = address >> cache->offset_bits;
+  // PCs past the program cannot execute; the extra entry keeps the indexing branch-free
+  CachePCStats *stats = &cache->pcs[pc / 4 < cache->num_pcs ? pc / 4 : cache->num_pcs];
+  cache->accesses++;
+  cache->writes += is_write;
+  stats->accesses++;
+
+  // Loops and straight-line code hit the line of the previous access most of the time
+  CacheLine *line = cache->last_line;
+  if (line == NULL || line->tag != tag) {
+    CacheLine *set = &cache->lines[(tag & (cache->num_sets - 1)) * cache->config.assoc];
+    line = NULL;
+    for (uint32_t way = 0; way < cache->config.assoc; way++) {
+      if (set[way].valid && set[way].tag == tag) {
+        line = &set[way];
+        break;
+      }
+    }
+
+    if (line == NULL) {
+      stats->misses++;
+      if (is_write) {
+        cache->write_misses++;
+        if (cache->config.write_policy == WRITE_THROUGH) return cache->config.hit_latency;  // The write buffer takes it
+      } else {
+        cache->read_misses++;
+      }
+
+      uint32_t penalty = cache->config.miss_penalty;
+      line = choose_victim(cache, set);
+      if (line->valid && line->dirty) {
+        cache->writebacks++;
+        penalty += cache->config.miss_penalty;
+      }
+      *line = (CacheLine){.tag = tag, .stamp = cache->accesses, .valid = true, .dirty = is_write};
+      cache->last_line = line;
+      cache->miss_cycles += penalty;
+      return cache->config.hit_latency + penalty;
+    }
+    cache->last_line = line;
+  }
+
+  if (cache->config.policy == REPLACE_LRU) line->stamp = cache->accesses;
+  if (is_write && cache->config.write_policy == WRITE_BACK) line->dirty = true;
+  return cache->config.hit_latency;
+}
+
+static const CachePCStats *sort_pcs;  // Table compare_pc_misses() sorts PCs of
+
+static int compare_pc_misses(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  if (sort_pcs[x].misses != sort_pcs[y].misses) return sort_pcs[x].misses < sort_pcs[y].misses ? 1 : -1;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Print the configuration, hit rates and the PCs with the most misses
+ *
+ * @param cache Cache
+ * @param mips  MIPS simulator, whose memory holds the instructions listed
+ * @param file  Output
+ */
+void print_cache_stats(Cache *cache, MIPSSim *mips, FILE *file) {
+  CacheConfig *c = &cache->config;
+  uint64_t misses = cache->read_misses + cache->write_misses;
+  fprintf(file, "%s: %u B, %u-way, %u B lines, %s, %s, %u cycle hit, %u cycle miss penalty\n", cache->name, c->size, c->assoc, c->line_size,
+          policy_names[c->policy], c->write_policy == WRITE_BACK ? "write-back" : "write-through", c->hit_latency, c->miss_penalty);
+  fprintf(file, "\\ Accesses: %" PRIu64 " (%" PRIu64 " reads, %" PRIu64 " writes)\n", cache->accesses, cache->accesses - cache->writes, cache->writes);
+  fprintf(file, "\\ Misses: %" PRIu64 " (%" PRIu64 " reads, %" PRIu64 " writes)\n", misses, cache->read_misses, cache->write_misses);
+  fprintf(file, "\\ Hit rate: %.2f%%\n", cache->accesses ? 100.0 * (cache->accesses - misses) / cache->accesses : 100.0);
+  if (c->write_policy == WRITE_BACK && cache->writes > 0) fprintf(file, "\\ Write-backs: %" PRIu64 "\n", cache->writebacks);
+  fprintf(file, "\\ Stall cycles: %" PRIu64 "\n", cache->accesses * (c->hit_latency - 1) + cache->miss_cycles);
+  if (misses == 0) return;
+
+  uint32_t *sorted = malloc(cache->num_pcs * sizeof(uint32_t));
+  if (sorted == NULL) return;
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < cache->num_pcs; i++) {
+    if (cache->pcs[i].misses > 0) sorted[count++] = i;
+  }
+  sort_pcs = cache->pcs;
+  qsort(sorted, count, sizeof(uint32_t), compare_pc_misses);
+
+  fprintf(file, "  %-8s  %-22s %10s %10s %8s\n", "pc", "instruction", "accesses", "misses", "hit rate");
+  for (uint32_t i = 0; i < count && i < CACHE_REPORT_PCS; i++) {
+    CachePCStats *s = &cache->pcs[sorted[i]];
+    char text[32];
+    fprintf(file, "  %08x  %-22s %10u %10u %7.2f%%\n", sorted[i] * 4, format_instruction(read_memory(&mips->memory, sorted[i]), text, sizeof(text)), s->accesses,
+            s->misses, 100.0 * (s->accesses - s->misses) / s->accesses);
+  }
+  free(sorted);
+}
@@ -0,0 +1,279 @@
+/**
+ * @file  checkpoint.c
+ * @brief Binary snapshots of the full simulator state
+ * @copyright Copyright (c) 2024
+ */
+
+#include "checkpoint.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "pipeline.h"
+
+static void save_instruction(const Instruction *instr, CheckpointInstr *saved) {
+  *saved = (CheckpointInstr){
+      .instruction = instr->instruction,
+      .pc = instr->pc,
+      .stage = instr->stage,
+      .type = instr->type,
+      .opcode = instr->opcode,
+      .rs = instr->rs,
+      .rt = instr->rt,
+      .rd = instr->rd,
+      .imm = instr->imm,
+      .alu_out = instr->alu_out,
+      .mdr = instr->mdr,
+      .forward_values = {instr->forward_reg[RS].reg, instr->forward_reg[RT].reg},
+      .forwarded = instr->forward_reg[RS].is_forwarded | instr->forward_reg[RT].is_forwarded << 1,
+      .ex_cycles = instr->ex_cycles,
+      .invalid = instr->invalid,
+  };
+}
+
+static void restore_instruction(const CheckpointInstr *saved, Instruction *instr) {
+  *instr = (Instruction){
+      .instruction = saved->instruction,
+      .pc = saved->pc,
+      .stage = saved->stage,
+      .type = saved->type,
+      .opcode = saved->opcode,
+      .rs = saved->rs,
+      .rt = saved->rt,
+      .rd = saved->rd,
+      .imm = saved->imm,
+      .alu_out = saved->alu_out,
+      .mdr = saved->mdr,
+      .predicted_pc = saved->pc + 4,
+      .ex_cycles = saved->ex_cycles,
+      .invalid = saved->invalid,
+      .forward_reg = {{.reg = saved->forward_values[RS], .is_forwarded = saved->forwarded & 1},
+                      {.reg = saved->forward_values[RT], .is_forwarded = saved->forwarded >> 1 & 1}},
+  };
+}
+
+static bool valid_pipeline_config(const PipelineConfig *config) {
+  for (int stage = IF; stage < NUM_STAGES; stage++) {
+    uint8_t limit = stage == ID || stage == WB ? 1 : PIPELINE_MAX_STAGE_CYCLES;
+    if (config->cycles[stage] < 1 || config->cycles[stage] > limit) return false;
+  }
+  return config->mul_cycles >= 1 && config->mul_cycles <= PIPELINE_MAX_MUL_CYCLES;
+}
+
+static bool valid_instruction(const CheckpointInstr *saved) {
+  return saved->stage <= DONE && saved->type <= J_TYPE && saved->opcode <= HALT && saved->rs < 32 && saved->rt < 32 &&
+         saved->rd < 32 && saved->forwarded <= 3;
+}
+
+/**
+ * @brief Check that every physical stage of the pipeline holds a distinct valid slot or nothing, and that
+ * no slot is held beyond the configured depth
+ *
+ * @param header  Checkpoint header (its pipeline configuration already checked)
+ * @return true if the in-flight instructions can be restored
+ */
+static bool valid_stages(const CheckpointHeader *header) {
+  uint8_t depth = 0;
+  for (int stage = IF; stage < NUM_STAGES; stage++) depth += header->pipeline.cycles[stage];
+  bool used[PIPELINE_SLOTS] = {false};
+  for (int i = 0; i < PIPELINE_MAX_DEPTH; i++) {
+    uint8_t slot = header->stage_slot[i];
+    if (slot == CHECKPOINT_NO_SLOT) continue;
+    if (i >= depth || slot >= PIPELINE_SLOTS || used[slot] || !valid_instruction(&header->slots[slot])) return false;
+    used[slot] = true;
+  }
+  return true;
+}
+
+/**
+ * @brief Save the simulator state (registers, memory, counters and in-flight pipeline) to a file
+ *
+ * Only memory pages holding data are written. Their words are stored page-aligned at the end of the
+ * file, so restore_checkpoint() copies each page in one block. Branch predictor and cache state is not
+ * saved, so a simulator using either cannot be checkpointed.
+ *
+ * @param mips      MIPS simulator
+ * @param filename  Checkpoint file
+ * @return true on success, false if the file cannot be written
+ */
+bool save_checkpoint(MIPSSim *mips, const char *filename) {
+  if (mips->predictor != NULL || mips->icache != NULL || mips->dcache != NULL) {
+    fprintf(stderr, "Failed to save checkpoint: branch predictor and cache state is not saved\n");
+    return false;
+  }
+
+  CheckpointHeader header = {
+      .version = CHECKPOINT_VERSION,
+      .mode = mips->mode,
+      .pc = mips->pc,
+      .clock = mips->clock,
+      .memory_size = mips->memory_size,
+      .halt = mips->halt,
+      .done = mips->done,
+      .is_pipelined = mips->pipeline.is_pipelined,
+      .is_stalled = mips->pipeline.is_stalled,
+      .total_stalls = mips->pipeline.total_stalls,
+      .counts = mips->counts,
+      .pipeline = mips->pipeline.config,
+  };
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+
+  for (int i = 0; i < 32; i++) {
+    header.registers[i] = mips->registers[i].value;
+    if (mips->registers[i].modified) header.registers_modified |= 1u << i;
+  }
+
+  Pipeline *p = &mips->pipeline;
+  for (int i = 0; i < PIPELINE_MAX_DEPTH; i++) {
+    header.stage_slot[i] = CHECKPOINT_NO_SLOT;
+    if (p->stages[i] != NULL) {
+      uint8_t slot = p->stages[i] - p->slots;
+      header.stage_slot[i] = slot;
+      save_instruction(p->stages[i], &header.slots[slot]);
+    }
+  }
+
+  // Describe every allocated page that holds a non-zero or modified word
+  header.page_words = CHECKPOINT_PAGE_WORDS;
+  CheckpointPage *pages = malloc((mips->memory.num_pages + 1) * sizeof(CheckpointPage));
+  MemoryPage **saved_pages = malloc((mips->memory.num_pages + 1) * sizeof(MemoryPage *));
+  if (pages == NULL || saved_pages == NULL) {
+    perror("Failed to save checkpoint");
+    free(pages);
+    free(saved_pages);
+    return false;
+  }
+  for (MemoryPage *page = mips->memory.pages; page != NULL; page = page->next) {
+    bool used = page->is_dirty;
+    for (uint32_t i = 0; i < CHECKPOINT_PAGE_WORDS && !used; i++) used = page->words[i] != 0;
+    if (!used) continue;
+
+    CheckpointPage *saved = &pages[header.num_pages];
+    memset(saved, 0, sizeof(CheckpointPage));
+    saved->index = page->index;
+    memcpy(saved->modified, page->modified, sizeof(saved->modified));
+    saved_pages[header.num_pages++] = page;
+  }
+
+  size_t meta_size = sizeof(CheckpointHeader) + header.num_pages * sizeof(CheckpointPage);
+  header.pages_offset = (meta_size + CHECKPOINT_PAGE_BYTES - 1) / CHECKPOINT_PAGE_BYTES * CHECKPOINT_PAGE_BYTES;
+
+  FILE *file = fopen(filename, "wb");
+  if (!file) {
+    perror("Failed to open checkpoint file");
+    free(pages);
+    free(saved_pages);
+    return false;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (header.num_pages > 0) ok = ok && fwrite(pages, sizeof(CheckpointPage), header.num_pages, file) == header.num_pages;
+  for (size_t pad = meta_size; ok && pad < header.pages_offset; pad++) ok = fputc(0, file) != EOF;
+
+  for (uint32_t n = 0; ok && n < header.num_pages; n++) {
+    ok = fwrite(saved_pages[n]->words, CHECKPOINT_PAGE_BYTES, 1, file) == 1;
+  }
+
+  if (fclose(file) != 0) ok = false;
+  if (!ok) perror("Failed to write checkpoint");
+  free(pages);
+  free(saved_pages);
+  return ok;
+}
+
+/**
+ * @brief Restore a simulator from a checkpoint file. The file is mapped and each saved page is copied
+ * from it in one block. The restored simulator has no branch predictor or caches.
+ *
+ * @param mips      MIPS simulator (re-initialized)
+ * @param filename  Checkpoint file
+ * @return SIM_OK, SIM_ERR_FILE if the file cannot be opened, or SIM_ERR_CHECKPOINT if it is not a valid checkpoint
+ */
+SimStatus restore_checkpoint(MIPSSim *mips, const char *filename) {
+  init_simulator(mips, NOT_PIPED);
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return sim_error(mips, SIM_ERR_FILE, "Failed to open file: %s", strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CheckpointHeader)) {
+    close(fd);
+    return sim_error(mips, SIM_ERR_CHECKPOINT, "%s: not a checkpoint", filename);
+  }
+  const uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return sim_error(mips, SIM_ERR_FILE, "Failed to map file: %s", strerror(errno));
+  }
+
+  const CheckpointHeader *header = (const CheckpointHeader *)data;
+  SimStatus status = SIM_OK;
+  if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0) {
+    status = sim_error(mips, SIM_ERR_CHECKPOINT, "%s: not a checkpoint", filename);
+  } else if (header->version != CHECKPOINT_VERSION) {
+    status = sim_error(mips, SIM_ERR_CHECKPOINT, "%s: unsupported checkpoint version %u", filename, header->version);
+  } else if (header->page_words != CHECKPOINT_PAGE_WORDS) {
+    status = sim_error(mips, SIM_ERR_CHECKPOINT, "%s: checkpoint has %u-word pages, this build uses %u", filename, header->page_words,
+                       CHECKPOINT_PAGE_WORDS);
+  } else if (header->mode > PIPED_FWD || !valid_pipeline_config(&header->pipeline) || !valid_stages(header) ||
+             header->pages_offset + (uint64_t)header->num_pages * CHECKPOINT_PAGE_BYTES > (uint64_t)st.st_size ||
+             sizeof(CheckpointHeader) + (uint64_t)header->num_pages * sizeof(CheckpointPage) > header->pages_offset) {
+    status = sim_error(mips, SIM_ERR_CHECKPOINT, "%s: corrupt checkpoint", filename);
+  }
+  const CheckpointPage *pages = (const CheckpointPage *)(data + sizeof(CheckpointHeader));
+  for (uint32_t n = 0; status == SIM_OK && n < header->num_pages; n++) {
+    if (pages[n].index >= MEMORY_NUM_PAGES) status = sim_error(mips, SIM_ERR_CHECKPOINT, "%s: corrupt checkpoint", filename);
+  }
+  if (status != SIM_OK) {
+    munmap((void *)data, st.st_size);
+    return status;
+  }
+
+  init_simulator(mips, header->mode);
+  mips->pc = header->pc;
+  mips->clock = header->clock;
+  mips->memory_size = header->memory_size;
+  mips->halt = header->halt;
+  mips->done = header->done;
+  mips->counts = header->counts;
+  for (int i = 0; i < 32; i++) {
+    mips->registers[i].value = header->registers[i];
+    mips->registers[i].modified = (header->registers_modified >> i) & 1;
+  }
+
+  Pipeline *p = &mips->pipeline;
+  configure_pipeline(p, &header->pipeline);
+  p->is_pipelined = header->is_pipelined;
+  p->is_stalled = header->is_stalled;
+  p->total_stalls = header->total_stalls;
+  p->num_free = 0;
+  bool used[PIPELINE_SLOTS] = {false};
+  for (int i = 0; i < p->depth; i++) {
+    uint8_t slot = header->stage_slot[i];
+    if (slot != CHECKPOINT_NO_SLOT) {
+      used[slot] = true;
+      restore_instruction(&header->slots[slot], &p->slots[slot]);
+      p->stages[i] = &p->slots[slot];
+    }
+  }
+  for (int slot = PIPELINE_SLOTS - 1; slot >= 0; slot--) {
+    if (!used[slot]) release_instruction(p, &p->slots[slot]);
+  }
+  rebuild_scoreboard(p);
+
+  for (uint32_t n = 0; n < header->num_pages; n++) {
+    MemoryPage *page = get_page(&mips->memory, pages[n].index);
+    memcpy(page->words, data + header->pages_offset + (size_t)n * CHECKPOINT_PAGE_BYTES, CHECKPOINT_PAGE_BYTES);
+    memcpy(page->modified, pages[n].modified, sizeof(page->modified));
+    for (uint32_t i = 0; i < CHECKPOINT_PAGE_WORDS / 64; i++) {
+      if (page->modified[i] != 0 && !page->is_dirty) mark_page_dirty(&mips->memory, page);
+    }
+  }
+
+  munmap((void *)data, st.st_size);
+  return SIM_OK;
+}
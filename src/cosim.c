@@ -0,0 +1,308 @@
+/**
+ * @file  cosim.c
+ * @brief Lockstep co-simulation: a functional engine follows the pipeline model instruction by instruction
+ * and the two are compared as they go, stopping at the first divergence
+ * @copyright Copyright (c) 2024
+ */
+
+#include "cosim.h"
+
+#include "common.h"
+#include "functional.h"
+#include "jit.h"
+#include "mips.h"
+#include "pipeline.h"
+
+/**
+ * @brief Parse a co-simulation, "engine[:interval]" (engine 1 or 2, interval 1 or more, default 1)
+ *
+ * @param spec    Co-simulation
+ * @param config  Configuration to fill
+ * @return true on success, false if the engine or interval is invalid
+ */
+bool parse_cosim_config(const char *spec, CoSimConfig *config) {
+  char *end;
+  unsigned long engine = strtoul(spec, &end, 10);
+  unsigned long interval = 1;
+  if (end == spec || (engine != ENGINE_FUNCTIONAL && engine != ENGINE_JIT)) return false;
+  if (*end == ':') {
+    const char *start = end + 1;
+    interval = strtoul(start, &end, 10);
+    if (end == start || interval == 0 || interval > UINT32_MAX) return false;
+  }
+  if (*end != '\0') return false;
+  config->engine = (Engine)engine;
+  config->interval = (uint32_t)interval;
+  return true;
+}
+
+/**
+ * @brief Start co-simulating a simulator, with a candidate that gets a copy of its program
+ *
+ * @param reference Pipeline model, with its program loaded and nothing run yet
+ * @param config    Candidate engine and check interval
+ * @return Co-simulation, also set as reference->cosim
+ */
+CoSim *create_cosim(MIPSSim *reference, const CoSimConfig *config) {
+  CoSim *cs = calloc(1, sizeof(CoSim));
+  MIPSSim *candidate = malloc(sizeof(MIPSSim));
+  if (cs == NULL || candidate == NULL) {
+    perror("Failed to allocate co-simulation");
+    exit(EXIT_FAILURE);
+  }
+  init_simulator(candidate, NOT_PIPED);
+  copy_memory(&candidate->memory, &reference->memory);
+  candidate->pc = reference->pc;
+  candidate->memory_size = reference->memory_size;
+
+  cs->config = *config;
+  cs->reference = reference;
+  cs->candidate = candidate;
+  // Without executable memory the JIT falls back to the functional engine, as run_jit() does
+  if (config->engine == ENGINE_JIT) cs->jit = create_jit(candidate);
+  cs->next_check = config->interval;
+  reference->memory.log = &cs->reference_stores;
+  candidate->memory.log = &cs->candidate_stores;
+  reference->cosim = cs;
+  return cs;
+}
+
+/**
+ * @brief Fold the stores of a log into a hash, in order
+ *
+ * @param hash  Hash of the earlier stores
+ * @param log   Stores since
+ * @return Hash of every store
+ */
+static uint64_t fold_stores(uint64_t hash, const MemoryLog *log) {
+  for (uint32_t i = 0; i < log->count; i++) {
+    uint64_t h = hash ^ ((uint64_t)log->indexes[i] << 32 | (uint32_t)log->values[i]);
+    // splitmix64 finaliser
+    h = (h ^ h >> 30) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ h >> 27) * 0x94D049BB133111EBull;
+    hash = h ^ h >> 31;
+  }
+  return hash;
+}
+
+/**
+ * @brief Address of the instruction the reference retires next: the oldest instruction in flight behind
+ * the one in WB, or the fetch PC if there is none. Wrong-path instructions are flushed before a branch
+ * reaches WB, so every instruction in flight is on the correct path.
+ *
+ * @param mips  Reference simulator, in its writeback stage
+ * @return Byte address
+ */
+static uint32_t next_reference_pc(MIPSSim *mips) {
+  Pipeline *p = &mips->pipeline;
+  if (p->is_pipelined) {
+    for (int i = p->work[WB] - 1; i >= 0; i--) {
+      if (p->stages[i] != NULL && p->stages[i]->stage != DONE) return p->stages[i]->pc;
+    }
+  }
+  return mips->pc;
+}
+
+/**
+ * @brief Append a line to the divergence report
+ *
+ * @param cs      Co-simulation
+ * @param format  printf() format
+ */
+static void report(CoSim *cs, const char *format, ...) {
+  size_t used = strlen(cs->report);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(cs->report + used, sizeof(cs->report) - used, format, args);
+  va_end(args);
+}
+
+/**
+ * @brief Stop the reference with a divergence
+ *
+ * @param cs  Co-simulation
+ */
+static void diverge(CoSim *cs) {
+  cs->diverged = true;
+  sim_error(cs->reference, SIM_ERR_DIVERGED, "Co-simulation with the %s engine diverged after instruction %u",
+            cs->config.engine == ENGINE_JIT ? "JIT" : "functional", cs->matched);
+}
+
+/**
+ * @brief Check whether the engines continue at the same PC. Past the end of the program they only need to
+ * agree on being there: the non-pipelined datapath has already fetched one word further.
+ *
+ * @param cs       Co-simulation
+ * @param next_pc  Address the reference continues at
+ * @return true if the PCs match
+ */
+static bool same_pc(CoSim *cs, uint32_t next_pc) {
+  uint32_t size = cs->reference->memory_size;
+  return next_pc == cs->candidate->pc || (next_pc / 4 >= size && cs->candidate->pc / 4 >= size);
+}
+
+/**
+ * @brief Describe how the candidate differs from the reference
+ *
+ * @param cs       Co-simulation
+ * @param next_pc  Address the reference continues at
+ */
+static void report_differences(CoSim *cs, uint32_t next_pc) {
+  MIPSSim *ref = cs->reference, *cand = cs->candidate;
+  report(cs, "Instructions %u to %u, reference clock cycle %u:\n", cs->matched + 1, cs->retired, ref->clock);
+  if (!same_pc(cs, next_pc)) report(cs, "  PC: reference %u, candidate %u\n", next_pc, cand->pc);
+  for (int r = 0; r < 32; r++) {
+    if (ref->registers[r].value != cand->registers[r].value || ref->registers[r].modified != cand->registers[r].modified) {
+      report(cs, "  R%d: reference %d, candidate %d\n", r, ref->registers[r].value, cand->registers[r].value);
+    }
+  }
+
+  // Only the first store that differs: the ones after it usually follow from it
+  const MemoryLog *a = &cs->reference_stores, *b = &cs->candidate_stores;
+  for (uint32_t i = 0; i < a->count || i < b->count; i++) {
+    if (i < a->count && i < b->count && a->indexes[i] == b->indexes[i] && a->values[i] == b->values[i]) continue;
+    report(cs, "  Store %u of these instructions: reference ", i + 1);
+    if (i < a->count) {
+      report(cs, "[%u] = %d", a->indexes[i] * 4, a->values[i]);
+    } else {
+      report(cs, "none");
+    }
+    if (i < b->count) {
+      report(cs, ", candidate [%u] = %d\n", b->indexes[i] * 4, b->values[i]);
+    } else {
+      report(cs, ", candidate none\n");
+    }
+    break;
+  }
+}
+
+/**
+ * @brief Compare the candidate with the reference, both having executed the same instructions
+ *
+ * @param cs       Co-simulation
+ * @param next_pc  Address the reference continues at
+ * @return true if they match
+ */
+static bool compare_engines(CoSim *cs, uint32_t next_pc) {
+  MIPSSim *ref = cs->reference, *cand = cs->candidate;
+  cs->checks++;
+  uint64_t reference_hash = fold_stores(cs->reference_hash, &cs->reference_stores);
+  uint64_t candidate_hash = fold_stores(cs->candidate_hash, &cs->candidate_stores);
+  bool match = same_pc(cs, next_pc) && reference_hash == candidate_hash;
+  for (int r = 0; r < 32 && match; r++) {
+    match = ref->registers[r].value == cand->registers[r].value && ref->registers[r].modified == cand->registers[r].modified;
+  }
+  if (!match) {
+    report_differences(cs, next_pc);
+    return false;
+  }
+
+  cs->reference_hash = reference_hash;
+  cs->candidate_hash = candidate_hash;
+  cs->reference_stores.count = cs->candidate_stores.count = 0;
+  cs->matched = cs->retired;
+  return true;
+}
+
+/**
+ * @brief Run the candidate until it has executed a number of instructions or finished. The JIT may run
+ * past it, to its next taken branch.
+ *
+ * @param cs      Co-simulation
+ * @param target  Instructions executed since the start
+ * @return true if the candidate finished
+ */
+static bool run_candidate(CoSim *cs, uint32_t target) {
+  MIPSSim *cand = cs->candidate;
+  while (cand->counts.total < target && !cand->done && !cand->halt) {
+    if (cs->jit != NULL) {
+      run_jit_for(cs->jit, target - cand->counts.total);
+    } else {
+      run_functional_for(cand, NULL, target - cand->counts.total);
+    }
+  }
+  return cand->done || cand->halt;
+}
+
+/**
+ * @brief Count an instruction the reference has written back, and check the candidate against it when due
+ *
+ * @param cs  Co-simulation
+ */
+void check_retired(CoSim *cs) {
+  if (++cs->retired < cs->next_check) return;
+
+  MIPSSim *cand = cs->candidate;
+  run_candidate(cs, cs->retired);
+  if (cand->counts.total > cs->retired) {
+    cs->next_check = cand->counts.total;  // Check when the reference gets there
+    return;
+  }
+  if (cand->counts.total < cs->retired) {
+    report(cs, "The candidate %s after %u instructions, the reference retired %u\n",
+           cand->status != SIM_OK ? cand->error : "finished", cand->counts.total, cs->retired);
+    diverge(cs);
+    return;
+  }
+  if (!compare_engines(cs, next_reference_pc(cs->reference))) {
+    diverge(cs);
+    return;
+  }
+  cs->next_check = cs->retired + cs->config.interval;
+}
+
+/**
+ * @brief Finish the candidate once the reference has finished, and compare how both ended. The pipelined
+ * modes never write back the instruction ahead of HALT, which the functional engines do, so after a
+ * pipelined reference only the instruction counts and the halt are compared.
+ *
+ * @param cs  Co-simulation, whose reference finished without an error
+ */
+void finish_cosim(CoSim *cs) {
+  MIPSSim *ref = cs->reference, *cand = cs->candidate;
+  if (ref->status != SIM_OK) return;
+
+  // Run one instruction past the reference, to see whether the candidate stops with it
+  bool finished = run_candidate(cs, ref->counts.total + 1);
+  if (cand->status != SIM_OK || !finished || cand->counts.total != ref->counts.total || cand->halt != ref->halt) {
+    report(cs, "At the end: reference %s after %u instructions, candidate %s after %u\n", ref->halt ? "halted" : "finished",
+           ref->counts.total, cand->status != SIM_OK ? cand->error : !finished ? "still running" : cand->halt ? "halted" : "finished",
+           cand->counts.total);
+    diverge(cs);
+    return;
+  }
+  if (ref->mode == NOT_PIPED) {
+    cs->retired = ref->counts.total;
+    if (!compare_engines(cs, ref->pc)) diverge(cs);
+  }
+}
+
+/**
+ * @brief Print how the co-simulation went: the number of checks, or what differed
+ *
+ * @param cs    Co-simulation
+ * @param file  Output file
+ */
+void print_cosim_report(CoSim *cs, FILE *file) {
+  if (cs->diverged) {
+    fputs(cs->report, file);
+    return;
+  }
+  fprintf(file, "Co-simulation: %s engine matched the pipeline model in %u checks over %u instructions\n",
+          cs->config.engine == ENGINE_JIT ? "JIT" : "functional", cs->checks, cs->candidate->counts.total);
+}
+
+/**
+ * @brief Free a co-simulation and detach it from its reference
+ *
+ * @param cs  Co-simulation
+ */
+void destroy_cosim(CoSim *cs) {
+  cs->reference->cosim = NULL;
+  cs->reference->memory.log = NULL;
+  if (cs->jit != NULL) free_jit(cs->jit);
+  destroy_simulator(cs->candidate);
+  destroy_memory_log(&cs->reference_stores);
+  destroy_memory_log(&cs->candidate_stores);
+  free(cs);
+}
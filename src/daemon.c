@@ -0,0 +1,395 @@
+/**
+ * @file  daemon.c
+ * @brief Simulation daemon: runs jobs sent over a Unix domain socket on a pool of workers, keeping recently
+ * used images loaded and decoded
+ * @copyright Copyright (c) 2024
+ */
+
+#include "daemon.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "common.h"
+#include "decode.h"
+#include "functional.h"
+#include "image.h"
+#include "jit.h"
+#include "memory.h"
+#include "mips.h"
+#include "queue.h"
+
+/* A loaded and decoded image. Jobs copy its memory; it is freed once dropped from the cache and unused. */
+typedef struct CachedImage {
+  uint64_t hash;
+  uint8_t *bytes;  // Image as sent, to tell apart images with the same hash
+  uint32_t size;
+  Memory memory;
+  uint32_t pc;
+  uint32_t memory_size;
+  uint32_t refs;  // Jobs copying it, plus one while it is in the cache
+  struct CachedImage *prev;
+  struct CachedImage *next;
+} CachedImage;
+
+/* Least recently used images last */
+typedef struct {
+  CachedImage *head;
+  CachedImage *tail;
+  uint32_t count;
+} ImageCache;
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;  // A connection was queued
+  pthread_cond_t space;  // A connection was taken
+  Queue connections;     // Accepted sockets, as intptr_t
+  ImageCache cache;
+} Daemon;
+
+static volatile sig_atomic_t stopping;
+
+static void stop_daemon(int signum) {
+  (void)signum;
+  stopping = 1;
+}
+
+/**
+ * @brief FNV-1a hash of an image
+ *
+ * @param bytes Image
+ * @param size  Image size
+ * @return Hash
+ */
+static uint64_t hash_image(const uint8_t *bytes, uint32_t size) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (uint32_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+  return hash;
+}
+
+/**
+ * @brief Drop a reference to a cached image, freeing it with the last one (call with the lock held)
+ *
+ * @param image Cached image
+ */
+static void release_image(CachedImage *image) {
+  if (--image->refs > 0) return;
+  destroy_memory(&image->memory);
+  free(image->bytes);
+  free(image);
+}
+
+static void unlink_image(ImageCache *cache, CachedImage *image) {
+  if (image->prev) image->prev->next = image->next;
+  if (image->next) image->next->prev = image->prev;
+  if (cache->head == image) cache->head = image->next;
+  if (cache->tail == image) cache->tail = image->prev;
+  image->prev = image->next = NULL;
+}
+
+static void push_image(ImageCache *cache, CachedImage *image) {
+  image->next = cache->head;
+  if (cache->head) cache->head->prev = image;
+  cache->head = image;
+  if (cache->tail == NULL) cache->tail = image;
+}
+
+/**
+ * @brief Find an image in the cache and take a reference to it
+ *
+ * @param d     Daemon
+ * @param bytes Image
+ * @param size  Image size
+ * @param hash  hash_image() of it
+ * @return Cached image, or NULL if it is not cached
+ */
+static CachedImage *acquire_image(Daemon *d, const uint8_t *bytes, uint32_t size, uint64_t hash) {
+  pthread_mutex_lock(&d->lock);
+  CachedImage *image = d->cache.head;
+  while (image != NULL && (image->hash != hash || image->size != size || memcmp(image->bytes, bytes, size) != 0)) {
+    image = image->next;
+  }
+  if (image != NULL) {
+    unlink_image(&d->cache, image);
+    push_image(&d->cache, image);
+    image->refs++;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return image;
+}
+
+/**
+ * @brief Cache the image a simulator has just loaded: decode every word of the program, then keep a copy
+ * of the memory. The least recently used image is dropped when the cache is full.
+ *
+ * @param d     Daemon
+ * @param mips  Simulator, with the image loaded and nothing run
+ * @param bytes Image
+ * @param size  Image size
+ * @param hash  hash_image() of it
+ */
+static void cache_image(Daemon *d, MIPSSim *mips, const uint8_t *bytes, uint32_t size, uint64_t hash) {
+  for (MemoryPage *page = mips->memory.pages; page != NULL; page = page->next) {
+    uint32_t first = page->index << MEMORY_PAGE_BITS;
+    for (uint32_t i = 0; i < MEMORY_PAGE_WORDS && first + i < mips->memory_size; i++) {
+      DecodedInstr *entries = get_decoded_page(&mips->memory, first + i);
+      lookup_decoded(&entries[i], page->words[i]);  // Data words do not decode, and stay invalid
+    }
+  }
+
+  CachedImage *image = calloc(1, sizeof(CachedImage));
+  if (image == NULL || (image->bytes = malloc(size ? size : 1)) == NULL) {
+    free(image);
+    return;
+  }
+  memcpy(image->bytes, bytes, size);
+  image->hash = hash;
+  image->size = size;
+  init_memory(&image->memory);
+  copy_memory(&image->memory, &mips->memory);
+  image->pc = mips->pc;
+  image->memory_size = mips->memory_size;
+  image->refs = 1;
+
+  pthread_mutex_lock(&d->lock);
+  push_image(&d->cache, image);
+  if (++d->cache.count > DAEMON_CACHE_ENTRIES) {
+    CachedImage *oldest = d->cache.tail;
+    unlink_image(&d->cache, oldest);
+    d->cache.count--;
+    release_image(oldest);
+  }
+  pthread_mutex_unlock(&d->lock);
+}
+
+/**
+ * @brief Run one job on a worker's simulator
+ *
+ * @param d       Daemon
+ * @param mips    Simulator owned by the worker
+ * @param request Job
+ * @param bytes   Its image
+ * @param result  Filled with the results
+ */
+static void run_job(Daemon *d, MIPSSim *mips, const DaemonRequest *request, const uint8_t *bytes, DaemonResult *result) {
+  memset(result, 0, sizeof(DaemonResult));
+  memcpy(result->magic, DAEMON_RESULT_MAGIC, sizeof(result->magic));
+  init_simulator(mips, request->mode <= PIPED_FWD ? (Mode)request->mode : NOT_PIPED);
+  if (request->mode > PIPED_FWD || request->engine > ENGINE_JIT || (request->engine != ENGINE_PIPELINE && request->mode != NOT_PIPED) ||
+      request->reply > DAEMON_REPLY_JSON) {
+    sim_error(mips, SIM_ERR_REQUEST, "Invalid job: mode %u, engine %u (engines 1 and 2 need mode 0), reply %u", request->mode,
+              request->engine, request->reply);
+  } else {
+    mips->cycle_limit = request->cycle_limit;
+
+    uint64_t hash = hash_image(bytes, request->image_size);
+    CachedImage *image = acquire_image(d, bytes, request->image_size, hash);
+    if (image != NULL) {
+      copy_memory(&mips->memory, &image->memory);
+      mips->pc = image->pc;
+      mips->memory_size = image->memory_size;
+      pthread_mutex_lock(&d->lock);
+      release_image(image);
+      pthread_mutex_unlock(&d->lock);
+      result->cached = true;
+    } else if (load_image(mips, "image", bytes, request->image_size) == SIM_OK) {
+      cache_image(d, mips, bytes, request->image_size, hash);
+    }
+
+    if (mips->status == SIM_OK) {
+      if (request->engine == ENGINE_FUNCTIONAL) {
+        run_functional(mips, NULL);
+      } else if (request->engine == ENGINE_JIT) {
+        run_jit(mips);
+      } else {
+        run_pipeline(mips);
+      }
+    }
+  }
+
+  result->status = mips->status;
+  result->cycles = mips->clock;
+  result->stalls = mips->pipeline.total_stalls;
+  result->pc = mips->pc;
+  result->counts = mips->counts;
+  result->halted = mips->halt;
+  for (int r = 0; r < 32; r++) result->registers[r] = mips->registers[r].value;
+}
+
+/**
+ * @brief Write the results of a job as one line of JSON
+ *
+ * @param file   Connection
+ * @param result Results
+ * @param error  Error message, empty if none
+ */
+static void write_json_result(FILE *file, const DaemonResult *result, const char *error) {
+  fprintf(file, "{\"status\": \"%s\", \"cycles\": %u, \"stalls\": %u, \"final_pc\": %u, \"halted\": %s, \"cached\": %s, ",
+          status_name(result->status), result->cycles, result->stalls, result->pc, result->halted ? "true" : "false",
+          result->cached ? "true" : "false");
+  fprintf(file, "\"counts\": {\"total\": %u, \"arithmetic\": %u, \"logical\": %u, \"memory\": %u, \"control\": %u}, \"registers\": [",
+          result->counts.total, result->counts.arithmetic, result->counts.logical, result->counts.memory, result->counts.control);
+  for (int r = 0; r < 32; r++) fprintf(file, r ? ", %d" : "%d", result->registers[r]);
+  fprintf(file, "], \"error\": ");
+  write_json_string(file, error);
+  fprintf(file, "}\n");
+}
+
+/**
+ * @brief Read exactly size bytes from a socket
+ *
+ * @param fd    Socket
+ * @param data  Buffer
+ * @param size  Bytes to read
+ * @return true on success, false on end of file or error
+ */
+static bool read_full(int fd, void *data, size_t size) {
+  uint8_t *p = data;
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Answer every job of a connection, in order, until the client closes it or sends an invalid header
+ *
+ * @param d     Daemon
+ * @param mips  Simulator owned by the worker
+ * @param fd    Connection
+ */
+static void serve_connection(Daemon *d, MIPSSim *mips, int fd) {
+  int out_fd = dup(fd);
+  FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+  if (out == NULL) {
+    if (out_fd >= 0) close(out_fd);
+    return;
+  }
+  uint8_t *image = NULL;
+  uint32_t capacity = 0;
+  DaemonRequest request;
+  while (read_full(fd, &request, sizeof(request)) && memcmp(request.magic, DAEMON_REQUEST_MAGIC, sizeof(request.magic)) == 0 &&
+         request.image_size <= DAEMON_MAX_IMAGE_SIZE) {
+    if (request.image_size > capacity) {
+      uint8_t *grown = realloc(image, request.image_size);
+      if (grown == NULL) break;
+      image = grown;
+      capacity = request.image_size;
+    }
+    if (!read_full(fd, image, request.image_size)) break;
+
+    DaemonResult result;
+    run_job(d, mips, &request, image, &result);
+    if (request.reply == DAEMON_REPLY_JSON) {
+      write_json_result(out, &result, mips->error);
+    } else {
+      fwrite(&result, sizeof(result), 1, out);
+    }
+    destroy_memory(&mips->memory);
+    if (fflush(out) != 0) break;  // The client has gone
+  }
+  free(image);
+  fclose(out);
+}
+
+static void *worker_main(void *arg) {
+  Daemon *d = arg;
+  MIPSSim *mips = malloc(sizeof(MIPSSim));
+  if (mips == NULL) {
+    perror("Failed to allocate worker");
+    exit(EXIT_FAILURE);
+  }
+  for (;;) {
+    pthread_mutex_lock(&d->lock);
+    while (is_queue_empty(&d->connections)) pthread_cond_wait(&d->ready, &d->lock);
+    int fd = (int)(intptr_t)dequeue(&d->connections);
+    pthread_cond_signal(&d->space);
+    pthread_mutex_unlock(&d->lock);
+
+    serve_connection(d, mips, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Listen on a Unix domain socket and run the jobs clients send until interrupted (SIGINT or SIGTERM)
+ *
+ * @param path        Socket path; a stale socket there is replaced
+ * @param num_workers Worker threads, each serving one connection at a time (0 for one per CPU)
+ * @return Process exit status
+ */
+int run_daemon(const char *path, int num_workers) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return EXIT_FAILURE;
+  }
+  strcpy(address.sun_path, path);
+
+  struct stat st;
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0) {
+    perror("Failed to listen");
+    if (listener >= 0) close(listener);
+    return EXIT_FAILURE;
+  }
+
+  if (num_workers <= 0) num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_workers <= 0) num_workers = 1;
+  Daemon *d = calloc(1, sizeof(Daemon));
+  if (d == NULL) {
+    perror("Failed to allocate daemon");
+    return EXIT_FAILURE;
+  }
+  pthread_mutex_init(&d->lock, NULL);
+  pthread_cond_init(&d->ready, NULL);
+  pthread_cond_init(&d->space, NULL);
+  init_queue(&d->connections);
+
+  // Clients that disconnect early must not kill the daemon; SIGINT and SIGTERM interrupt accept()
+  signal(SIGPIPE, SIG_IGN);
+  struct sigaction action = {.sa_handler = stop_daemon};
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  for (int i = 0; i < num_workers; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker_main, d) != 0) {
+      perror("Failed to start worker");
+      return EXIT_FAILURE;
+    }
+    pthread_detach(thread);
+  }
+  fprintf(stderr, "Listening on %s with %d workers\n", path, num_workers);
+
+  while (!stopping) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      perror("Failed to accept");
+      break;
+    }
+    pthread_mutex_lock(&d->lock);
+    while (is_queue_full(&d->connections)) pthread_cond_wait(&d->space, &d->lock);
+    enqueue(&d->connections, (void *)(intptr_t)fd);
+    pthread_cond_signal(&d->ready);
+    pthread_mutex_unlock(&d->lock);
+  }
+
+  // Workers are left to the process exit
+  close(listener);
+  unlink(path);
+  fprintf(stderr, "Daemon stopped\n");
+  return stopping ? EXIT_SUCCESS : EXIT_FAILURE;
+}
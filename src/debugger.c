@@ -0,0 +1,511 @@
+/**
+ * @file  debugger.c
+ * @brief Interactive debugger over the pipeline model: stepping, breakpoints kept in the decode cache,
+ * register and memory watchpoints, and state inspection
+ * @copyright Copyright (c) 2024
+ */
+
+#include "debugger.h"
+
+#include <unistd.h>
+
+#include "common.h"
+#include "decode.h"
+#include "memory.h"
+#include "mips.h"
+#include "pipeline.h"
+
+static const char *stage_names[] = {"IF", "ID", "EX", "MEM", "WB", "DONE"};
+
+/**
+ * @brief Instruction the decode stage works on this cycle
+ *
+ * @param mips  MIPS simulator
+ * @return Instruction, or NULL if there is none
+ */
+static Instruction *decoding_instruction(MIPSSim *mips) {
+  Instruction *instr = peek_pipeline_stage(&mips->pipeline, mips->mode == NOT_PIPED ? IF : ID);
+  return instr != NULL && instr->stage == ID ? instr : NULL;
+}
+
+/**
+ * @brief Instruction held in EX by a breakpoint it met in ID while an older branch could still squash it
+ *
+ * @param mips  MIPS simulator
+ * @return Instruction, or NULL if there is none
+ */
+static Instruction *held_instruction(MIPSSim *mips) {
+  if (mips->mode == NOT_PIPED || mips->status != SIM_BREAKPOINT) return NULL;
+  Instruction *instr = peek_pipeline_stage(&mips->pipeline, EX);
+  return instr != NULL && instr->stage == EX && instr->breakpoint ? instr : NULL;
+}
+
+/**
+ * @brief Instruction the program stopped at: the one held in EX, or else the one in ID
+ *
+ * @param mips  MIPS simulator, stopped at a breakpoint
+ * @return Instruction
+ */
+static Instruction *stopped_instruction(MIPSSim *mips) {
+  Instruction *instr = held_instruction(mips);
+  return instr != NULL ? instr : decoding_instruction(mips);
+}
+
+static DecodedInstr *decode_entry(MIPSSim *mips, uint32_t address) {
+  return &get_decoded_page(&mips->memory, address / 4)[(address / 4) & MEMORY_WORD_MASK];
+}
+
+static bool is_finished(const MIPSSim *mips) {
+  return mips->done || mips->halt || (mips->status != SIM_OK && mips->status != SIM_BREAKPOINT);
+}
+
+static int find_breakpoint(const Debugger *dbg, uint32_t address) {
+  for (uint32_t i = 0; i < dbg->num_breakpoints; i++) {
+    if (dbg->breakpoints[i] == address) return (int)i;
+  }
+  return -1;
+}
+
+/**
+ * @brief Mark the decode cache entries of the breakpoints. A store to an address drops the decoded copy but
+ * keeps the mark; marks are set again before every run, and after the breakpoint of an instruction resumed
+ * while it stalls in ID has been left lifted until the instruction moves on.
+ *
+ * @param dbg Debugger
+ */
+static void arm_breakpoints(Debugger *dbg) {
+  for (uint32_t i = 0; i < dbg->num_breakpoints; i++) {
+    if (dbg->resumed != NULL && dbg->resumed->pc == dbg->breakpoints[i]) continue;
+    *decode_entry(dbg->mips, dbg->breakpoints[i]) = (DecodedInstr){.breakpoint = true};
+  }
+}
+
+/**
+ * @brief Complete the cycle that stopped at a breakpoint, with the breakpoint lifted
+ *
+ * @param dbg Debugger, stopped at a breakpoint
+ */
+static void resume(Debugger *dbg) {
+  MIPSSim *mips = dbg->mips;
+  Instruction *held = held_instruction(mips);
+  mips->status = SIM_OK;
+  if (held != NULL) {
+    held->breakpoint = false;
+    finish_from_execute(mips);
+  } else {
+    dbg->resumed = decoding_instruction(mips);
+    *decode_entry(mips, dbg->resumed->pc) = (DecodedInstr){0};
+    finish_cycle(mips);
+  }
+  if (mips->status != SIM_OK) return;
+  mips->clock++;
+  if (mips->cycle_limit && mips->clock > mips->cycle_limit) {
+    sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);
+  } else if (mips->done || mips->halt) {
+    correct_pc(mips);
+  }
+}
+
+/**
+ * @brief Check the watchpoints against the values they last saw, and print the ones that changed
+ *
+ * @param dbg Debugger
+ * @return true if any changed
+ */
+static bool check_watchpoints(Debugger *dbg) {
+  bool changed = false;
+  for (uint32_t i = 0; i < dbg->num_watchpoints; i++) {
+    Watchpoint *w = &dbg->watchpoints[i];
+    int32_t value = w->kind == WATCH_REGISTER ? dbg->mips->registers[w->target].value : read_memory(&dbg->mips->memory, w->target / 4);
+    if (value == w->value) continue;
+    if (w->kind == WATCH_REGISTER) {
+      printf("Watchpoint R%u: %d -> %d\n", w->target, w->value, value);
+    } else {
+      printf("Watchpoint [%u]: %d -> %d\n", w->target, w->value, value);
+    }
+    w->value = value;
+    changed = true;
+  }
+  return changed;
+}
+
+/**
+ * @brief Print where the program stopped: the clock, the fetch PC, the instruction held in EX by a breakpoint
+ * and the instruction about to be decoded
+ *
+ * @param dbg Debugger
+ */
+static void print_location(Debugger *dbg) {
+  MIPSSim *mips = dbg->mips;
+  char text[64];
+  printf("Clock %u, PC %u, %u instructions executed\n", mips->clock, mips->pc, mips->counts.total);
+  Instruction *instr = held_instruction(mips);
+  if (instr != NULL) printf("EX: [%4u] %s\n", instr->pc, format_instruction(instr->instruction, text, sizeof(text)));
+  instr = decoding_instruction(mips);
+  if (instr != NULL) printf("ID: [%4u] %s\n", instr->pc, format_instruction(instr->instruction, text, sizeof(text)));
+}
+
+/**
+ * @brief Run the program until it finishes or stops at a breakpoint or watchpoint, or for a number of cycles
+ * or instructions. Without watchpoints or an instruction count it runs at full speed.
+ *
+ * @param dbg           Debugger
+ * @param cycles        Clock cycles to run, 0 for no limit
+ * @param instructions  Instructions to execute, 0 for no limit
+ */
+static void run_program(Debugger *dbg, uint32_t cycles, uint32_t instructions) {
+  MIPSSim *mips = dbg->mips;
+  if (is_finished(mips)) {
+    printf("The program has finished\n");
+    return;
+  }
+  uint32_t stop_clock = cycles ? mips->clock + cycles : 0;
+  uint32_t stop_count = mips->counts.total + instructions;
+  bool watched = false;
+
+  if (mips->status == SIM_BREAKPOINT) {
+    resume(dbg);
+    watched = check_watchpoints(dbg);
+  }
+  arm_breakpoints(dbg);
+  while (!watched && !is_finished(mips) && mips->status == SIM_OK) {
+    if (stop_clock && mips->clock >= stop_clock) break;
+    if (instructions && mips->counts.total >= stop_count) break;
+    bool single = instructions || dbg->num_watchpoints || dbg->resumed;
+    run_pipeline_until(mips, single ? mips->clock + 1 : stop_clock);
+    if (dbg->resumed != NULL && decoding_instruction(mips) != dbg->resumed) {
+      dbg->resumed = NULL;
+      arm_breakpoints(dbg);
+    }
+    watched = check_watchpoints(dbg);
+  }
+
+  if (mips->status == SIM_BREAKPOINT) {
+    printf("Breakpoint at %u\n", stopped_instruction(mips)->pc);
+  } else if (mips->status != SIM_OK) {
+    printf("Program stopped: %s\n", mips->error);
+  } else if (is_finished(mips)) {
+    printf(mips->halt ? "Program halted\n" : "Program finished\n");
+  }
+  print_location(dbg);
+}
+
+/**
+ * @brief Parse a byte address, decimal or 0x-prefixed hexadecimal, that must be word aligned
+ *
+ * @param text    Address
+ * @param address Set to the address
+ * @return true on success
+ */
+static bool parse_address(const char *text, uint32_t *address) {
+  char *end;
+  unsigned long value = strtoul(text, &end, 0);
+  if (end == text || *end != '\0' || value > UINT32_MAX || value % 4 != 0) {
+    printf("Invalid address: %s (word-aligned byte address expected)\n", text);
+    return false;
+  }
+  *address = (uint32_t)value;
+  return true;
+}
+
+static void add_breakpoint(Debugger *dbg, const char *arg) {
+  uint32_t address;
+  if (!parse_address(arg, &address)) return;
+  if (address / 4 >= dbg->mips->memory_size) {
+    printf("Address %u is outside the program\n", address);
+  } else if (find_breakpoint(dbg, address) >= 0) {
+    printf("Breakpoint at %u already set\n", address);
+  } else if (dbg->num_breakpoints == DEBUGGER_MAX_BREAKPOINTS) {
+    printf("Too many breakpoints (at most %d)\n", DEBUGGER_MAX_BREAKPOINTS);
+  } else {
+    dbg->breakpoints[dbg->num_breakpoints++] = address;
+    arm_breakpoints(dbg);
+    printf("Breakpoint at %u\n", address);
+  }
+}
+
+static void remove_breakpoint(Debugger *dbg, uint32_t i) {
+  DecodedInstr *entry = decode_entry(dbg->mips, dbg->breakpoints[i]);
+  if (entry->breakpoint) *entry = (DecodedInstr){0};
+  dbg->breakpoints[i] = dbg->breakpoints[--dbg->num_breakpoints];
+}
+
+static void delete_breakpoint(Debugger *dbg, const char *arg) {
+  uint32_t address;
+  if (arg == NULL) {
+    while (dbg->num_breakpoints > 0) remove_breakpoint(dbg, 0);
+    printf("Deleted all breakpoints\n");
+    return;
+  }
+  if (!parse_address(arg, &address)) return;
+  int i = find_breakpoint(dbg, address);
+  if (i < 0) {
+    printf("No breakpoint at %u\n", address);
+    return;
+  }
+  remove_breakpoint(dbg, (uint32_t)i);
+  printf("Deleted breakpoint at %u\n", address);
+}
+
+/**
+ * @brief Parse a watchpoint target: a register (r0 to r31) or the byte address of a word
+ *
+ * @param arg   Target
+ * @param watch Filled with the kind and target
+ * @return true on success
+ */
+static bool parse_watch(const char *arg, Watchpoint *watch) {
+  if (arg[0] == 'r' || arg[0] == 'R') {
+    char *end;
+    unsigned long reg = strtoul(arg + 1, &end, 10);
+    if (end == arg + 1 || *end != '\0' || reg >= 32) {
+      printf("Invalid register: %s (r0 to r31)\n", arg);
+      return false;
+    }
+    *watch = (Watchpoint){.kind = WATCH_REGISTER, .target = (uint32_t)reg};
+    return true;
+  }
+  *watch = (Watchpoint){.kind = WATCH_MEMORY};
+  return parse_address(arg, &watch->target);
+}
+
+static void add_watchpoint(Debugger *dbg, const char *arg) {
+  Watchpoint watch;
+  if (!parse_watch(arg, &watch)) return;
+  for (uint32_t i = 0; i < dbg->num_watchpoints; i++) {
+    if (dbg->watchpoints[i].kind == watch.kind && dbg->watchpoints[i].target == watch.target) {
+      printf("Already watched: %s\n", arg);
+      return;
+    }
+  }
+  if (dbg->num_watchpoints == DEBUGGER_MAX_WATCHPOINTS) {
+    printf("Too many watchpoints (at most %d)\n", DEBUGGER_MAX_WATCHPOINTS);
+    return;
+  }
+  MIPSSim *mips = dbg->mips;
+  watch.value = watch.kind == WATCH_REGISTER ? mips->registers[watch.target].value : read_memory(&mips->memory, watch.target / 4);
+  dbg->watchpoints[dbg->num_watchpoints++] = watch;
+  printf("Watching %s (now %d)\n", arg, watch.value);
+}
+
+static void delete_watchpoint(Debugger *dbg, const char *arg) {
+  Watchpoint watch;
+  if (arg == NULL) {
+    dbg->num_watchpoints = 0;
+    printf("Deleted all watchpoints\n");
+    return;
+  }
+  if (!parse_watch(arg, &watch)) return;
+  for (uint32_t i = 0; i < dbg->num_watchpoints; i++) {
+    if (dbg->watchpoints[i].kind == watch.kind && dbg->watchpoints[i].target == watch.target) {
+      dbg->watchpoints[i] = dbg->watchpoints[--dbg->num_watchpoints];
+      printf("Deleted watchpoint %s\n", arg);
+      return;
+    }
+  }
+  printf("Not watched: %s\n", arg);
+}
+
+static void print_points(Debugger *dbg) {
+  char text[64];
+  printf("Breakpoints:\n");
+  for (uint32_t i = 0; i < dbg->num_breakpoints; i++) {
+    uint32_t address = dbg->breakpoints[i];
+    printf("  [%4u] %s\n", address, format_instruction(read_memory(&dbg->mips->memory, address / 4), text, sizeof(text)));
+  }
+  printf("Watchpoints:\n");
+  for (uint32_t i = 0; i < dbg->num_watchpoints; i++) {
+    Watchpoint *w = &dbg->watchpoints[i];
+    if (w->kind == WATCH_REGISTER) {
+      printf("  R%u = %d\n", w->target, w->value);
+    } else {
+      printf("  [%u] = %d\n", w->target, w->value);
+    }
+  }
+}
+
+/**
+ * @brief Print words of memory with their disassembly
+ *
+ * @param dbg     Debugger
+ * @param address First byte address
+ * @param count   Words to print
+ */
+static void examine_memory(Debugger *dbg, uint32_t address, uint32_t count) {
+  char text[64];
+  for (uint32_t i = 0; i < count && address <= UINT32_MAX - 4 * i; i++) {
+    uint32_t a = address + 4 * i;
+    int32_t word = read_memory(&dbg->mips->memory, a / 4);
+    printf("%c [%4u] %08x %11d  %s\n", find_breakpoint(dbg, a) >= 0 ? '*' : ' ', a, (uint32_t)word, word,
+           format_instruction(word, text, sizeof(text)));
+  }
+}
+
+static void print_stages(Debugger *dbg) {
+  Pipeline *p = &dbg->mips->pipeline;
+  char text[64];
+  for (int i = 0; i < p->depth; i++) {
+    Instruction *instr = p->stages[i];
+    const char *stage = stage_names[p->is_pipelined ? p->kind[i] : (instr ? instr->stage : IF)];
+    if (instr == NULL || instr->stage == DONE) {
+      printf("%-4s -\n", stage);
+    } else {
+      printf("%-4s [%4u] %s\n", stage, instr->pc, format_instruction(instr->instruction, text, sizeof(text)));
+    }
+  }
+}
+
+static void print_help(void) {
+  printf("Commands (a prefix picks the first one it matches, as s, c or b; an empty line repeats the last command):\n");
+  printf("  step [n]          Run until n more instructions (default 1) have executed\n");
+  printf("  cycle [n]         Run n clock cycles (default 1)\n");
+  printf("  continue          Run until a breakpoint, a watchpoint or the end of the program\n");
+  printf("  break [address]   Stop before the instruction at address executes, when it is decoded; list without address\n");
+  printf("  delete [address]  Delete the breakpoint at address, or all of them\n");
+  printf("  watch rN|address  Stop after a cycle that changes register N or the memory word at address\n");
+  printf("  unwatch [target]  Delete a watchpoint, or all of them\n");
+  printf("  info              List the breakpoints and watchpoints\n");
+  printf("  registers         Print the modified registers\n");
+  printf("  memory            Print the modified memory words\n");
+  printf("  x address [n]     Print n words (default 1) from address, disassembled\n");
+  printf("  pipeline          Print the instruction in every stage\n");
+  printf("  where             Print the clock, PC and the instruction in ID\n");
+  printf("  quit              Stop debugging\n");
+  printf("Addresses are byte addresses, decimal or 0x-prefixed hexadecimal.\n");
+}
+
+typedef enum {
+  CMD_STEP,
+  CMD_CONTINUE,
+  CMD_CYCLE,
+  CMD_BREAK,
+  CMD_DELETE,
+  CMD_WATCH,
+  CMD_UNWATCH,
+  CMD_INFO,
+  CMD_REGISTERS,
+  CMD_MEMORY,
+  CMD_EXAMINE,
+  CMD_PIPELINE,
+  CMD_WHERE,
+  CMD_HELP,
+  CMD_QUIT,
+  NUM_COMMANDS
+} Command;
+
+/* Indexed by Command; a prefix picks the first name it matches, so "c" is continue and "s" step */
+static const char *command_names[NUM_COMMANDS] = {"step",   "continue", "cycle", "break",    "delete", "watch", "unwatch", "info",
+                                                  "registers", "memory", "x",   "pipeline", "where",  "help",  "quit"};
+
+/**
+ * @brief Debug a loaded program, reading commands until quit or the end of the input
+ *
+ * @param mips      MIPS simulator, with the program loaded and the pipeline engine selected (modes 0 to 2)
+ * @param input     Commands
+ * @return true if the program ran to its end (or failed), false if debugging stopped before
+ */
+bool run_debugger(MIPSSim *mips, FILE *input) {
+  Debugger *dbg = calloc(1, sizeof(Debugger));
+  dbg->mips = mips;
+  bool interactive = isatty(fileno(input));
+  char line[256], last[256] = "";
+  printf("Debugging %u words in mode %d. Type help for the commands.\n", mips->memory_size, mips->mode);
+  print_location(dbg);
+
+  bool quit = false;
+  while (!quit) {
+    if (interactive) {
+      printf("(mips) ");
+      fflush(stdout);
+    }
+    if (fgets(line, sizeof(line), input) == NULL) break;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[strspn(line, " \t")] == '\0') {
+      strcpy(line, last);
+    } else {
+      strcpy(last, line);
+    }
+
+    char *name = strtok(line, " \t");
+    char *arg = strtok(NULL, " \t");
+    char *arg2 = strtok(NULL, " \t");
+    if (name == NULL) continue;
+    Command command = 0;
+    while (command < NUM_COMMANDS && strncmp(command_names[command], name, strlen(name)) != 0) command++;
+    uint32_t count = arg != NULL ? strtoul(arg, NULL, 0) : 1;
+    uint32_t address;
+
+    switch (command) {
+      case CMD_STEP:
+        run_program(dbg, 0, count ? count : 1);
+        break;
+      case CMD_CYCLE:
+        run_program(dbg, count ? count : 1, 0);
+        break;
+      case CMD_CONTINUE:
+        run_program(dbg, 0, 0);
+        break;
+      case CMD_BREAK:
+        if (arg != NULL) {
+          add_breakpoint(dbg, arg);
+        } else {
+          print_points(dbg);
+        }
+        break;
+      case CMD_DELETE:
+        delete_breakpoint(dbg, arg);
+        break;
+      case CMD_WATCH:
+        if (arg != NULL) {
+          add_watchpoint(dbg, arg);
+        } else {
+          print_points(dbg);
+        }
+        break;
+      case CMD_UNWATCH:
+        delete_watchpoint(dbg, arg);
+        break;
+      case CMD_INFO:
+        print_points(dbg);
+        break;
+      case CMD_REGISTERS:
+        print_registers(mips);
+        break;
+      case CMD_MEMORY:
+        print_memory(mips);
+        break;
+      case CMD_EXAMINE:
+        if (arg == NULL) {
+          printf("Usage: x address [n]\n");
+        } else if (parse_address(arg, &address)) {
+          examine_memory(dbg, address, arg2 != NULL ? strtoul(arg2, NULL, 0) : 1);
+        }
+        break;
+      case CMD_PIPELINE:
+        print_stages(dbg);
+        break;
+      case CMD_WHERE:
+        print_location(dbg);
+        break;
+      case CMD_HELP:
+        print_help();
+        break;
+      case CMD_QUIT:
+        quit = true;
+        break;
+      default:
+        printf("Unknown command: %s. Type help for the commands.\n", name);
+        break;
+    }
+    fflush(stdout);
+  }
+
+  // Lift the breakpoints so that the decode cache is left as a normal run leaves it
+  for (uint32_t i = 0; i < dbg->num_breakpoints; i++) {
+    DecodedInstr *entry = decode_entry(mips, dbg->breakpoints[i]);
+    if (entry->breakpoint) *entry = (DecodedInstr){0};
+  }
+  bool finished = is_finished(mips);
+  free(dbg);
+  return finished;
+}
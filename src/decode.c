@@ -0,0 +1,139 @@
+/**
+ * @file  decode.c
+ * @copyright Copyright (c) 2024
+ */
+
+#include "decode.h"
+#include "common.h"
+
+/**
+ * @brief Decode a raw instruction word into its fields
+ *
+ * @param word    Raw instruction word
+ * @param decoded Decoded instruction to fill
+ * @return true if the opcode is valid, false otherwise
+ */
+bool decode_instruction(int32_t word, DecodedInstr *decoded) {
+  memset(decoded, 0, sizeof(DecodedInstr));
+  decoded->word = word;
+  decoded->opcode = (word >> 26) & INSTR_MASK;
+
+  switch (decoded->opcode) {
+    case ADD:
+    case SUB:
+    case MUL:
+    case OR:
+    case AND:
+    case XOR:
+      decoded->type = R_TYPE;
+      break;
+    case ADDI:
+    case SUBI:
+    case MULI:
+    case ORI:
+    case ANDI:
+    case XORI:
+      decoded->type = I_TYPE_IMM;
+      break;
+    case LDW:
+    case STW:
+      decoded->type = I_TYPE_MEM;
+      break;
+    case HALT:
+    case BZ:
+    case BEQ:
+    case JR:
+      decoded->type = J_TYPE;
+      break;
+    default:
+      return false;
+  }
+
+  decoded->rs = (word >> 21) & INSTR_MASK;
+  decoded->rt = (word >> 16) & INSTR_MASK;
+
+  if (decoded->type == R_TYPE) {
+    decoded->rd = (word >> 11) & INSTR_MASK;
+  } else {
+    decoded->imm = (int16_t)(word & 0xFFFF);
+  }
+
+  switch (decoded->opcode) {
+    case STW:
+    case BEQ:
+      decoded->reads = (1u << decoded->rs) | (1u << decoded->rt);
+      decoded->writes = -1;
+      break;
+    case BZ:
+    case JR:
+    case HALT:  // HALT waits on its rs field like the other J-Type instructions
+      decoded->reads = 1u << decoded->rs;
+      decoded->writes = -1;
+      break;
+    default:
+      decoded->reads = (1u << decoded->rs) | ((decoded->type == R_TYPE) ? (1u << decoded->rt) : 0);
+      decoded->writes = (decoded->type == R_TYPE) ? decoded->rd : decoded->rt;
+      break;
+  }
+
+  decoded->valid = true;
+  return true;
+}
+
+/**
+ * @brief Look up the decoded form of an instruction word in its decode cache entry, decoding it on first use
+ *
+ * @param entry Decode cache entry of the word's memory location
+ * @param word  Raw instruction word that was fetched from that location
+ * @return Decoded instruction, or NULL if the opcode is invalid or the entry holds a breakpoint
+ */
+const DecodedInstr *lookup_decoded(DecodedInstr *entry, int32_t word) {
+  if (!entry->valid || entry->word != word) {
+    if (entry->breakpoint || !decode_instruction(word, entry)) {
+      return NULL;
+    }
+  }
+  return entry;
+}
+
+/**
+ * @brief Write the assembly form of an instruction word (e.g. "ADDI R1 R0 5")
+ *
+ * @param word    Raw instruction word
+ * @param buffer  Output buffer
+ * @param size    Size of the buffer
+ * @return buffer
+ */
+char *format_instruction(int32_t word, char *buffer, size_t size) {
+  static const char *names[] = {"ADD", "ADDI", "SUB", "SUBI", "MUL", "MULI", "OR", "ORI", "AND",
+                                "ANDI", "XOR", "XORI", "LDW", "STW", "BZ", "BEQ", "JR", "HALT"};
+  DecodedInstr d;
+  if (!decode_instruction(word, &d)) {
+    snprintf(buffer, size, ".word 0x%08x", (uint32_t)word);
+    return buffer;
+  }
+
+  const char *name = names[d.opcode];
+  switch (d.opcode) {
+    case BZ:
+      snprintf(buffer, size, "%s R%d %d", name, d.rs, d.imm);
+      break;
+    case BEQ:
+      snprintf(buffer, size, "%s R%d R%d %d", name, d.rs, d.rt, d.imm);
+      break;
+    case JR:
+      snprintf(buffer, size, "%s R%d", name, d.rs);
+      break;
+    case HALT:
+      snprintf(buffer, size, "%s", name);
+      break;
+    default:
+      if (d.type == R_TYPE) {
+        snprintf(buffer, size, "%s R%d R%d R%d", name, d.rd, d.rs, d.rt);
+      } else {
+        snprintf(buffer, size, "%s R%d R%d %d", name, d.rt, d.rs, d.imm);
+      }
+      break;
+  }
+  return buffer;
+}
@@ -0,0 +1,258 @@
+/**
+ * @file  functional.c
+ * @brief Functional (non-timing) execution engine using a direct-threaded dispatch loop
+ * @copyright Copyright (c) 2024
+ */
+
+#include "functional.h"
+#include "common.h"
+#include "decode.h"
+#include "mips.h"
+#include "timing.h"
+
+/* Cycles an instruction spends in the non-pipelined datapath (IF, ID, EX, MEM, WB) */
+#define NOT_PIPED_CYCLES NUM_STAGES
+/* A HALT stops the simulation once it has executed (IF, ID, EX) */
+#define NOT_PIPED_HALT_CYCLES 3
+
+/**
+ * @brief Append an executed instruction to the retire stream, handing full buffers to the timing models
+ *
+ * @param stream  Retire stream
+ * @param d       Decoded instruction
+ * @param pc      PC of the instruction
+ * @return Record for the handler to fill in with the instruction's outcome
+ */
+static inline RetiredInstr *retire(RetireStream *stream, const DecodedInstr *d, uint32_t pc) {
+  if (stream->count == RETIRE_BUFFER_SIZE) flush_retire_stream(stream);
+  RetiredInstr *retired = &stream->buffer[stream->count++];
+  *retired = (RetiredInstr){
+      .pc = pc,
+      .opcode = d->opcode,
+      .type = d->type,
+      .rs = d->rs,
+      .rt = d->rt,
+      .rd = d->rd,
+      .reads = d->reads,
+      .writes = d->writes,
+  };
+  return retired;
+}
+
+/**
+ * @brief Run the program to completion without modelling the pipeline
+ *
+ * Every word is decoded once through the decode cache and bound to the address of its handler, so
+ * each instruction jumps straight to the next one's handler. Registers, memory, PC and the
+ * instruction counts end up exactly as after a NOT_PIPED run of process(), and the clock is derived
+ * from the NOT_PIPED timing rules (5 cycles per instruction, 3 for the final HALT, plus one for every
+ * taken branch).
+ *
+ * If a retire stream is given, every executed instruction is also appended to it (PC, registers read and
+ * written, branch outcome and memory address) so timing models can be driven from this single run. Branch
+ * targets follow the non-pipelined rules (PC of the branch + offset).
+ *
+ * @param mips    MIPS simulator
+ * @param stream  Retire stream to fill, or NULL
+ */
+void run_functional(MIPSSim *mips, RetireStream *stream) {
+  run_functional_for(mips, stream, 0);
+}
+
+/**
+ * @brief Run the program functionally for at most a given number of instructions
+ *
+ * Same as run_functional(), but stops before the instruction that would exceed max_instructions. The
+ * simulator is then left ready to continue from that instruction, with any engine.
+ *
+ * @param mips              MIPS simulator
+ * @param stream            Retire stream to fill, or NULL
+ * @param max_instructions  Number of instructions to execute (0 for no limit)
+ * @return true if the program finished, false if it was paused
+ */
+bool run_functional_for(MIPSSim *mips, RetireStream *stream, uint64_t max_instructions) {
+  static void *const handlers[] = {
+      [ADD] = &&op_add,   [ADDI] = &&op_addi, [SUB] = &&op_sub, [SUBI] = &&op_subi, [MUL] = &&op_mul, [MULI] = &&op_muli,
+      [OR] = &&op_or,     [ORI] = &&op_ori,   [AND] = &&op_and, [ANDI] = &&op_andi, [XOR] = &&op_xor, [XORI] = &&op_xori,
+      [LDW] = &&op_ldw,   [STW] = &&op_stw,   [BZ] = &&op_bz,   [BEQ] = &&op_beq,   [JR] = &&op_jr,   [HALT] = &&op_halt,
+  };
+
+  Value *regs = mips->registers;
+  Memory *memory = &mips->memory;
+  DecodedInstr *code = NULL;  // Decode cache of the page the PC is in
+  uint32_t code_page = UINT32_MAX;
+  uint32_t memory_size = mips->memory_size;
+  uint32_t pc = mips->pc;
+  DecodedInstr *d = NULL;
+  uint32_t index;
+  InstructionCount counts = {0};
+  uint32_t taken = 0;
+  uint64_t remaining = max_instructions ? max_instructions : UINT64_MAX;
+  bool paused = false;
+  RetiredInstr scratch;
+  RetiredInstr *retired = &scratch;  // Handlers record outcomes here; only kept when there is a stream
+
+#define REG(r) (regs[(r)].value)
+#define SET_REG(r, v)               \
+  do {                              \
+    regs[(r)].value = (int32_t)(v); \
+    regs[(r)].modified = true;      \
+  } while (0)
+#define DISPATCH()                                                \
+  do {                                                            \
+    if (pc / 4 >= memory_size) goto finished;                     \
+    index = pc / 4;                                               \
+    if (index >> MEMORY_PAGE_BITS != code_page) goto change_page; \
+    d = &code[index & MEMORY_WORD_MASK];                          \
+    if (d->handler == NULL) goto decode;                          \
+    if (remaining-- == 0) goto pause;                             \
+    if (stream) retired = retire(stream, d, pc);                  \
+    pc += 4;                                                      \
+    goto *d->handler;                                             \
+  } while (0)
+#define BRANCH_TARGET() ((int32_t)(pc - 4) + (d->imm << 2))
+// Loops can only run through taken branches, so that is where the cycle limit stops a run; the cycles of
+// straight-line code are checked once the run ends
+#define EXECUTED() (counts.arithmetic + counts.logical + counts.memory + counts.control)
+#define TAKE_BRANCH(target)                                                                             \
+  do {                                                                                                  \
+    pc = (target);                                                                                      \
+    taken++;                                                                                            \
+    retired->taken = true;                                                                              \
+    if (mips->cycle_limit && mips->clock + EXECUTED() * NOT_PIPED_CYCLES + taken > mips->cycle_limit) { \
+      sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);             \
+      goto finished;                                                                                    \
+    }                                                                                                   \
+  } while (0)
+
+  DISPATCH();
+
+change_page:
+  code = get_decoded_page(memory, index);
+  code_page = index >> MEMORY_PAGE_BITS;
+  DISPATCH();
+
+decode:
+  // Handlers are bound in the page's decode cache; a store to the word clears the entry
+  if (lookup_decoded(d, read_memory(memory, index)) == NULL) {
+    // The pipeline model only gets to decode the word if its fetch cycle is within the cycle limit
+    if (mips->cycle_limit && mips->clock + EXECUTED() * NOT_PIPED_CYCLES + taken + 1 > mips->cycle_limit) {
+      sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);
+    } else {
+      sim_error(mips, SIM_ERR_INVALID_OPCODE, "Invalid opcode: %08x", read_memory(memory, index));
+    }
+    goto finished;
+  }
+  d->handler = handlers[d->opcode];
+  DISPATCH();
+
+op_add:
+  SET_REG(d->rd, (uint32_t)REG(d->rs) + (uint32_t)REG(d->rt));
+  counts.arithmetic++;
+  DISPATCH();
+op_addi:
+  SET_REG(d->rt, (uint32_t)REG(d->rs) + (uint32_t)d->imm);
+  counts.arithmetic++;
+  DISPATCH();
+op_sub:
+  SET_REG(d->rd, (uint32_t)REG(d->rs) - (uint32_t)REG(d->rt));
+  counts.arithmetic++;
+  DISPATCH();
+op_subi:
+  SET_REG(d->rt, (uint32_t)REG(d->rs) - (uint32_t)d->imm);
+  counts.arithmetic++;
+  DISPATCH();
+op_mul:
+  SET_REG(d->rd, (uint32_t)REG(d->rs) * (uint32_t)REG(d->rt));
+  counts.arithmetic++;
+  DISPATCH();
+op_muli:
+  SET_REG(d->rt, (uint32_t)REG(d->rs) * (uint32_t)d->imm);
+  counts.arithmetic++;
+  DISPATCH();
+op_or:
+  SET_REG(d->rd, REG(d->rs) | REG(d->rt));
+  counts.logical++;
+  DISPATCH();
+op_ori:
+  SET_REG(d->rt, REG(d->rs) | d->imm);
+  counts.logical++;
+  DISPATCH();
+op_and:
+  SET_REG(d->rd, REG(d->rs) & REG(d->rt));
+  counts.logical++;
+  DISPATCH();
+op_andi:
+  SET_REG(d->rt, REG(d->rs) & d->imm);
+  counts.logical++;
+  DISPATCH();
+op_xor:
+  SET_REG(d->rd, REG(d->rs) ^ REG(d->rt));
+  counts.logical++;
+  DISPATCH();
+op_xori:
+  SET_REG(d->rt, REG(d->rs) ^ d->imm);
+  counts.logical++;
+  DISPATCH();
+op_ldw: {
+  int32_t address = REG(d->rs) + d->imm;
+  retired->mem_address = address;
+  SET_REG(d->rt, read_memory(memory, (uint32_t)address / 4));
+  counts.memory++;
+  DISPATCH();
+}
+op_stw: {
+  int32_t address = REG(d->rs) + d->imm;
+  retired->mem_address = address;
+  write_memory(memory, (uint32_t)address / 4, REG(d->rt));
+  counts.memory++;
+  DISPATCH();
+}
+op_bz:
+  counts.control++;
+  if (REG(d->rs) == 0) TAKE_BRANCH(BRANCH_TARGET());
+  DISPATCH();
+op_beq:
+  counts.control++;
+  if (REG(d->rs) == REG(d->rt)) TAKE_BRANCH(BRANCH_TARGET());
+  DISPATCH();
+op_jr:
+  counts.control++;
+  TAKE_BRANCH(REG(d->rs));
+  DISPATCH();
+op_halt:
+  counts.control++;
+  taken++;
+  retired->taken = true;
+  mips->halt = true;
+  goto finished;
+
+#undef REG
+#undef SET_REG
+#undef DISPATCH
+#undef BRANCH_TARGET
+#undef EXECUTED
+#undef TAKE_BRANCH
+
+pause:
+  paused = true;
+
+finished:
+  counts.total = counts.arithmetic + counts.logical + counts.memory + counts.control;
+  mips->counts.total += counts.total;
+  mips->counts.arithmetic += counts.arithmetic;
+  mips->counts.logical += counts.logical;
+  mips->counts.memory += counts.memory;
+  mips->counts.control += counts.control;
+  // A run that starts outside the image still takes the cycle in which the pipeline finds nothing to fetch
+  if (mips->pc / 4 >= memory_size && !mips->done) mips->clock++;
+  mips->pc = pc;
+  mips->clock += counts.total * NOT_PIPED_CYCLES + taken;
+  if (mips->halt) mips->clock -= NOT_PIPED_CYCLES - NOT_PIPED_HALT_CYCLES;
+  mips->done = !paused;
+  if (mips->cycle_limit && mips->clock > mips->cycle_limit && mips->status == SIM_OK) {
+    sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);
+    return true;
+  }
+  return !paused;
+}
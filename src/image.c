@@ -0,0 +1,275 @@
+/**
+ * @file  image.c
+ * @brief Memory image loading: hex text images and mmap-backed binary images, from files or stdin
+ * @copyright Copyright (c) 2024
+ */
+
+#include "image.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+
+/* A run of at least this many zero words splits a saved image into separate segments */
+#define SEGMENT_GAP_WORDS 16
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  bool is_mapped;
+} ImageFile;
+
+/**
+ * @brief Get the contents of an image file. Regular files are mapped; pipes and stdin ("-") are read
+ * into a buffer.
+ *
+ * @param mips      MIPS simulator (for errors)
+ * @param filename  File to read, or "-" for stdin
+ * @param image     File contents
+ * @return SIM_OK, or SIM_ERR_FILE if the file cannot be read
+ */
+static SimStatus open_image_file(MIPSSim *mips, const char *filename, ImageFile *image) {
+  bool is_stdin = strcmp(filename, "-") == 0;
+  int fd = is_stdin ? STDIN_FILENO : open(filename, O_RDONLY);
+  if (fd < 0) {
+    return sim_error(mips, SIM_ERR_FILE, "Failed to open file: %s", strerror(errno));
+  }
+
+  *image = (ImageFile){0};
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      if (!is_stdin) close(fd);
+      *image = (ImageFile){.data = data, .size = st.st_size, .is_mapped = true};
+      return SIM_OK;
+    }
+  }
+
+  uint8_t *buffer = NULL;
+  size_t capacity = 0;
+  ssize_t n;
+  do {
+    if (image->size == capacity) {
+      capacity = capacity ? capacity * 2 : 65536;
+      uint8_t *grown = realloc(buffer, capacity);
+      if (grown == NULL) {
+        n = -1;
+        errno = ENOMEM;
+        break;
+      }
+      buffer = grown;
+    }
+    n = read(fd, buffer + image->size, capacity - image->size);
+    if (n > 0) image->size += n;
+  } while (n > 0 || (n < 0 && errno == EINTR));
+
+  int error = errno;
+  if (!is_stdin) close(fd);
+  if (n < 0) {
+    free(buffer);
+    return sim_error(mips, SIM_ERR_FILE, "Failed to read file: %s", strerror(error));
+  }
+  image->data = buffer;
+  return SIM_OK;
+}
+
+static void close_image_file(ImageFile *image) {
+  if (image->is_mapped) {
+    munmap((void *)image->data, image->size);
+  } else {
+    free((void *)image->data);
+  }
+}
+
+static inline int hex_digit(uint8_t c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * @brief Load a text image: one hexadecimal word per line, from address 0
+ *
+ * @param mips  MIPS simulator
+ * @param data  File contents
+ * @param size  File size
+ */
+static void load_text_image(MIPSSim *mips, const uint8_t *data, size_t size) {
+  const uint8_t *p = data, *end = data + size;
+  int32_t words[MEMORY_PAGE_WORDS];
+  uint32_t i = 0, n = 0;
+
+  while (p < end && i + n < MEMORY_NUM_PAGES * MEMORY_PAGE_WORDS) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+
+    uint32_t word = 0;
+    int digit;
+    while (p < end && (digit = hex_digit(*p)) >= 0) {
+      word = (word << 4) | digit;
+      p++;
+    }
+    while (p < end && *p++ != '\n');  // Skip the rest of the line
+
+    words[n++] = (int32_t)word;
+    if (n == MEMORY_PAGE_WORDS) {
+      copy_to_memory(&mips->memory, i, words, n);
+      i += n;
+      n = 0;
+    }
+  }
+  copy_to_memory(&mips->memory, i, words, n);
+  mips->memory_size = i + n;  // Set the memory size with the number of instructions loaded
+}
+
+/**
+ * @brief Load a binary image. The words of each segment are copied straight from the mapped file.
+ *
+ * @param mips      MIPS simulator
+ * @param filename  File name (for errors)
+ * @param data      File contents
+ * @param size      File size
+ * @return SIM_OK, or SIM_ERR_IMAGE if the image is invalid
+ */
+static SimStatus load_binary_image(MIPSSim *mips, const char *filename, const uint8_t *data, size_t size) {
+  const ImageHeader *header = (const ImageHeader *)data;
+  if (size < sizeof(ImageHeader)) {
+    return sim_error(mips, SIM_ERR_IMAGE, "%s: corrupt image", filename);
+  }
+  if (header->version != IMAGE_VERSION) {
+    return sim_error(mips, SIM_ERR_IMAGE, "%s: unsupported image version %u", filename, header->version);
+  }
+  if (header->memory_size > MEMORY_NUM_PAGES * MEMORY_PAGE_WORDS || header->entry_pc % 4 != 0 ||
+      sizeof(ImageHeader) + (uint64_t)header->num_segments * sizeof(ImageSegment) > size) {
+    return sim_error(mips, SIM_ERR_IMAGE, "%s: corrupt image", filename);
+  }
+
+  const ImageSegment *segments = (const ImageSegment *)(data + sizeof(ImageHeader));
+  for (uint32_t n = 0; n < header->num_segments; n++) {
+    const ImageSegment *segment = &segments[n];
+    if (segment->address % 4 != 0 || segment->offset % 4 != 0 ||
+        segment->address / 4 + (uint64_t)segment->num_words > header->memory_size ||
+        segment->offset + (uint64_t)segment->num_words * 4 > size) {
+      return sim_error(mips, SIM_ERR_IMAGE, "%s: corrupt segment %u", filename, n);
+    }
+
+    copy_to_memory(&mips->memory, segment->address / 4, (const int32_t *)(data + segment->offset), segment->num_words);
+  }
+
+  mips->memory_size = header->memory_size;
+  mips->pc = header->entry_pc;
+  return SIM_OK;
+}
+
+/**
+ * @brief Load the program into memory from a file. Binary images are recognized by their header;
+ * anything else is read as a text image.
+ *
+ * @param mips      MIPS simulator
+ * @param filename  File to load, or "-" for stdin
+ * @return SIM_OK, SIM_ERR_FILE if the file cannot be read, or SIM_ERR_IMAGE if a binary image is invalid
+ */
+SimStatus load_memory(MIPSSim *mips, char *filename) {
+  ImageFile image;
+  if (open_image_file(mips, filename, &image) != SIM_OK) return mips->status;
+
+  SimStatus status = load_image(mips, filename, image.data, image.size);
+  close_image_file(&image);
+  LOG("Memory loaded from file: %s\n", filename);
+  return status;
+}
+
+/**
+ * @brief Load the program into memory from an image already in memory, text or binary
+ *
+ * @param mips  MIPS simulator
+ * @param name  Name of the image (for errors)
+ * @param data  Image contents
+ * @param size  Image size in bytes
+ * @return SIM_OK, or SIM_ERR_IMAGE if a binary image is invalid
+ */
+SimStatus load_image(MIPSSim *mips, const char *name, const void *data, size_t size) {
+  if (size >= sizeof(((ImageHeader *)0)->magic) && memcmp(data, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0) {
+    return load_binary_image(mips, name, data, size);
+  }
+  load_text_image(mips, data, size);
+  return SIM_OK;
+}
+
+/**
+ * @brief Save the loaded program as a binary image. Memory is split into segments at long runs of
+ * zero words, which are left out.
+ *
+ * @param mips      MIPS simulator
+ * @param filename  Image file, or "-" for stdout
+ * @return true on success, false if the file cannot be written
+ */
+bool save_image(MIPSSim *mips, const char *filename) {
+  ImageHeader header = {.version = IMAGE_VERSION, .entry_pc = mips->pc, .memory_size = mips->memory_size};
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+
+  // Find the segments: runs of words that are not separated by SEGMENT_GAP_WORDS or more zeros
+  ImageSegment *segments = NULL;
+  uint32_t capacity = 0;
+  uint32_t i = 0;
+  while (i < mips->memory_size) {
+    if (read_memory(&mips->memory, i) == 0) {
+      i++;
+      continue;
+    }
+    uint32_t start = i, last = i, zeros = 0;
+    for (; i < mips->memory_size && zeros < SEGMENT_GAP_WORDS; i++) {
+      if (read_memory(&mips->memory, i) != 0) {
+        last = i;
+        zeros = 0;
+      } else {
+        zeros++;
+      }
+    }
+
+    if (header.num_segments == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      ImageSegment *grown = realloc(segments, capacity * sizeof(ImageSegment));
+      if (grown == NULL) {
+        perror("Failed to save image");
+        free(segments);
+        return false;
+      }
+      segments = grown;
+    }
+    segments[header.num_segments++] = (ImageSegment){.address = start * 4, .num_words = last - start + 1};
+  }
+
+  uint64_t offset = sizeof(ImageHeader) + header.num_segments * sizeof(ImageSegment);
+  for (uint32_t n = 0; n < header.num_segments; n++) {
+    segments[n].offset = offset;
+    offset += segments[n].num_words * 4;
+  }
+
+  bool to_stdout = strcmp(filename, "-") == 0;
+  FILE *file = to_stdout ? stdout : fopen(filename, "wb");
+  if (!file) {
+    perror("Failed to open image file");
+    free(segments);
+    return false;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (header.num_segments > 0) ok = ok && fwrite(segments, sizeof(ImageSegment), header.num_segments, file) == header.num_segments;
+  for (uint32_t n = 0; ok && n < header.num_segments; n++) {
+    for (uint32_t w = 0; ok && w < segments[n].num_words; w++) {
+      int32_t word = read_memory(&mips->memory, segments[n].address / 4 + w);
+      ok = fwrite(&word, sizeof(word), 1, file) == 1;
+    }
+  }
+
+  if (to_stdout ? fflush(file) != 0 : fclose(file) != 0) ok = false;
+  if (!ok) perror("Failed to write image");
+  free(segments);
+  return ok;
+}
@@ -0,0 +1,719 @@
+/**
+ * @file  jit.c
+ * @brief Functional engine translating guest basic blocks to x86-64 code
+ *
+ * A block runs from the PC to the first BZ, BEQ, JR or HALT (or JIT_MAX_BLOCK_INSTRS instructions). Its
+ * code keeps the guest register file in rbx and the JitState in rbp, calls back into C for loads and
+ * stores, and adds the block's instruction counts and cycles to the state on the way out. Exits with a
+ * static target start as a jump to a stub that returns to the dispatcher; the dispatcher patches them to
+ * jump straight into the next block once it is translated, so hot loops never leave translated code.
+ * A store to a word some block was translated from drops those blocks, undoes the links into them and
+ * returns to the dispatcher, which translates the new code. The code buffer is only made writable, one
+ * range at a time, while a block is emitted or an exit patched, and is never writable and executable.
+ * @copyright Copyright (c) 2024
+ */
+
+#include "jit.h"
+#include "common.h"
+#include "decode.h"
+#include "functional.h"
+#include "memory.h"
+#include "mips.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Cycles an instruction spends in the non-pipelined datapath, and the cycles of a final HALT */
+#define NOT_PIPED_CYCLES NUM_STAGES
+#define NOT_PIPED_HALT_CYCLES 3
+
+/* Upper bound of the code of one block: no instruction needs more than 128 bytes with its store exit */
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK_INSTRS * 128 + 512)
+
+/* Host registers, by x86 encoding */
+#define X86_EAX 0
+#define X86_EDX 2
+#define X86_ESI 6
+
+#define REG_VALUE(r) ((uint32_t)(r) * (uint32_t)sizeof(Value))
+#define REG_MODIFIED(r) (REG_VALUE(r) + (uint32_t)offsetof(Value, modified))
+
+_Static_assert(sizeof(Value) == 8 && offsetof(Value, modified) == 4, "translated code assumes 8-byte registers");
+_Static_assert(offsetof(Jit, state) == 0, "translated code passes its JitState to the helpers as the Jit");
+_Static_assert(JIT_MAX_BLOCK_INSTRS <= MEMORY_PAGE_WORDS, "a block must start in the memory page of its last word or the one before");
+
+typedef struct {
+  uint8_t *p;
+} Emitter;
+
+static void emit8(Emitter *e, uint8_t byte) {
+  *e->p++ = byte;
+}
+
+static void emit32(Emitter *e, uint32_t value) {
+  memcpy(e->p, &value, sizeof(value));
+  e->p += sizeof(value);
+}
+
+static void emit64(Emitter *e, uint64_t value) {
+  memcpy(e->p, &value, sizeof(value));
+  e->p += sizeof(value);
+}
+
+/**
+ * @brief Emit an instruction whose memory operand is a guest register, [rbx + disp32]
+ *
+ * @param e       Emitter
+ * @param opcode  Opcode byte (after any 0x0F escape)
+ * @param reg     ModRM reg field: host register or opcode extension
+ * @param offset  Offset in the guest register file
+ */
+static void emit_guest_operand(Emitter *e, uint8_t opcode, uint8_t reg, uint32_t offset) {
+  emit8(e, opcode);
+  emit8(e, 0x83 | reg << 3);
+  emit32(e, offset);
+}
+
+/**
+ * @brief Emit an instruction whose memory operand is a JitState field, [rbp + disp32]
+ *
+ * @param e       Emitter
+ * @param wide    Emit REX.W for a 64-bit operand
+ * @param opcode  Opcode byte
+ * @param reg     ModRM reg field: host register or opcode extension
+ * @param offset  Offset in the JitState
+ */
+static void emit_state_operand(Emitter *e, bool wide, uint8_t opcode, uint8_t reg, size_t offset) {
+  if (wide) emit8(e, 0x48);
+  emit8(e, opcode);
+  emit8(e, 0x85 | reg << 3);
+  emit32(e, (uint32_t)offset);
+}
+
+/**
+ * @brief Emit a jmp (cc = 0) or jcc rel32 and return where its displacement goes
+ */
+static uint8_t *emit_jump(Emitter *e, uint8_t cc) {
+  if (cc) {
+    emit8(e, 0x0F);
+    emit8(e, cc);
+  } else {
+    emit8(e, 0xE9);
+  }
+  uint8_t *rel = e->p;
+  emit32(e, 0);
+  return rel;
+}
+
+static void patch_jump(uint8_t *rel, const uint8_t *target) {
+  int32_t displacement = (int32_t)(target - (rel + 4));
+  memcpy(rel, &displacement, sizeof(displacement));
+}
+
+/**
+ * @brief Make part of the code buffer writable, or executable again
+ *
+ * @param start     First byte
+ * @param end       Byte after the last
+ * @param writable  true for read and write, false for read and execute
+ */
+static void protect_code(uint8_t *start, uint8_t *end, bool writable) {
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t from = (uintptr_t)start & ~(page - 1);
+  uintptr_t to = ((uintptr_t)end + page - 1) & ~(page - 1);
+  if (mprotect((void *)from, to - from, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0) {
+    perror("Failed to change the protection of translated code");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Point an emitted jump at another target */
+static void repatch_jump(uint8_t *rel, const uint8_t *target) {
+  protect_code(rel, rel + 4, true);
+  patch_jump(rel, target);
+  protect_code(rel, rel + 4, false);
+}
+
+#define JMP 0
+#define JE 0x84
+#define JNE 0x85
+#define JG 0x8F
+
+/* Store eax to a guest register and mark it modified */
+static void emit_set_reg(Emitter *e, uint8_t r) {
+  emit_guest_operand(e, 0x89, X86_EAX, REG_VALUE(r));  // mov [rbx + r], eax
+  emit_guest_operand(e, 0xC6, 0, REG_MODIFIED(r));     // mov byte [rbx + r + 4], 1
+  emit8(e, 1);
+}
+
+/* Call a helper as helper(jit, esi, edx); the result is in eax */
+static void emit_call(Emitter *e, const void *helper) {
+  emit8(e, 0x48);  // mov rdi, rbp
+  emit8(e, 0x89);
+  emit8(e, 0xEF);
+  emit8(e, 0x48);  // mov rax, helper
+  emit8(e, 0xB8);
+  emit64(e, (uint64_t)(uintptr_t)helper);
+  emit8(e, 0xFF);  // call rax
+  emit8(e, 0xD0);
+}
+
+/* Return to the dispatcher with an exit reason */
+static void emit_leave(Emitter *e, Jit *jit, JitExit reason) {
+  emit8(e, 0xB8);  // mov eax, reason
+  emit32(e, reason);
+  patch_jump(emit_jump(e, JMP), jit->leave);
+}
+
+/**
+ * @brief Emit the counter updates for the first instructions of a block
+ *
+ * @param e       Emitter
+ * @param instrs  Instructions of the block
+ * @param count   Number of them executed at this exit
+ */
+static void emit_counts(Emitter *e, const DecodedInstr *instrs, uint32_t count) {
+  uint32_t arithmetic = 0, logical = 0, memory = 0, control = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    Opcode opcode = instrs[i].opcode;
+    if (opcode >= ADD && opcode <= MULI) {
+      arithmetic++;
+    } else if (opcode >= OR && opcode <= XORI) {
+      logical++;
+    } else if (opcode == LDW || opcode == STW) {
+      memory++;
+    } else {
+      control++;
+    }
+  }
+
+  const struct {
+    size_t offset;
+    uint32_t value;
+  } counters[] = {
+      {offsetof(JitState, arithmetic), arithmetic},
+      {offsetof(JitState, logical), logical},
+      {offsetof(JitState, memory), memory},
+      {offsetof(JitState, control), control},
+      {offsetof(JitState, cycles), count * NOT_PIPED_CYCLES},
+  };
+  for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+    if (counters[i].value == 0) continue;
+    emit_state_operand(e, true, 0x81, 0, counters[i].offset);  // add qword [rbp + counter], value
+    emit32(e, counters[i].value);
+  }
+}
+
+/* Count a taken branch whose target is in state.pc, and leave if it passes the cycle limit */
+static void emit_taken_branch(Emitter *e, Jit *jit) {
+  emit_state_operand(e, true, 0x81, 0, offsetof(JitState, cycles));  // add qword [rbp + cycles], 1
+  emit32(e, 1);
+  if (!jit->checks_budget) return;
+  emit_state_operand(e, true, 0x8B, X86_EAX, offsetof(JitState, cycles));        // mov rax, [rbp + cycles]
+  emit_state_operand(e, true, 0x3B, X86_EAX, offsetof(JitState, cycle_budget));  // cmp rax, [rbp + cycle_budget]
+  patch_jump(emit_jump(e, JG), jit->limit_exit);
+}
+
+/**
+ * @brief Emit an exit to a known guest address, as a jump the dispatcher can later point at the target block
+ *
+ * @param e       Emitter
+ * @param jit     JIT
+ * @param target  Guest PC to continue at
+ */
+static void emit_chained_exit(Emitter *e, Jit *jit, uint32_t target) {
+  uint8_t *site = e->p;
+  uint8_t *rel = emit_jump(e, JMP);
+  patch_jump(rel, e->p);  // Falls through to the stub until the exit is linked
+
+  emit_state_operand(e, false, 0xC7, 0, offsetof(JitState, pc));  // mov dword [rbp + pc], target
+  emit32(e, target);
+  int32_t site_offset = (int32_t)(site - (e->p + 7));
+  emit8(e, 0x48);  // lea rax, [rip + site]
+  emit8(e, 0x8D);
+  emit8(e, 0x05);
+  emit32(e, (uint32_t)site_offset);
+  emit_state_operand(e, true, 0x89, X86_EAX, offsetof(JitState, exit_site));  // mov [rbp + exit_site], rax
+  emit_leave(e, jit, JIT_EXIT_CONTINUE);
+}
+
+/* Exit to the address in state.pc, which cannot be chained */
+static void emit_unchained_exit(Emitter *e, Jit *jit) {
+  emit_state_operand(e, true, 0xC7, 0, offsetof(JitState, exit_site));  // mov qword [rbp + exit_site], 0
+  emit32(e, 0);
+  emit_leave(e, jit, JIT_EXIT_CONTINUE);
+}
+
+/**
+ * @brief Load a word for translated code
+ *
+ * @param jit   JIT
+ * @param index Word index
+ * @return Word value
+ */
+static int32_t jit_load(Jit *jit, uint32_t index) {
+  return read_memory(&jit->mips->memory, index);
+}
+
+static void invalidate_blocks(Jit *jit, uint32_t index);
+
+/**
+ * @brief Store a word for translated code, dropping the blocks translated from it
+ *
+ * @param jit   JIT
+ * @param index Word index
+ * @param value Word value
+ * @return 1 if translated code was overwritten and the block must return to the dispatcher, 0 otherwise
+ */
+static int jit_store(Jit *jit, uint32_t index, int32_t value) {
+  write_memory(&jit->mips->memory, index, value);
+  if (index >= jit->mips->memory_size || jit->coverage[index] == 0) return 0;
+  invalidate_blocks(jit, index);
+  return 1;
+}
+
+/* Compute the word index of REG(rs) + imm in esi */
+static void emit_address(Emitter *e, const DecodedInstr *d) {
+  emit_guest_operand(e, 0x8B, X86_EAX, REG_VALUE(d->rs));  // mov eax, [rbx + rs]
+  emit8(e, 0x05);                                          // add eax, imm
+  emit32(e, (uint32_t)(int32_t)d->imm);
+  emit8(e, 0xC1);  // shr eax, 2
+  emit8(e, 0xE8);
+  emit8(e, 2);
+  emit8(e, 0x89);  // mov esi, eax
+  emit8(e, 0xC0 | X86_EAX << 3 | X86_ESI);
+}
+
+/**
+ * @brief Emit an ALU instruction or a load
+ *
+ * @param e Emitter
+ * @param d Decoded instruction
+ */
+static void emit_instruction(Emitter *e, const DecodedInstr *d) {
+  // Opcodes of op eax, r/m32 and op eax, imm32 (0 where there is none)
+  static const uint8_t reg_ops[] = {[ADD] = 0x03, [SUB] = 0x2B, [MUL] = 0xAF, [OR] = 0x0B, [AND] = 0x23, [XOR] = 0x33};
+  static const uint8_t imm_ops[] = {[ADDI] = 0x05, [SUBI] = 0x2D, [MULI] = 0x69, [ORI] = 0x0D, [ANDI] = 0x25, [XORI] = 0x35};
+
+  switch (d->type) {
+    case R_TYPE:
+      emit_guest_operand(e, 0x8B, X86_EAX, REG_VALUE(d->rs));  // mov eax, [rbx + rs]
+      if (d->opcode == MUL) emit8(e, 0x0F);                    // imul eax, [rbx + rt]
+      emit_guest_operand(e, reg_ops[d->opcode], X86_EAX, REG_VALUE(d->rt));
+      emit_set_reg(e, d->rd);
+      break;
+    case I_TYPE_IMM:
+      emit_guest_operand(e, 0x8B, X86_EAX, REG_VALUE(d->rs));
+      emit8(e, imm_ops[d->opcode]);
+      if (d->opcode == MULI) emit8(e, 0xC0);  // imul eax, eax, imm
+      emit32(e, (uint32_t)(int32_t)d->imm);   // Immediates are sign-extended, as in the interpreter
+      emit_set_reg(e, d->rt);
+      break;
+    case I_TYPE_MEM:  // LDW; stores need an exit and are emitted by translate_block()
+      emit_address(e, d);
+      emit_call(e, (const void *)jit_load);
+      emit_set_reg(e, d->rt);
+      break;
+    default:
+      break;
+  }
+}
+
+/**
+ * @brief Drop every block and link and start filling the code buffer again
+ *
+ * @param jit JIT
+ */
+static void flush_translations(Jit *jit) {
+  uint32_t memory_size = jit->mips->memory_size;
+  memset(jit->block_at, 0, memory_size * sizeof(JitBlock *));
+  memset(jit->page_blocks, 0, ((memory_size >> MEMORY_PAGE_BITS) + 1) * sizeof(JitBlock *));
+  memset(jit->coverage, 0, memory_size * sizeof(uint32_t));
+  jit->num_blocks = 0;
+  jit->num_links = 0;
+  jit->code_end = jit->code_start;
+  jit->flushes++;
+}
+
+/**
+ * @brief Drop the blocks translated from a word and point the exits linked to them back at their stubs.
+ * A block is no longer than a memory page, so only the blocks starting in the word's page or the one
+ * before it are looked at.
+ *
+ * @param jit   JIT
+ * @param index Word index
+ */
+static void invalidate_blocks(Jit *jit, uint32_t index) {
+  uint32_t page = index >> MEMORY_PAGE_BITS;
+  for (uint32_t p = page ? page - 1 : page; p <= page; p++) {
+    JitBlock **prev = &jit->page_blocks[p];
+    while (*prev != NULL) {
+      JitBlock *block = *prev;
+      if (index < block->index || index >= block->index + block->length) {
+        prev = &block->next_in_page;
+        continue;
+      }
+
+      *prev = block->next_in_page;
+      block->valid = false;
+      if (jit->block_at[block->index] == block) jit->block_at[block->index] = NULL;
+      for (uint32_t w = block->index; w < block->index + block->length; w++) jit->coverage[w]--;
+      for (JitLink *link = block->links; link != NULL; link = link->next_link) {
+        repatch_jump(link->site + 1, link->stub);
+        link->target = NULL;
+      }
+      block->links = NULL;
+    }
+  }
+}
+
+/**
+ * @brief Translate the block starting at a PC
+ *
+ * @param jit JIT
+ * @param pc  Guest PC, inside the program
+ * @return Block, or NULL if the word at pc is not a valid instruction
+ */
+static JitBlock *translate_block(Jit *jit, uint32_t pc) {
+  MIPSSim *mips = jit->mips;
+  uint32_t index = pc / 4;
+  DecodedInstr instrs[JIT_MAX_BLOCK_INSTRS];
+  uint32_t n = 0;
+  while (n < JIT_MAX_BLOCK_INSTRS && index + n < mips->memory_size &&
+         decode_instruction(read_memory(&mips->memory, index + n), &instrs[n])) {
+    if (instrs[n++].type == J_TYPE) break;
+  }
+  if (n == 0) return NULL;
+
+  if (jit->num_blocks == JIT_MAX_BLOCKS || jit->buffer + JIT_BUFFER_SIZE - jit->code_end < JIT_MAX_BLOCK_BYTES) {
+    flush_translations(jit);
+  }
+
+  JitBlock *block = &jit->blocks[jit->num_blocks++];
+  *block = (JitBlock){.pc = pc, .index = index, .length = n, .code = jit->code_end, .valid = true};
+  protect_code(block->code, block->code + JIT_MAX_BLOCK_BYTES, true);
+  Emitter e = {jit->code_end};
+  uint8_t *store_exits[JIT_MAX_BLOCK_INSTRS] = {NULL};
+
+  for (uint32_t i = 0; i < n; i++) {
+    const DecodedInstr *d = &instrs[i];
+    if (d->opcode == STW) {
+      emit_address(&e, d);
+      emit_guest_operand(&e, 0x8B, X86_EDX, REG_VALUE(d->rt));  // mov edx, [rbx + rt]
+      emit_call(&e, (const void *)jit_store);
+      emit8(&e, 0x85);  // test eax, eax
+      emit8(&e, 0xC0);
+      store_exits[i] = emit_jump(&e, JNE);
+    } else if (d->type != J_TYPE) {
+      emit_instruction(&e, d);
+    }
+  }
+
+  // The counters include the last instruction, whichever way it leaves the block
+  const DecodedInstr *last = &instrs[n - 1];
+  uint32_t next_pc = pc + n * 4;
+  emit_counts(&e, instrs, n);
+  switch (last->opcode) {
+    case BZ:
+    case BEQ: {
+      uint8_t *not_taken;
+      if (last->opcode == BZ) {
+        emit_guest_operand(&e, 0x83, 7, REG_VALUE(last->rs));  // cmp dword [rbx + rs], 0
+        emit8(&e, 0);
+      } else {
+        emit_guest_operand(&e, 0x8B, X86_EAX, REG_VALUE(last->rs));  // mov eax, [rbx + rs]
+        emit_guest_operand(&e, 0x3B, X86_EAX, REG_VALUE(last->rt));  // cmp eax, [rbx + rt]
+      }
+      not_taken = emit_jump(&e, JNE);
+      uint32_t target = (uint32_t)((int32_t)(next_pc - 4) + (last->imm << 2));
+      if (jit->checks_budget) {
+        emit_state_operand(&e, false, 0xC7, 0, offsetof(JitState, pc));  // mov dword [rbp + pc], target
+        emit32(&e, target);
+      }
+      emit_taken_branch(&e, jit);
+      emit_chained_exit(&e, jit, target);
+      patch_jump(not_taken, e.p);
+      emit_chained_exit(&e, jit, next_pc);
+      break;
+    }
+    case JR:
+      emit_guest_operand(&e, 0x8B, X86_EAX, REG_VALUE(last->rs));  // mov eax, [rbx + rs]
+      emit_state_operand(&e, false, 0x89, X86_EAX, offsetof(JitState, pc));
+      emit_taken_branch(&e, jit);
+      emit_unchained_exit(&e, jit);
+      break;
+    case HALT:
+      emit_state_operand(&e, true, 0x81, 0, offsetof(JitState, cycles));
+      emit32(&e, 1);
+      emit_state_operand(&e, false, 0xC7, 0, offsetof(JitState, pc));
+      emit32(&e, next_pc);
+      emit_leave(&e, jit, JIT_EXIT_HALT);
+      break;
+    default:  // Split off, or followed by an invalid word or the end of the program
+      emit_chained_exit(&e, jit, next_pc);
+      break;
+  }
+
+  // Stores that overwrote translated code leave right after themselves
+  for (uint32_t i = 0; i < n; i++) {
+    if (store_exits[i] == NULL) continue;
+    patch_jump(store_exits[i], e.p);
+    emit_counts(&e, instrs, i + 1);
+    emit_state_operand(&e, false, 0xC7, 0, offsetof(JitState, pc));
+    emit32(&e, pc + (i + 1) * 4);
+    emit_unchained_exit(&e, jit);
+  }
+
+  protect_code(block->code, block->code + JIT_MAX_BLOCK_BYTES, false);
+  jit->code_end = e.p;
+  jit->block_at[index] = block;
+  block->next_in_page = jit->page_blocks[index >> MEMORY_PAGE_BITS];
+  jit->page_blocks[index >> MEMORY_PAGE_BITS] = block;
+  for (uint32_t w = index; w < index + n; w++) jit->coverage[w]++;
+  return block;
+}
+
+/**
+ * @brief Point a block exit straight at the block it continues to
+ *
+ * @param jit     JIT
+ * @param site    jmp rel32 of the exit
+ * @param target  Block the exit continues to
+ */
+static void link_blocks(Jit *jit, uint8_t *site, JitBlock *target) {
+  if (jit->num_links == JIT_MAX_LINKS) return;  // Left to the dispatcher
+  int32_t displacement;
+  memcpy(&displacement, site + 1, sizeof(displacement));
+  JitLink *link = &jit->links[jit->num_links++];
+  *link = (JitLink){.site = site, .stub = site + 5 + displacement, .target = target, .next_link = target->links};
+  target->links = link;
+  repatch_jump(site + 1, target->code);
+}
+
+/**
+ * @brief Map the code buffer, emit the trampolines and make it executable
+ *
+ * @param jit     JIT
+ * @param mips    MIPS simulator
+ * @param stepped Whether the program runs in several run_jit_for() calls
+ * @return true on success, false if the host refuses executable memory or memory runs out
+ */
+static bool init_jit(Jit *jit, MIPSSim *mips, bool stepped) {
+  *jit = (Jit){.mips = mips, .checks_budget = stepped || mips->cycle_limit != 0};
+  jit->buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jit->buffer == MAP_FAILED) {
+    jit->buffer = NULL;
+    return false;
+  }
+  jit->blocks = malloc(JIT_MAX_BLOCKS * sizeof(JitBlock));
+  jit->links = malloc(JIT_MAX_LINKS * sizeof(JitLink));
+  jit->block_at = calloc(mips->memory_size + 1, sizeof(JitBlock *));
+  jit->page_blocks = calloc((mips->memory_size >> MEMORY_PAGE_BITS) + 1, sizeof(JitBlock *));
+  jit->coverage = calloc(mips->memory_size + 1, sizeof(uint32_t));
+  if (jit->blocks == NULL || jit->links == NULL || jit->block_at == NULL || jit->page_blocks == NULL || jit->coverage == NULL) {
+    return false;
+  }
+
+  // enter(state, registers, code): save the callee-saved registers used by blocks (keeping the stack
+  // 16-byte aligned for the helper calls) and jump to the code
+  static const uint8_t enter[] = {
+      0x53,                    // push rbx
+      0x55,                    // push rbp
+      0x48, 0x83, 0xEC, 0x08,  // sub rsp, 8
+      0x48, 0x89, 0xFD,        // mov rbp, rdi
+      0x48, 0x89, 0xF3,        // mov rbx, rsi
+      0xFF, 0xE2,              // jmp rdx
+  };
+  static const uint8_t leave[] = {
+      0x48, 0x83, 0xC4, 0x08,  // add rsp, 8
+      0x5D,                    // pop rbp
+      0x5B,                    // pop rbx
+      0xC3,                    // ret
+  };
+  Emitter e = {jit->buffer};
+  memcpy(e.p, enter, sizeof(enter));
+  e.p += sizeof(enter);
+  jit->leave = e.p;
+  memcpy(e.p, leave, sizeof(leave));
+  e.p += sizeof(leave);
+  jit->limit_exit = e.p;
+  emit_leave(&e, jit, JIT_EXIT_CYCLE_LIMIT);
+
+  jit->enter = (JitEntry)(void *)jit->buffer;
+  jit->code_start = jit->code_end = e.p;
+  return mprotect(jit->buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC) == 0;
+}
+
+static void destroy_jit(Jit *jit) {
+  if (jit->buffer != NULL) munmap(jit->buffer, JIT_BUFFER_SIZE);
+  free(jit->blocks);
+  free(jit->links);
+  free(jit->block_at);
+  free(jit->page_blocks);
+  free(jit->coverage);
+}
+
+/**
+ * @brief Move the counters of translated code into the simulator
+ *
+ * @param jit JIT
+ */
+static void flush_counts(Jit *jit) {
+  MIPSSim *mips = jit->mips;
+  JitState *state = &jit->state;
+  mips->counts.total += (uint32_t)(state->arithmetic + state->logical + state->memory + state->control);
+  mips->counts.arithmetic += (uint32_t)state->arithmetic;
+  mips->counts.logical += (uint32_t)state->logical;
+  mips->counts.memory += (uint32_t)state->memory;
+  mips->counts.control += (uint32_t)state->control;
+  mips->clock += (uint32_t)state->cycles;
+  state->arithmetic = state->logical = state->memory = state->control = state->cycles = 0;
+}
+
+/**
+ * @brief Create a JIT for a program that is run in steps with run_jit_for()
+ *
+ * @param mips MIPS simulator, with its program loaded
+ * @return JIT, or NULL if the host does not allow executable memory
+ */
+Jit *create_jit(MIPSSim *mips) {
+  Jit *jit = malloc(sizeof(Jit));
+  if (jit == NULL) return NULL;
+  if (!init_jit(jit, mips, true)) {
+    free_jit(jit);
+    return NULL;
+  }
+  return jit;
+}
+
+/**
+ * @brief Run translated code until the program finishes, or until it has executed at least a number of
+ * instructions and takes a branch
+ *
+ * Produces the same registers, memory, PC, instruction counts and clock cycles as run_functional(),
+ * including the cycle limit (checked at taken branches and when the run ends) and invalid opcodes. The
+ * simulator is up to date whenever this returns.
+ *
+ * @param jit               JIT
+ * @param min_instructions  Instructions to run before pausing, 0 to run to completion
+ * @return true if the program halted, ran off the end of memory or failed, false if it paused
+ */
+bool run_jit_for(Jit *jit, uint32_t min_instructions) {
+  MIPSSim *mips = jit->mips;
+  uint32_t stop = mips->counts.total + min_instructions;
+  uint32_t pc = mips->pc;
+  uint8_t *chain_from = NULL;  // Exit the last block left through, to link to the next block
+  bool finished = true;
+  // As in run_functional_for(), a run that starts outside the image takes one cycle to find nothing to fetch
+  if (pc / 4 >= mips->memory_size && !mips->done) mips->clock++;
+  while (pc / 4 < mips->memory_size) {
+    JitBlock *block = jit->block_at[pc / 4];
+    if (block == NULL || block->pc != pc) {
+      uint32_t flushes = jit->flushes;
+      block = translate_block(jit, pc);
+      if (jit->flushes != flushes) chain_from = NULL;  // Its block is gone
+      if (block == NULL) {
+        // As in run_functional_for(), the word is only decoded if its fetch cycle is within the cycle limit
+        if (mips->cycle_limit && mips->clock + 1 > mips->cycle_limit) {
+          sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);
+        } else {
+          sim_error(mips, SIM_ERR_INVALID_OPCODE, "Invalid opcode: %08x", read_memory(&mips->memory, pc / 4));
+        }
+        break;
+      }
+    }
+    if (chain_from != NULL) link_blocks(jit, chain_from, block);
+
+    // Each instruction takes at least NOT_PIPED_CYCLES, so running past this many cycles runs the instructions
+    int64_t budget = mips->cycle_limit ? (int64_t)mips->cycle_limit - mips->clock : INT64_MAX;
+    int64_t pause = (int64_t)(stop - mips->counts.total) * NOT_PIPED_CYCLES;
+    if (min_instructions && pause < budget) budget = pause;
+    jit->state.cycle_budget = budget;
+
+    JitExit exit = jit->enter(&jit->state, mips->registers, block->code);
+    flush_counts(jit);
+    pc = jit->state.pc;
+    chain_from = exit == JIT_EXIT_CONTINUE ? jit->state.exit_site : NULL;  // Only chained exits set it
+    if (exit == JIT_EXIT_HALT) {
+      mips->halt = true;
+      mips->clock -= NOT_PIPED_CYCLES - NOT_PIPED_HALT_CYCLES;
+      break;
+    }
+    if (exit == JIT_EXIT_CYCLE_LIMIT && mips->cycle_limit && mips->clock > mips->cycle_limit) {
+      sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);
+      break;
+    }
+    if (min_instructions && mips->counts.total >= stop) {
+      finished = false;
+      break;
+    }
+  }
+
+  mips->pc = pc;
+  mips->done = finished;
+  // Blocks only check the budget at taken branches, so straight-line code can end past the limit
+  if (mips->cycle_limit && mips->clock > mips->cycle_limit && mips->status == SIM_OK) {
+    sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);
+    return true;
+  }
+  return finished;
+}
+
+/**
+ * @brief Free a JIT made by create_jit()
+ *
+ * @param jit JIT
+ */
+void free_jit(Jit *jit) {
+  destroy_jit(jit);
+  free(jit);
+}
+
+/**
+ * @brief Run the program to completion on translated code, as run_jit_for() does. Falls back to
+ * run_functional() if the host does not allow executable memory.
+ *
+ * @param mips MIPS simulator
+ */
+void run_jit(MIPSSim *mips) {
+  Jit jit;
+  if (!init_jit(&jit, mips, false)) {
+    destroy_jit(&jit);
+    run_functional(mips, NULL);
+    return;
+  }
+  run_jit_for(&jit, 0);
+  destroy_jit(&jit);
+}
+
+#else
+
+/**
+ * @brief Run the program with the interpreter: translation needs an x86-64 Unix host
+ *
+ * @param mips MIPS simulator
+ */
+void run_jit(MIPSSim *mips) {
+  run_functional(mips, NULL);
+}
+
+/**
+ * @brief Translation needs an x86-64 Unix host
+ *
+ * @param mips MIPS simulator
+ * @return NULL
+ */
+Jit *create_jit(MIPSSim *mips) {
+  return NULL;
+}
+
+bool run_jit_for(Jit *jit, uint32_t min_instructions) {
+  return true;
+}
+
+void free_jit(Jit *jit) {}
+
+#endif
@@ -6,32 +6,230 @@
  * @copyright Copyright (c) 2024
  */
 
+#include "batch.h"
+#include "cache.h"
+#include "checkpoint.h"
 #include "common.h"
+#include "cosim.h"
+#include "daemon.h"
+#include "debugger.h"
+#include "functional.h"
+#include "image.h"
+#include "jit.h"
 #include "mips.h"
+#include "multicore.h"
 #include "pipeline.h"
+#include "predictor.h"
+#include "profile.h"
+#include "sampling.h"
+#include "superscalar.h"
+#include "timing.h"
+#include "trace.h"
 
-void process_args(int argc, char* argv[], char** filename, Mode* mode);
+typedef struct {
+  char* filename;
+  Mode mode;
+  Engine engine;
+  bool all_modes;
+  uint32_t cycle_limit;
+  char* checkpoint_file;
+  uint32_t checkpoint_clock;
+  char* restore_file;
+  char* image_output;
+  char* trace_file;
+  char* profile_file;
+  char* predictor;
+  char* icache;
+  char* dcache;
+  char* manifest;
+  char* output;
+  int num_workers;
+  bool sampled;
+  SamplingConfig sampling;
+  char* issue;
+  SuperscalarConfig superscalar;
+  char* stages;
+  PipelineConfig pipeline;
+  char* cores;
+  MulticoreConfig multicore;
+  char* verify;
+  CoSimConfig cosim;
+  char* socket;
+  bool debug;
+} Options;
+
+/**
+ * @brief Run the cores given with -n on shared memory and print their results
+ *
+ * @param options Command line options
+ * @return Process exit status
+ */
+int run_multicore_mode(Options* options) {
+  Multicore* mc = malloc(sizeof(Multicore));
+  if (init_multicore(mc, &options->multicore, options->filename, options->mode, options->cycle_limit,
+                     options->stages != NULL ? &options->pipeline : NULL) != SIM_OK) {
+    fprintf(stderr, "%s\n", mc->cores[0]->error);
+    destroy_multicore(mc);
+    free(mc);
+    free_multicore_config(&options->multicore);
+    return EXIT_FAILURE;
+  }
+
+  run_multicore(mc);
+  int status = EXIT_SUCCESS;
+  for (uint32_t i = 0; i < mc->config.num_cores; i++) {
+    if (mc->cores[i]->status != SIM_OK) {
+      fprintf(stderr, "Core %u: %s\n", i, mc->cores[i]->error);
+      status = EXIT_FAILURE;
+    }
+  }
+  if (status == EXIT_SUCCESS) {
+    printf("======== Simulation complete ========\n");
+    print_multicore_results(mc, options->filename);
+  }
+  destroy_multicore(mc);
+  free(mc);
+  free_multicore_config(&options->multicore);
+  return status;
+}
+
+void process_args(int argc, char* argv[], Options* options);
+int run_batch_mode(Options* options);
+SimStatus start_simulator(MIPSSim* mips, Options* options);
 
 int main(int argc, char* argv[]) {
-  char* filename = NULL;
-  Mode mode;
-  process_args(argc, argv, &filename, &mode);
+  Options options;
+  process_args(argc, argv, &options);
+
+  if (options.manifest != NULL) {
+    return run_batch_mode(&options);
+  }
+
+  if (options.socket != NULL) {
+    return run_daemon(options.socket, options.num_workers);
+  }
+
+  if (options.cores != NULL) {
+    return run_multicore_mode(&options);
+  }
 
   MIPSSim* mips = malloc(sizeof(MIPSSim));
-  init_simulator(mips, mode);
-  load_memory(mips, filename);
+  if (start_simulator(mips, &options) != SIM_OK) {
+    fprintf(stderr, "%s\n", mips->error);
+    destroy_simulator(mips);
+    exit(EXIT_FAILURE);
+  }
 
-  while (!mips->done && !mips->halt) {
-    process(mips);
-    mips->clock++;
-    print_pipeline_state(&mips->pipeline);
+  if (options.image_output != NULL) {
+    bool saved = save_image(mips, options.image_output);
+    destroy_simulator(mips);
+    return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (options.trace_file != NULL) {
+    mips->pipeline.tracer = open_trace(options.trace_file, mips->mode);
+    if (mips->pipeline.tracer == NULL) {
+      destroy_simulator(mips);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (options.profile_file != NULL) mips->profiler = create_profiler();
+  if (options.predictor != NULL) mips->predictor = create_predictor(options.predictor);
+  if (options.icache != NULL) mips->icache = create_cache("I-cache", options.icache, mips->memory_size);
+  if (options.dcache != NULL) mips->dcache = create_cache("D-cache", options.dcache, mips->memory_size);
+  CoSim* cosim = options.verify != NULL ? create_cosim(mips, &options.cosim) : NULL;
+
+  RetireStream* stream = NULL;
+  TimingModel models[PIPED_FWD + 1];
+  SamplingResult sampled;
+  SuperscalarResult superscalar;
+  bool finished = true;
+  if (options.sampled) {
+    run_sampled(mips, &options.sampling, &sampled);
+  } else if (options.all_modes) {
+    // One functional pass drives a timing model per mode
+    stream = malloc(sizeof(RetireStream));
+    init_retire_stream(stream);
+    for (Mode m = NOT_PIPED; m <= PIPED_FWD; m++) {
+      init_timing_model(&models[m], m);
+      attach_timing_model(stream, &models[m]);
+    }
+    run_functional(mips, stream);
+    finish_retire_stream(stream, mips->halt);
+    free(stream);
+  } else if (options.engine == ENGINE_FUNCTIONAL) {
+    run_functional(mips, NULL);
+  } else if (options.engine == ENGINE_JIT) {
+    run_jit(mips);
+  } else if (mips->mode == PIPED_SUPERSCALAR) {
+    run_superscalar(mips, &options.superscalar, &superscalar);
+  } else if (options.debug) {
+    finished = run_debugger(mips, stdin);
+  } else {
+    if (options.checkpoint_file != NULL) {
+      if (!run_pipeline_until(mips, options.checkpoint_clock) && save_checkpoint(mips, options.checkpoint_file)) {
+        fprintf(stderr, "Checkpoint saved to %s at clock cycle %u\n", options.checkpoint_file, mips->clock);
+      } else if (mips->status == SIM_OK && (mips->done || mips->halt)) {
+        fprintf(stderr, "Program finished before clock cycle %u, no checkpoint saved\n", options.checkpoint_clock);
+      }
+    }
+    run_pipeline(mips);
+    if (cosim != NULL) finish_cosim(cosim);
+  }
+  if (mips->pipeline.tracer != NULL && !close_trace(mips->pipeline.tracer, &mips->pipeline, mips->clock)) {
+    destroy_simulator(mips);
+    exit(EXIT_FAILURE);
+  }
+
+  // Debugging stopped before the end: there are no results to report
+  if (!finished) {
+    destroy_simulator(mips);
+    return EXIT_SUCCESS;
+  }
+
+  if (mips->status != SIM_OK) {
+    fprintf(stderr, "%s\n", mips->error);
+    if (cosim != NULL) {
+      print_cosim_report(cosim, stderr);
+      destroy_cosim(cosim);
+    }
+    destroy_simulator(mips);
+    exit(EXIT_FAILURE);
   }
-  correct_pc(mips);
 
   printf("======== Simulation complete ========\n");
-  printf("Total clock cycles: %d\n", mips->clock);
-  printf("Final PC: %d\n", mips->pc);
-  printf("Total Stalls: %d\n", mips->pipeline.total_stalls);
+  if (stream != NULL) {
+    for (Mode m = NOT_PIPED; m <= PIPED_FWD; m++) {
+      printf("Mode %d (%s): %" PRIu64 " clock cycles, %" PRIu64 " stalls\n", m, models[m].name, models[m].clock, models[m].stalls);
+    }
+    printf("Final PC: %d\n", mips->pc);
+  } else if (options.sampled) {
+    printf("Samples: %u (%" PRIu64 " of %" PRIu64 " instructions measured, %" PRIu64 " simulated in detail)\n", sampled.samples,
+           sampled.measured_instructions, sampled.instructions, sampled.detailed_instructions);
+    if (sampled.samples >= 2 || sampled.exact) {
+      printf("Estimated clock cycles: %.0f +/- %.0f\n", sampled.cycles, sampled.cycles_error);
+      printf("Estimated stalls: %.0f +/- %.0f\n", sampled.stalls, sampled.stalls_error);
+      printf("Estimated CPI: %.4f +/- %.4f (%s)\n", sampled.cpi, sampled.cpi_error,
+             sampled.exact ? "exact: every instruction was simulated in detail" : "95% confidence");
+    } else {
+      // A single sample gives no variance to build an interval from
+      printf("Estimated clock cycles: %.0f\n", sampled.cycles);
+      printf("Estimated stalls: %.0f\n", sampled.stalls);
+      printf("Estimated CPI: %.4f (fewer than two samples, no confidence interval)\n", sampled.cpi);
+    }
+    printf("Final PC: %d\n", mips->pc);
+  } else {
+    printf("Total clock cycles: %d\n", mips->clock);
+    printf("Final PC: %d\n", mips->pc);
+    printf("Total Stalls: %d\n", mips->pipeline.total_stalls);
+  }
+  // A run restored from a checkpoint taken with -P reports the configuration like the run that saved it
+  if (options.stages != NULL || (options.restore_file != NULL && !is_default_pipeline_config(&mips->pipeline.config))) {
+    printf("Pipeline: ");
+    print_pipeline_config(&mips->pipeline.config, stdout);
+    if (!options.sampled) printf("CPI: %.4f\n", mips->counts.total ? (double)mips->clock / mips->counts.total : 0.0);
+  }
   printf("Instruction counts:\n");
   printf("\\ Total: %d\n", mips->counts.total);
   printf("\\ Arithmetic: %d\n", mips->counts.arithmetic);
@@ -43,45 +241,421 @@ int main(int argc, char* argv[]) {
   print_memory(mips);
   if (mips->halt) printf("\n\nPROGRAM HALTED\n");
 
+  if (cosim != NULL) {
+    printf("\n");
+    print_cosim_report(cosim, stdout);
+    destroy_cosim(cosim);
+  }
+
+  if (mips->mode == PIPED_SUPERSCALAR) {
+    printf("\n");
+    print_superscalar_stats(mips, &options.superscalar, &superscalar, stdout);
+  }
+
+  if (mips->predictor != NULL) {
+    printf("\n");
+    print_predictor_stats(mips->predictor, mips->counts.total, stdout);
+    destroy_predictor(mips->predictor);
+  }
+
+  if (mips->icache != NULL) {
+    printf("\n");
+    print_cache_stats(mips->icache, mips, stdout);
+    destroy_cache(mips->icache);
+  }
+
+  if (mips->dcache != NULL) {
+    printf("\n");
+    print_cache_stats(mips->dcache, mips, stdout);
+    destroy_cache(mips->dcache);
+  }
+
+  if (mips->profiler != NULL) {
+    print_profile(mips->profiler, mips, stdout);
+    bool saved = write_profile_json(mips->profiler, mips, options.profile_file);
+    destroy_profiler(mips->profiler);
+    if (!saved) {
+      destroy_simulator(mips);
+      return EXIT_FAILURE;
+    }
+  }
+
   destroy_simulator(mips);
   return 0;
 }
 
-void process_args(int argc, char* argv[], char** filename, Mode* mode) {
+/**
+ * @brief Set up the simulator from the memory image, or from a checkpoint when restoring
+ *
+ * @param mips    MIPS simulator
+ * @param options Command line options
+ * @return SIM_OK, or the error that stopped the simulator
+ */
+SimStatus start_simulator(MIPSSim* mips, Options* options) {
+  if (options->restore_file == NULL) {
+    init_simulator(mips, options->all_modes ? NOT_PIPED : options->mode);
+    if (options->stages != NULL) configure_pipeline(&mips->pipeline, &options->pipeline);
+    mips->cycle_limit = options->cycle_limit;
+    return load_memory(mips, options->filename);
+  }
+
+  if (restore_checkpoint(mips, options->restore_file) != SIM_OK) return mips->status;
+  mips->cycle_limit = options->cycle_limit;
+
+  // A different mode can only be used if no instruction is in flight
+  if (options->mode != -1 && options->mode != mips->mode) {
+    for (int i = 0; i < mips->pipeline.depth; i++) {
+      if (mips->pipeline.stages[i] != NULL) {
+        return sim_error(mips, SIM_ERR_CHECKPOINT, "The checkpoint has instructions in flight, it can only resume in mode %d", mips->mode);
+      }
+    }
+    mips->mode = options->mode;
+    mips->pipeline.is_pipelined = !!options->mode;
+  }
+  return SIM_OK;
+}
+
+/**
+ * @brief Run every job of a manifest and write the aggregated results
+ *
+ * @param options Command line options
+ * @return Process exit status
+ */
+int run_batch_mode(Options* options) {
+  Batch batch;
+  if (!load_manifest(&batch, options->manifest)) {
+    destroy_batch(&batch);
+    return EXIT_FAILURE;
+  }
+
+  if (!run_batch(&batch, options->num_workers, options->cycle_limit)) {
+    destroy_batch(&batch);
+    return EXIT_FAILURE;
+  }
+
+  size_t failed = 0;
+  for (size_t i = 0; i < batch.num_jobs; i++) {
+    if (batch.jobs[i].status != SIM_OK) failed++;
+  }
+  fprintf(stderr, "Batch complete: %zu jobs, %zu failed\n", batch.num_jobs, failed);
+
+  bool written = write_batch_results(&batch, options->output ? options->output : "-");
+  destroy_batch(&batch);
+  return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void process_args(int argc, char* argv[], Options* options) {
   int opt;
-  *mode = -1;
+  *options = (Options){.mode = -1, .engine = ENGINE_PIPELINE, .superscalar = {.width = 2, .mem_ports = 1},
+                       .multicore = {.quantum = MULTICORE_DEFAULT_QUANTUM}};
 
-  while ((opt = getopt(argc, argv, "f:m:h")) != -1) {
+  while ((opt = getopt(argc, argv, "f:m:e:aS:c:s:r:x:t:p:B:I:D:w:P:n:q:V:b:o:j:d:gh")) != -1) {
     switch (opt) {
       case 'f':
-        *filename = optarg;
+        options->filename = optarg;
         break;
       case 'm':
-        *mode = (Mode)atoi(optarg);
-        if (*mode < NOT_PIPED || *mode > PIPED_FWD) {
-          fprintf(stderr, "Invalid mode: %d. Mode must be between 0 and 2. Use -h for help\n", *mode);
+        options->mode = (Mode)atoi(optarg);
+        if (options->mode < NOT_PIPED || options->mode > PIPED_SUPERSCALAR) {
+          fprintf(stderr, "Invalid mode: %d. Mode must be between 0 and 3. Use -h for help\n", options->mode);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'e':
+        options->engine = (Engine)atoi(optarg);
+        if (options->engine < ENGINE_PIPELINE || options->engine > ENGINE_JIT) {
+          fprintf(stderr, "Invalid engine: %d. Engine must be between 0 and 2. Use -h for help\n", options->engine);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'a':
+        options->all_modes = true;
+        break;
+      case 'S': {
+        char* end;
+        options->sampled = true;
+        options->sampling.fast_forward = strtoull(optarg, &end, 10);
+        if (*end == ':') options->sampling.warmup = strtoull(end + 1, &end, 10);
+        if (*end == ':') options->sampling.measure = strtoull(end + 1, &end, 10);
+        if (*end != '\0' || options->sampling.measure == 0) {
+          fprintf(stderr, "Invalid sampling: %s. Use -S fast_forward:warmup:measure. Use -h for help\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      }
+      case 'c':
+        options->cycle_limit = strtoul(optarg, NULL, 10);
+        break;
+      case 's': {
+        char* file = strchr(optarg, ':');
+        options->checkpoint_clock = strtoul(optarg, NULL, 10);
+        if (file == NULL || options->checkpoint_clock == 0) {
+          fprintf(stderr, "Invalid checkpoint: %s. Use -s cycle:file. Use -h for help\n", optarg);
           exit(EXIT_FAILURE);
         }
+        options->checkpoint_file = file + 1;
+        break;
+      }
+      case 'r':
+        options->restore_file = optarg;
+        break;
+      case 'x':
+        options->image_output = optarg;
+        break;
+      case 't':
+        options->trace_file = optarg;
+        break;
+      case 'p':
+        options->profile_file = optarg;
+        break;
+      case 'B': {
+        Predictor* predictor = create_predictor(optarg);
+        if (predictor == NULL) {
+          fprintf(stderr, "Invalid predictor: %s. Use nt, btfn, bimodal, gshare or btb, optionally with :btb_entries\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        destroy_predictor(predictor);
+        options->predictor = optarg;
+        break;
+      }
+      case 'I':
+      case 'D': {
+        Cache* cache = create_cache("", optarg, 0);
+        if (cache == NULL) {
+          fprintf(stderr, "Invalid cache: %s. Use size=4k,assoc=2,line=16,policy=lru|fifo|random,hit=1,miss=10,write=wb|wt\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        destroy_cache(cache);
+        if (opt == 'I') {
+          options->icache = optarg;
+        } else {
+          options->dcache = optarg;
+        }
+        break;
+      }
+      case 'w':
+        if (!parse_superscalar_config(optarg, &options->superscalar)) {
+          fprintf(stderr, "Invalid issue width: %s. Use -w width[:memory_ports] with 1 to %d instructions\n", optarg, SUPERSCALAR_MAX_WIDTH);
+          exit(EXIT_FAILURE);
+        }
+        options->issue = optarg;
+        break;
+      case 'P':
+        if (!parse_pipeline_config(optarg, &options->pipeline)) {
+          fprintf(stderr, "Invalid pipeline: %s. Use if=1,ex=1,mem=1,mul=1 with 1 to %d cycles per stage and 1 to %d for MUL\n", optarg,
+                  PIPELINE_MAX_STAGE_CYCLES, PIPELINE_MAX_MUL_CYCLES);
+          exit(EXIT_FAILURE);
+        }
+        options->stages = optarg;
+        break;
+      case 'n':
+        options->cores = optarg;
+        if (!parse_multicore_config(optarg, &options->multicore)) {
+          fprintf(stderr, "Invalid cores: %s. Use -n image[@entry_pc],... with 1 to %d cores and word-aligned entry PCs\n", options->cores,
+                  MULTICORE_MAX_CORES);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'q':
+        options->multicore.quantum = strtoul(optarg, NULL, 10);
+        if (options->multicore.quantum == 0) {
+          fprintf(stderr, "Invalid quantum: %s. Use -q cycles with at least one cycle\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'V':
+        if (!parse_cosim_config(optarg, &options->cosim)) {
+          fprintf(stderr, "Invalid co-simulation: %s. Use -V engine[:interval] with engine 1 or 2 and an interval of at least one\n",
+                  optarg);
+          exit(EXIT_FAILURE);
+        }
+        options->verify = optarg;
+        break;
+      case 'b':
+        options->manifest = optarg;
+        break;
+      case 'o':
+        options->output = optarg;
+        break;
+      case 'j':
+        options->num_workers = atoi(optarg);
+        break;
+      case 'd':
+        options->socket = optarg;
+        break;
+      case 'g':
+        options->debug = true;
         break;
       case 'h':
-        fprintf(stderr, "Usage: %s [-f filename] [-m mode]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-f filename] [-m mode] [-e engine] [-c cycles] [-t trace] [-p profile] [-B predictor]\n", argv[0]);
+        fprintf(stderr, "       %*s [-I cache] [-D cache] [-P stages]\n", (int)strlen(argv[0]), "");
+        fprintf(stderr, "       %s -f filename -a [-c cycles]\n", argv[0]);
+        fprintf(stderr, "       %s -f filename -m mode -S fast_forward:warmup:measure\n", argv[0]);
+        fprintf(stderr, "       %s -r checkpoint [-m mode] [-s cycle:file] [-c cycles]\n", argv[0]);
+        fprintf(stderr, "       %s [-f filename] -n cores -m mode [-q quantum] [-c cycles] [-P stages]\n", argv[0]);
+        fprintf(stderr, "       %s -f filename -m mode -V engine[:interval] [-c cycles] [-t trace] [-P stages] ...\n", argv[0]);
+        fprintf(stderr, "       %s -f filename -m mode -g [-c cycles] [-t trace] [-B predictor] [-P stages] ...\n", argv[0]);
+        fprintf(stderr, "       %s -f filename -x image\n", argv[0]);
+        fprintf(stderr, "       %s -b manifest [-o results] [-j workers] [-c cycles]\n", argv[0]);
+        fprintf(stderr, "       %s -d socket [-j workers]\n", argv[0]);
         fprintf(stderr, "Options:\n");
-        fprintf(stderr, "  -f filename: Load memory image from filename\n");
-        fprintf(stderr, "  -m mode: Set the mode (0: Non-pipelined, 1: Pipelined without forwarding, 2: Pipelined with forwarding)\n");
+        fprintf(stderr, "  -f filename: Load memory image from filename (text or binary, - for stdin)\n");
+        fprintf(stderr, "  -m mode: Set the mode (0: Non-pipelined, 1: Pipelined without forwarding, 2: Pipelined with forwarding,\n");
+        fprintf(stderr, "     3: Superscalar, pipelined with forwarding)\n");
+        fprintf(stderr, "  -e engine: Set the execution engine (0: Pipeline model (default), 1: Fast functional,\n");
+        fprintf(stderr, "     2: Fast functional on code translated to x86-64; engines 1 and 2 support mode 0 only)\n");
+        fprintf(stderr, "  -a: Execute the program once and report clock cycles and stalls for all three modes\n");
+        fprintf(stderr, "  -S ff:warmup:measure: Estimate timing by measuring samples of measure instructions, each after warmup\n");
+        fprintf(stderr, "     instructions simulated in detail, with ff instructions executed functionally between samples\n");
+        fprintf(stderr, "  -c cycles: Stop with an error after this many clock cycles (default: no limit)\n");
+        fprintf(stderr, "  -s cycle:file: Save a checkpoint of the simulator to file when the clock reaches cycle\n");
+        fprintf(stderr, "  -r checkpoint: Resume from a checkpoint instead of loading a memory image\n");
+        fprintf(stderr, "  -t trace: Record a binary per-instruction pipeline trace to trace (view with trace_view.py)\n");
+        fprintf(stderr, "  -p profile: Charge stalls to instruction pairs and flushes to branches, print the hot spots and\n");
+        fprintf(stderr, "     write the full profile to profile as JSON (- for stdout)\n");
+        fprintf(stderr, "  -B predictor[:btb_entries]: Predict branches at fetch (nt, btfn, bimodal, gshare, btb) and report\n");
+        fprintf(stderr, "     accuracy and MPKI. With a BTB (a power of two entries) it supplies the targets, JR's included\n");
+        fprintf(stderr, "  -w width[:ports]: Instructions fetched and issued per cycle in mode 3 (1 to %d, default 2), and how many\n",
+                SUPERSCALAR_MAX_WIDTH);
+        fprintf(stderr, "     of them can be loads or stores (default 1). Reports IPC and issue slot utilisation\n");
+        fprintf(stderr, "  -I cache, -D cache: Time fetches (-I) or loads and stores (-D) with an L1 cache described by\n");
+        fprintf(stderr, "     size=4k,assoc=2,line=16,policy=lru|fifo|random,hit=1,miss=10,write=wb|wt (any key can be left out,\n");
+        fprintf(stderr, "     \"\" for all the defaults) and report hit rates per cache and per PC\n");
+        fprintf(stderr, "  -P stages: Split IF, EX or MEM into several stages and hold EX for MUL/MULI in modes 1 and 2, as\n");
+        fprintf(stderr, "     if=1,ex=1,mem=1,mul=1 (cycles per stage, any key can be left out), and report the CPI\n");
+        fprintf(stderr, "  -n image[@pc],...: Run one core per entry, each starting at pc (default: its image's entry) of its\n");
+        fprintf(stderr, "     image (default: the -f one), with private registers and pipelines and one shared memory\n");
+        fprintf(stderr, "  -q quantum: Cycles each core runs on its own host thread before the cores exchange their stores\n");
+        fprintf(stderr, "     (default: %d). Results are deterministic for a given quantum\n", MULTICORE_DEFAULT_QUANTUM);
+        fprintf(stderr, "  -V engine[:interval]: Run engine 1 or 2 in lockstep with the pipeline model and compare the PC,\n");
+        fprintf(stderr, "     registers and stores every interval retired instructions (default: 1); stop at the first difference\n");
+        fprintf(stderr, "  -g: Debug the program interactively, reading commands (step, break, watch, ...; see help) from stdin\n");
+        fprintf(stderr, "  -x image: Convert the memory image to a binary image (- for stdout) and exit\n");
+        fprintf(stderr, "  -b manifest: Run every \"<image> <mode|all> [engine]\" line of manifest in parallel\n");
+        fprintf(stderr, "  -o results: Write batch results to results (.json for JSON, CSV otherwise; default: stdout)\n");
+        fprintf(stderr, "  -j workers: Number of batch or daemon worker threads (default: one per CPU)\n");
+        fprintf(stderr, "  -d socket: Serve jobs sent over the Unix domain socket socket until interrupted (see daemon_client.py)\n");
         exit(EXIT_SUCCESS);
       default:
-        fprintf(stderr, "Usage: %s [-f filename] [-m mode]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-f filename] [-m mode] [-e engine] [-c cycles]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
   }
 
-  if (*mode == -1) {
+  // Modes, engines and images of a batch come from its manifest, and those of a daemon from its clients
+  if (options->manifest != NULL || options->socket != NULL) return;
+
+  if (options->all_modes) options->mode = NOT_PIPED;
+
+  // Converting an image does not run it
+  if (options->image_output != NULL && options->restore_file == NULL) options->mode = NOT_PIPED;
+
+  if ((options->checkpoint_file != NULL || options->restore_file != NULL) && (options->engine != ENGINE_PIPELINE || options->all_modes)) {
+    fprintf(stderr, "Checkpoints are only supported with the pipeline engine\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if ((options->checkpoint_file != NULL || options->restore_file != NULL) &&
+      (options->predictor != NULL || options->icache != NULL || options->dcache != NULL)) {
+    fprintf(stderr, "Checkpoints do not save branch predictor or cache state and cannot be combined with -B, -I or -D\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->sampled && (options->engine != ENGINE_PIPELINE || options->all_modes || options->checkpoint_file != NULL)) {
+    fprintf(stderr, "Sampling drives the pipeline engine itself and cannot be combined with -e, -a or -s\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->trace_file != NULL && (options->engine != ENGINE_PIPELINE || options->all_modes)) {
+    fprintf(stderr, "Traces are only recorded by the pipeline engine\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->profile_file != NULL && (options->engine != ENGINE_PIPELINE || options->all_modes)) {
+    fprintf(stderr, "Hazard profiles are only collected by the pipeline engine\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->predictor != NULL && (options->engine != ENGINE_PIPELINE || options->all_modes)) {
+    fprintf(stderr, "Branch prediction is only modeled by the pipeline engine\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if ((options->icache != NULL || options->dcache != NULL) && (options->engine != ENGINE_PIPELINE || options->all_modes)) {
+    fprintf(stderr, "Caches are only modeled by the pipeline engine\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->mode == PIPED_SUPERSCALAR && (options->checkpoint_file != NULL || options->sampled || options->trace_file != NULL ||
+                                             options->profile_file != NULL || options->predictor != NULL || options->icache != NULL ||
+                                             options->dcache != NULL)) {
+    fprintf(stderr, "Mode 3 cannot be combined with -s, -S, -t, -p, -B, -I or -D\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->issue != NULL && options->mode != PIPED_SUPERSCALAR) {
+    fprintf(stderr, "The issue width (-w) only applies to mode 3\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->stages != NULL && (options->engine != ENGINE_PIPELINE || options->all_modes || options->restore_file != NULL ||
+                                  options->mode == NOT_PIPED || options->mode == PIPED_SUPERSCALAR)) {
+    fprintf(stderr, "Pipeline stages (-P) apply to the pipeline engine in mode 1 or 2, and come from the checkpoint with -r\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->cores != NULL && (options->engine != ENGINE_PIPELINE || options->all_modes || options->sampled || options->checkpoint_file != NULL ||
+                                 options->restore_file != NULL || options->image_output != NULL || options->trace_file != NULL ||
+                                 options->profile_file != NULL || options->predictor != NULL || options->icache != NULL ||
+                                 options->dcache != NULL || options->mode == PIPED_SUPERSCALAR)) {
+    fprintf(stderr, "Multiple cores (-n) run the pipeline engine in modes 0 to 2, without -e, -a, -S, -s, -r, -x, -t, -p, -B, -I or -D\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->verify != NULL && (options->engine != ENGINE_PIPELINE || options->all_modes || options->sampled ||
+                                  options->checkpoint_file != NULL || options->restore_file != NULL || options->image_output != NULL ||
+                                  options->cores != NULL || options->mode == PIPED_SUPERSCALAR)) {
+    fprintf(stderr, "Co-simulation (-V) checks the pipeline engine in modes 0 to 2, without -e, -a, -S, -s, -r, -x or -n\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->debug && (options->engine != ENGINE_PIPELINE || options->all_modes || options->sampled || options->checkpoint_file != NULL ||
+                         options->image_output != NULL || options->cores != NULL || options->verify != NULL ||
+                         options->mode == PIPED_SUPERSCALAR)) {
+    fprintf(stderr, "The debugger (-g) drives the pipeline engine in modes 0 to 2, without -e, -a, -S, -s, -x, -n or -V\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->debug && options->filename != NULL && strcmp(options->filename, "-") == 0) {
+    fprintf(stderr, "The debugger reads its commands from stdin, so the image cannot come from there\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // The mode and the program come from the checkpoint
+  if (options->restore_file != NULL) return;
+
+
+  if (options->mode == -1) {
     fprintf(stderr, "Mode not specified. Please specify a mode using the -m flag. Use -h for help\n");
     exit(EXIT_FAILURE);
   }
 
-  if (*filename == NULL) {
+  if (options->predictor != NULL && options->mode == NOT_PIPED) {
+    fprintf(stderr, "Branch prediction needs a pipelined mode (-m 1 or -m 2)\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->engine != ENGINE_PIPELINE && options->mode != NOT_PIPED) {
+    fprintf(stderr, "The functional engines only model non-pipelined timing. Use -m 0 with -e 1 or -e 2\n");
+    exit(EXIT_FAILURE);
+  }
+
+  bool needs_file = options->cores == NULL;
+  for (uint32_t i = 0; i < options->multicore.num_cores; i++) {
+    if (options->multicore.cores[i].image == NULL) needs_file = true;
+  }
+  if (needs_file && options->filename == NULL) {
     fprintf(stderr, "Filename not specified. Please specify a filename using the -f flag. Use -h for help\n");
     exit(EXIT_FAILURE);
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,206 @@
+/**
+ * @file  memory.c
+ * @brief Sparse paged memory
+ * @copyright Copyright (c) 2024
+ */
+
+#include "memory.h"
+#include "common.h"
+
+#define TABLE_INDEX(page_index) ((page_index) & ((1u << MEMORY_TABLE_BITS) - 1))
+#define DIR_INDEX(page_index) ((page_index) >> MEMORY_TABLE_BITS)
+
+/**
+ * @brief Initialize an empty memory (no page allocated)
+ *
+ * @param m Memory
+ */
+void init_memory(Memory *m) {
+  memset(m, 0, sizeof(Memory));
+}
+
+/**
+ * @brief Free every page and page table
+ *
+ * @param m Memory
+ */
+void destroy_memory(Memory *m) {
+  for (MemoryPage *page = m->pages, *next; page != NULL; page = next) {
+    next = page->next;
+    free(page->decoded);
+    free(page);
+  }
+  for (uint32_t i = 0; i < (1u << MEMORY_DIR_BITS); i++) {
+    free(m->directory[i]);
+  }
+  init_memory(m);
+}
+
+/**
+ * @brief Find an allocated page and make it the last accessed page
+ *
+ * @param m           Memory
+ * @param page_index  Page number
+ * @return Page, or NULL if it has not been allocated
+ */
+MemoryPage *find_page(Memory *m, uint32_t page_index) {
+  MemoryPage **table = m->directory[DIR_INDEX(page_index)];
+  if (table == NULL || table[TABLE_INDEX(page_index)] == NULL) return NULL;
+  m->last_page = table[TABLE_INDEX(page_index)];
+  return m->last_page;
+}
+
+/**
+ * @brief Find a page, allocating a zeroed one on first use, and make it the last accessed page
+ *
+ * @param m           Memory
+ * @param page_index  Page number
+ * @return Page
+ */
+MemoryPage *get_page(Memory *m, uint32_t page_index) {
+  MemoryPage *page = find_page(m, page_index);
+  if (page != NULL) return page;
+
+  MemoryPage **table = m->directory[DIR_INDEX(page_index)];
+  if (table == NULL) {
+    table = calloc(1u << MEMORY_TABLE_BITS, sizeof(MemoryPage *));
+    if (table == NULL) {
+      perror("Failed to allocate memory page table");
+      exit(EXIT_FAILURE);
+    }
+    m->directory[DIR_INDEX(page_index)] = table;
+  }
+
+  page = calloc(1, sizeof(MemoryPage));
+  if (page == NULL) {
+    perror("Failed to allocate memory page");
+    exit(EXIT_FAILURE);
+  }
+  page->index = page_index;
+  page->next = m->pages;
+  m->pages = page;
+  m->num_pages++;
+  table[TABLE_INDEX(page_index)] = page;
+  m->last_page = page;
+  return page;
+}
+
+/**
+ * @brief Add a page to the list of pages with modified words
+ *
+ * @param m     Memory
+ * @param page  Page
+ */
+void mark_page_dirty(Memory *m, MemoryPage *page) {
+  page->is_dirty = true;
+  page->next_dirty = m->dirty_pages;
+  m->dirty_pages = page;
+}
+
+/**
+ * @brief Copy words into memory without marking them modified (used to load programs)
+ *
+ * @param m     Memory
+ * @param index Word index of the first word
+ * @param words Words to copy
+ * @param count Number of words
+ */
+void copy_to_memory(Memory *m, uint32_t index, const int32_t *words, uint32_t count) {
+  while (count > 0) {
+    MemoryPage *page = get_page(m, index >> MEMORY_PAGE_BITS);
+    uint32_t offset = index & MEMORY_WORD_MASK;
+    uint32_t n = MEMORY_PAGE_WORDS - offset;
+    if (n > count) n = count;
+
+    memcpy(&page->words[offset], words, n * sizeof(int32_t));
+    if (page->decoded) memset(&page->decoded[offset], 0, n * sizeof(DecodedInstr));
+    index += n;
+    words += n;
+    count -= n;
+  }
+}
+
+/**
+ * @brief Get the decode cache of the page holding a word, allocating the page and its cache if needed
+ *
+ * @param m     Memory
+ * @param index Word index
+ * @return Decoded entries of the whole page (index the result with index & MEMORY_WORD_MASK)
+ */
+DecodedInstr *get_decoded_page(Memory *m, uint32_t index) {
+  MemoryPage *page = m->last_page;
+  if (page == NULL || page->index != index >> MEMORY_PAGE_BITS) {
+    page = get_page(m, index >> MEMORY_PAGE_BITS);
+  }
+  if (page->decoded == NULL) {
+    page->decoded = calloc(MEMORY_PAGE_WORDS, sizeof(DecodedInstr));
+    if (page->decoded == NULL) {
+      perror("Failed to allocate decode cache");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return page->decoded;
+}
+
+/**
+ * @brief Copy every allocated page of a memory into another one, with its decode cache, without marking
+ * the words modified
+ *
+ * @param dst Memory to copy into
+ * @param src Memory to copy from
+ */
+void copy_memory(Memory *dst, const Memory *src) {
+  for (const MemoryPage *page = src->pages; page != NULL; page = page->next) {
+    uint32_t index = page->index << MEMORY_PAGE_BITS;
+    copy_to_memory(dst, index, page->words, MEMORY_PAGE_WORDS);
+    if (page->decoded != NULL) memcpy(get_decoded_page(dst, index), page->decoded, MEMORY_PAGE_WORDS * sizeof(DecodedInstr));
+  }
+}
+
+/**
+ * @brief Append a write to a memory log, growing it as needed
+ *
+ * @param log   Memory log
+ * @param index Word index
+ * @param value Word value
+ */
+void append_memory_log(MemoryLog *log, uint32_t index, int32_t value) {
+  if (log->count == log->capacity) {
+    log->capacity = log->capacity ? log->capacity * 2 : 1024;
+    log->indexes = realloc(log->indexes, log->capacity * sizeof(uint32_t));
+    log->values = realloc(log->values, log->capacity * sizeof(int32_t));
+    if (log->indexes == NULL || log->values == NULL) {
+      perror("Failed to allocate memory log");
+      exit(EXIT_FAILURE);
+    }
+  }
+  log->indexes[log->count] = index;
+  log->values[log->count] = value;
+  log->count++;
+}
+
+/**
+ * @brief Replay the writes of a log into a memory, in order. They are not logged again.
+ *
+ * @param m   Memory
+ * @param log Memory log
+ */
+void apply_memory_log(Memory *m, const MemoryLog *log) {
+  MemoryLog *own = m->log;
+  m->log = NULL;
+  for (uint32_t i = 0; i < log->count; i++) {
+    write_memory(m, log->indexes[i], log->values[i]);
+  }
+  m->log = own;
+}
+
+/**
+ * @brief Free the entries of a memory log
+ *
+ * @param log Memory log
+ */
+void destroy_memory_log(MemoryLog *log) {
+  free(log->indexes);
+  free(log->values);
+  memset(log, 0, sizeof(MemoryLog));
+}
@@ -4,14 +4,22 @@
  */
 
 #include "mips.h"
+#include "cache.h"
 #include "common.h"
+#include "cosim.h"
 #include "pipeline.h"
+#include "predictor.h"
+#include "profile.h"
+#include "trace.h"
 
 /* helper functions prototypes */
 void print_memory(MIPSSim *mips);
 void print_registers(MIPSSim *mips);
 void correct_pc(MIPSSim *mips);
-void check_hazards(MIPSSim *mips, Instruction *instr);
+static void memory_access(MIPSSim *mips, Instruction *instr);
+static void write_back(MIPSSim *mips, Instruction *instr);
+static void finish_halt(MIPSSim *mips);
+static void run_instruction(MIPSSim *mips);
 
 /**
  * @brief Initialize the MIPS Lite simulator
@@ -23,6 +31,7 @@ void init_simulator(MIPSSim *mips, Mode mode) {
   mips->mode = mode;
   mips->counts = (InstructionCount){0};
   init_pipeline(&mips->pipeline, !!mode);
+  init_memory(&mips->memory);
   mips->clock = 1;
 }
 
@@ -32,33 +41,57 @@ void init_simulator(MIPSSim *mips, Mode mode) {
  * @param mips  MIPS simulator
  */
 void destroy_simulator(MIPSSim *mips) {
+  destroy_memory(&mips->memory);
   free(mips);
 }
 
 /**
- * @brief Load the program into memory from a file
+ * @brief Record an error on the simulator and stop it
  *
- * @param mips      MIPS simulator
- * @param filename  File to load
+ * @param mips    MIPS simulator
+ * @param status  Error status
+ * @param format  printf-style error message
+ * @return The error status
  */
-void load_memory(MIPSSim *mips, char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    perror("Failed to open file");
-    exit(1);
-    return;
-  }
-  char line[10];
-  int i = 0;
+SimStatus sim_error(MIPSSim *mips, SimStatus status, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(mips->error, sizeof(mips->error), format, args);
+  va_end(args);
+  mips->status = status;
+  mips->done = true;
+  return status;
+}
 
-  // Read the file line by line and load into memory
-  while (fgets(line, sizeof(line), file) && i < MEMORY_SIZE) {
-    mips->memory[i].value = strtol(line, NULL, 16);
-    i++;
+/**
+ * @brief Short name of a simulator status, for reports
+ *
+ * @param status  Simulator status
+ * @return Status name
+ */
+const char *status_name(SimStatus status) {
+  switch (status) {
+    case SIM_OK:
+      return "ok";
+    case SIM_ERR_FILE:
+      return "file_error";
+    case SIM_ERR_INVALID_OPCODE:
+      return "invalid_opcode";
+    case SIM_ERR_CYCLE_LIMIT:
+      return "cycle_limit";
+    case SIM_ERR_CHECKPOINT:
+      return "checkpoint_error";
+    case SIM_ERR_IMAGE:
+      return "image_error";
+    case SIM_ERR_DIVERGED:
+      return "diverged";
+    case SIM_ERR_REQUEST:
+      return "bad_request";
+    case SIM_BREAKPOINT:
+      return "breakpoint";
+    default:
+      return "unknown";
   }
-  fclose(file);
-  mips->memory_size = i;  // Set the memory size with the number of instructions loaded
-  LOG("Memory loaded from file: %s\n", filename);
 }
 
 /**
@@ -67,77 +100,25 @@ void load_memory(MIPSSim *mips, char *filename) {
  * @param mips  MIPS simulator
  */
 void fetch_stage(MIPSSim *mips) {
-  if (!peek_pipeline_stage(&mips->pipeline, IF) && (mips->pc / 4 < mips->memory_size) && !mips->halt) {
-    Instruction *instr = (Instruction *)malloc(sizeof(Instruction));
-    memset(instr, 0, sizeof(Instruction));
-    instr->instruction = mips->memory[mips->pc / 4].value;
+  Instruction *instr = peek_pipeline_stage(&mips->pipeline, IF);
+  if (!instr && (mips->pc / 4 < mips->memory_size) && !mips->halt) {
+    instr = alloc_instruction(&mips->pipeline);
+    instr->instruction = read_memory(&mips->memory, mips->pc / 4);
+    instr->pc = mips->pc;
     instr->stage = IF;
+    mips->fetch_clock = mips->clock;
+    mips->fetch_pc = mips->pc;
+    if (mips->pipeline.tracer) trace_stage(&mips->pipeline, instr, IF, mips->clock);
     fetch_instruction(&mips->pipeline, instr);
     mips->pc += 4;
+    if (mips->predictor) mips->pc = predict_next_pc(mips->predictor, instr->pc, instr->instruction, &instr->branch_history);
+    instr->predicted_pc = mips->pc;
+    if (mips->icache) instr->ready_clock = mips->clock + cache_access(mips->icache, instr->pc, instr->pc, false) - 1;
     // LOG("Instruction fetched: %08x\n", instr->instruction);
   }
-}
-
-/**
- * @brief Decode the instruction (ID stage)
- *
- * @param mips  MIPS simulator
- */
-void decode_stage(MIPSSim *mips) {
-  Instruction *instr = peek_pipeline_stage(&mips->pipeline, mips->pipeline.is_pipelined ? ID : IF);
-  if (instr == NULL || instr->stage != ID) {
-    return;
-  }
 
-  instr->opcode = (instr->instruction >> 26) & INSTR_MASK;
-
-  switch (instr->opcode) {
-    case ADD:
-    case SUB:
-    case MUL:
-    case OR:
-    case AND:
-    case XOR:
-      instr->type = R_TYPE;
-      break;
-    case ADDI:
-    case SUBI:
-    case MULI:
-    case ORI:
-    case ANDI:
-    case XORI:
-      instr->type = I_TYPE_IMM;
-      break;
-    case LDW:
-    case STW:
-      instr->type = I_TYPE_MEM;
-      break;
-    case HALT:
-    case BZ:
-    case BEQ:
-    case JR:
-      instr->type = J_TYPE;
-      break;
-    default:
-      fprintf(stderr, "Invalid opcode: %08x\n", instr->instruction);
-      exit(1);
-      break;
-  }
-
-  instr->rs = (instr->instruction >> 21) & INSTR_MASK;
-  instr->rt = (instr->instruction >> 16) & INSTR_MASK;
-
-  if (instr->type == R_TYPE) {
-    instr->rd = (instr->instruction >> 11) & INSTR_MASK;
-  } else {
-    instr->imm = (int16_t)(instr->instruction & 0xFFFF);
-    instr->alu_out = (int32_t)(mips->pc - 4) + (instr->imm << 2);
-  }
-
-  if (mips->mode != NOT_PIPED) check_hazards(mips, instr);
-
-  LOG("DECODED: [Instruction %08x] Type: %d, Opcode: %d, Rs: %d, Rt: %d, Rd: %d, Imm: %d, ALU: %d\n", instr->instruction, instr->type, instr->opcode,
-      instr->rs, instr->rt, instr->rd, instr->imm, instr->alu_out);
+  // An instruction that missed in the I-cache stays in IF until its line arrives
+  if (mips->icache && instr != NULL && instr->stage == IF && instr->ready_clock > mips->clock) mips->pipeline.fetch_busy = true;
 }
 
 /**
@@ -208,97 +189,71 @@ bool control_flow(MIPSSim *mips, Instruction *instr, int32_t rs, int32_t rt) {
 }
 
 /**
- * @brief Execute stage of the pipeline (EX stage)
+ * @brief Resolve a branch whose successor was predicted at fetch. Only a misprediction flushes the
+ * wrong-path instructions and costs the cycle every taken branch costs without prediction.
  *
  * @param mips  MIPS simulator
+ * @param instr Branch instruction (BZ, BEQ or JR)
+ * @param rs    Value of rs
+ * @param rt    Value of rt
  */
-void execute_stage(MIPSSim *mips) {
-  Instruction *instr = peek_pipeline_stage(&mips->pipeline, mips->pipeline.is_pipelined ? EX : IF);
-  if (instr == NULL || instr->stage != EX) {
-    return;
-  }
-
-  if (mips->mode != NOT_PIPED) instr->alu_out = (int32_t)(mips->pc - 8) + (instr->imm << 2);
-  int32_t rs = mips->registers[instr->rs].value;
-  int32_t rt = mips->registers[instr->rt].value;
-
-  // Forward the register value to either rs or rt if it is forwarded
-  if (instr->forward_reg.is_forwarded) {
-    if (instr->forward_reg.target == RT)
-      rt = instr->forward_reg.reg;
-    else
-      rs = instr->forward_reg.reg;
-  }
-
-  // Perform the operation based on the instruction type
-  switch (instr->type) {
-    case R_TYPE:  // R-Type instructions (ADD, SUB, MUL, OR, AND, XOR)
-      instr->alu_out = perform_operation(rs, rt, instr->opcode);
-      break;
-    case I_TYPE_IMM:  // I-Type instructions with immediate values (ADDI, SUBI, MULI, ORI, ANDI, XORI)
-      instr->alu_out = perform_operation(rs, instr->imm, instr->opcode);
-      break;
-    case I_TYPE_MEM:  // I-Type memory instructions (LDW, STW)
-      instr->alu_out = mips->registers[instr->rs].value + instr->imm;
-      break;
-    case J_TYPE:  // J-Type instructions (BZ, BEQ, JR, HALT)
-      bool branch_taken = control_flow(mips, instr, rs, rt);
-      // If branch is taken, flush the pipeline
-      if (branch_taken) {
-        flush_pipeline(&mips->pipeline, EX);
-        mips->clock++;
-      }
-      break;
-    default:
-      break;
+static void resolve_branch(MIPSSim *mips, Instruction *instr, int32_t rs, int32_t rt) {
+  uint32_t fetch_pc = mips->pc;
+  bool taken = control_flow(mips, instr, rs, rt);
+  uint32_t next_pc = taken ? mips->pc : instr->pc + 4;
+  bool mispredicted = next_pc != instr->predicted_pc;
+  update_predictor(mips->predictor, instr->pc, instr->branch_history, taken, next_pc, mispredicted);
+
+  mips->pc = fetch_pc;
+  if (mispredicted) {
+    mips->pc = next_pc;
+    flush_pipeline(&mips->pipeline, EX);
+    if (mips->pipeline.tracer) trace_flush(&mips->pipeline, mips->clock, TRACE_FLUSHED);
+    mips->clock++;
   }
+  if (mips->profiler) profile_branch(mips->profiler, &mips->pipeline, instr, taken, mispredicted);
+}
 
-  // Increment instruction counts
+/**
+ * @brief Count an executed instruction in the instruction counts
+ *
+ * @param mips    MIPS simulator
+ * @param opcode  Operation code
+ */
+void count_instruction(MIPSSim *mips, Opcode opcode) {
   mips->counts.total++;
-  if (instr->opcode >= ADD && instr->opcode <= MULI) {
+  if (opcode >= ADD && opcode <= MULI) {
     mips->counts.arithmetic++;
-  } else if (instr->opcode >= OR && instr->opcode <= XORI) {
+  } else if (opcode >= OR && opcode <= XORI) {
     mips->counts.logical++;
-  } else if (instr->opcode == LDW || instr->opcode == STW) {
+  } else if (opcode == LDW || opcode == STW) {
     mips->counts.memory++;
   } else {
     mips->counts.control++;
   }
 }
 
-void memory_stage(MIPSSim *mips) {
-  Instruction *instr = peek_pipeline_stage(&mips->pipeline, mips->pipeline.is_pipelined ? MEM : IF);
-  if (instr == NULL || instr->stage != MEM) {
-    return;
-  }
-
-  // Perform memory operation based on the instruction type
-  switch (instr->type) {
-    case I_TYPE_MEM:
-      if (instr->opcode == LDW) {  // If load word, read from memory and store in MDR
-        instr->mdr = mips->memory[instr->alu_out / 4].value;
-
-      } else if (instr->opcode == STW) {  // If store word, write to memory from register
-        mips->memory[instr->alu_out / 4].value = mips->registers[instr->rt].value;
-        mips->memory[instr->alu_out / 4].modified = true;
-      }
-      break;
-    default:
-      break;
+/**
+ * @brief Perform the memory access of a load or store
+ *
+ * @param mips  MIPS simulator
+ * @param instr Instruction
+ */
+static void memory_access(MIPSSim *mips, Instruction *instr) {
+  if (instr->opcode == LDW) {  // If load word, read from memory and store in MDR
+    instr->mdr = read_memory(&mips->memory, (uint32_t)instr->alu_out / 4);
+  } else if (instr->opcode == STW) {  // If store word, write to memory from register
+    write_memory(&mips->memory, (uint32_t)instr->alu_out / 4, mips->registers[instr->rt].value);
   }
 }
 
 /**
- * @brief Writeback stage of the pipeline (WB stage)
+ * @brief Write an instruction's result to the register file
  *
  * @param mips  MIPS simulator
+ * @param instr Instruction
  */
-void writeback_stage(MIPSSim *mips) {
-  Instruction *instr = peek_pipeline_stage(&mips->pipeline, mips->pipeline.is_pipelined ? WB : IF);
-  if (instr == NULL || instr->stage != WB) {
-    return;
-  }
-
+static void write_back(MIPSSim *mips, Instruction *instr) {
   switch (instr->type) {
     case R_TYPE:
       mips->registers[instr->rd].value = instr->alu_out;
@@ -320,37 +275,63 @@ void writeback_stage(MIPSSim *mips) {
 }
 
 /**
- * @brief Process the next clock cycle of the simulator
+ * @brief Bring the instructions ahead of a HALT to the point the five-stage pipeline leaves them at: the
+ * nearest has done its memory access but does not write back, and the older ones complete. A deeper
+ * pipeline would otherwise stop with more of their work undone. The oldest go first, as WB comes before
+ * MEM in a cycle, so a store reads the register an older instruction writes back.
  *
- * @param mips  MIPS simulator
+ * @param mips  MIPS simulator, whose HALT has just executed
  */
-void process(MIPSSim *mips) {
-  LOG("-> CLK: %d, PC: %d\n", mips->clock, mips->pc);
-  writeback_stage(mips);
-  memory_stage(mips);
-  execute_stage(mips);
-  if (mips->halt) return;
-  decode_stage(mips);
-  fetch_stage(mips);
-  mips->done = advance_pipeline(&mips->pipeline);
+static void finish_halt(MIPSSim *mips) {
+  Pipeline *p = &mips->pipeline;
+  int nearest = p->work[EX] + 1;
+  while (nearest < p->depth && (p->stages[nearest] == NULL || p->stages[nearest]->stage == DONE)) nearest++;
+  for (int i = p->depth - 1; i >= nearest; i--) {
+    Instruction *instr = p->stages[i];
+    if (instr == NULL || instr->stage == DONE) continue;
+    if (i < p->work[MEM]) memory_access(mips, instr);
+    if (i < p->work[WB] && i != nearest) write_back(mips, instr);
+  }
+}
 
-  // If not pipelined and the PC is within the memory bounds, keep processing
-  if (mips->mode == NOT_PIPED && mips->pc / 4 < mips->memory_size) mips->done = false;
+static int compare_pages(const void *a, const void *b) {
+  uint32_t x = (*(MemoryPage *const *)a)->index, y = (*(MemoryPage *const *)b)->index;
+  return (x > y) - (x < y);
 }
 
+/**
+ * @brief Print the modified words of the program's memory in address order. Only the dirty pages are
+ * visited. As in the original simulator, words past the loaded image are not printed even when the program
+ * stored to them (tests/Pipeline_No_Forward/13 relies on this); the stores still take effect.
+ *
+ * @param mips  MIPS simulator
+ */
 void print_memory(MIPSSim *mips) {
   printf("Memory:\n");
-  uint8_t k = 0;
-  for (int i = 0; i < mips->memory_size; i++) {
-    if (mips->memory[i].modified) {
-      if (k % 8 == 0 && k != 0) {
-        printf("\n");
+  size_t num_dirty = 0;
+  for (MemoryPage *page = mips->memory.dirty_pages; page != NULL; page = page->next_dirty) num_dirty++;
+  MemoryPage **pages = malloc(num_dirty * sizeof(MemoryPage *) + 1);
+  num_dirty = 0;
+  for (MemoryPage *page = mips->memory.dirty_pages; page != NULL; page = page->next_dirty) pages[num_dirty++] = page;
+  qsort(pages, num_dirty, sizeof(MemoryPage *), compare_pages);
+
+  uint32_t k = 0;
+  for (size_t n = 0; n < num_dirty; n++) {
+    for (uint32_t i = 0; i < MEMORY_PAGE_WORDS / 64; i++) {
+      for (uint64_t bits = pages[n]->modified[i]; bits != 0; bits &= bits - 1) {
+        uint32_t offset = i * 64 + __builtin_ctzll(bits);
+        uint32_t index = (pages[n]->index << MEMORY_PAGE_BITS) + offset;
+        if (index >= mips->memory_size) break;
+        if (k % 8 == 0 && k != 0) {
+          printf("\n");
+        }
+        printf("[%4u:%d] ", index * 4, pages[n]->words[offset]);
+        k++;
       }
-      printf("[%4d:%d] ", i * 4, mips->memory[i].value);
-      k++;
     }
   }
   printf("\n");
+  free(pages);
 }
 
 void print_registers(MIPSSim *mips) {
@@ -376,54 +357,252 @@ void print_registers(MIPSSim *mips) {
 void correct_pc(MIPSSim *mips) {
   if (mips->mode == NOT_PIPED) return;
 
-  for (int i = 0; i < EX; i++) {
-    Instruction *instr = peek_pipeline_stage(&mips->pipeline, i);
+  // Instructions fetched but not executed are not part of the final state: the PC goes back to the oldest
+  for (int i = mips->pipeline.work[EX] - 1; i >= 0; i--) {
+    Instruction *instr = mips->pipeline.stages[i];
     if (instr != NULL) {
-      mips->pc -= 4;
+      mips->pc = instr->pc;
+      return;
     }
   }
 }
 
-// Helper function to set the forward register
-void set_forward_reg(Instruction *instr, int8_t check_reg, int reg) {
-  instr->forward_reg = (ForwardReg){.is_forwarded = true, .reg = reg, .target = (instr->rs == check_reg) ? RS : RT};
+/**
+ * @brief Check whether an instruction in flight is still to execute. A multi-cycle operation holding EX is not.
+ *
+ * @param instr Instruction
+ * @return true if it has not gone through execute_stage() and was not flushed
+ */
+static bool is_unexecuted(const Instruction *instr) {
+  return instr->stage < EX || (instr->stage == EX && instr->ex_cycles == 0);
 }
 
 /**
- * @brief Check for RAW hazards and stall the pipeline if necessary
+ * @brief Empty the pipeline so another engine can take over. Instructions that have not executed yet are
+ * squashed and the PC is rewound to the oldest of them; the rest complete their MEM and WB stages.
  *
  * @param mips  MIPS simulator
- * @param instr Instruction
  */
-void check_hazards(MIPSSim *mips, Instruction *instr) {
-  for (int i = EX; i < WB; i++) {
-    Instruction *next_instr = peek_pipeline_stage(&mips->pipeline, i);
-    if (next_instr == NULL || next_instr->type == J_TYPE) continue;
+void drain_pipeline(MIPSSim *mips) {
+  Pipeline *p = &mips->pipeline;
+
+  // Without pipelining the single in-flight instruction sits in the first slot
+  for (int i = p->is_pipelined ? p->work[EX] : 0; i >= 0; i--) {
+    Instruction *instr = p->stages[i];
+    if (instr != NULL && is_unexecuted(instr)) {
+      mips->pc = instr->pc;
+      break;
+    }
+  }
+  for (int i = 0; i < p->depth; i++) {
+    Instruction *instr = p->stages[i];
+    if (instr != NULL && is_unexecuted(instr)) instr->stage = DONE;
+  }
+  if (p->tracer) trace_flush(p, mips->clock, TRACE_SQUASHED);
+
+  p->is_stalled = false;
+  p->scoreboard.pending = 0;  // Squashed instructions write nothing, and the rest complete here
+  bool is_empty;
+  do {
+    writeback_stage(mips);
+    memory_stage(mips);
+    is_empty = advance_pipeline(p);
+  } while (!is_empty);
+  mips->done = false;
+}
 
-    int8_t check_reg = (next_instr->type == R_TYPE) ? next_instr->rd : next_instr->rt;
+/**
+ * @brief Registers an instruction reads in EX. A store's data register is read in MEM, after the
+ * instructions ahead of it have written back, so it never causes a hazard. HALT reads nothing but, as in
+ * the original model, waits on its rs field like the other J-Type instructions.
+ *
+ * @param instr Instruction in ID
+ * @return Bitmask of registers
+ */
+static uint32_t source_registers(const Instruction *instr) {
+  switch (instr->opcode) {
+    case LDW:
+    case STW:
+    case BZ:
+    case JR:
+    case HALT:
+      return 1u << instr->rs;
+    case BEQ:
+      return (1u << instr->rs) | (1u << instr->rt);
+    default:
+      return (1u << instr->rs) | (instr->type == R_TYPE ? 1u << instr->rt : 0);
+  }
+}
 
-    // Check if the current instruction is using the register that the next instruction will modify
-    bool is_hazard = (instr->type == R_TYPE && (instr->rs == check_reg || instr->rt == check_reg)) ||
-                     ((instr->type == I_TYPE_IMM || instr->type == I_TYPE_MEM) && instr->rs == check_reg) ||
-                     (instr->opcode == BEQ && (instr->rs == check_reg || instr->rt == check_reg)) ||
-                     (instr->type == J_TYPE && instr->rs == check_reg);
+/* The cycle loop, once per mode (see mips_cycle.h) */
+#define MODE NOT_PIPED
+#define MODE_FN(name) name##_not_piped
+#include "mips_cycle.h"
+#undef MODE
+#undef MODE_FN
+
+#define MODE PIPED_NO_FWD
+#define MODE_FN(name) name##_no_fwd
+#include "mips_cycle.h"
+#undef MODE
+#undef MODE_FN
+
+#define MODE PIPED_FWD
+#define MODE_FN(name) name##_fwd
+#include "mips_cycle.h"
+#undef MODE
+#undef MODE_FN
+
+/* The instances of one mode */
+typedef struct {
+  ProcessFn process;
+  ProcessFn finish_from_execute;
+  ProcessFn finish_cycle;
+  ProcessFn decode_stage;
+  ProcessFn execute_stage;
+  ProcessFn memory_stage;
+  ProcessFn writeback_stage;
+  bool (*run_until)(MIPSSim *mips, uint32_t stop_clock);
+} ModeCycle;
+
+#define MODE_CYCLE(suffix)                                                                                        \
+  {process_##suffix, finish_from_execute_##suffix, finish_cycle_##suffix, decode_stage_##suffix,              \
+   execute_stage_##suffix, memory_stage_##suffix, writeback_stage_##suffix, run_until_##suffix}
+
+/* Indexed by Mode. The superscalar mode has its own engine; anything that steps it here gets forwarding */
+static const ModeCycle mode_cycles[] = {
+    [NOT_PIPED] = MODE_CYCLE(not_piped),
+    [PIPED_NO_FWD] = MODE_CYCLE(no_fwd),
+    [PIPED_FWD] = MODE_CYCLE(fwd),
+    [PIPED_SUPERSCALAR] = MODE_CYCLE(fwd),
+};
 
-    if (is_hazard) {
-      // If pipeline forwarding is enabled and the next instruction is either R-type or immediate I-type and has reached the EX stage
-      if (mips->mode == PIPED_FWD && (next_instr->type == R_TYPE || next_instr->type == I_TYPE_IMM) && next_instr->stage >= EX) {
-        set_forward_reg(instr, check_reg, next_instr->alu_out);
-        return;
+/**
+ * @brief Run a whole instruction through the non-pipelined datapath. Only one stage works in each of its
+ * cycles, so the stages are called in a row and the clock advances as process() would advance it.
+ *
+ * @param mips  MIPS simulator, with an empty pipeline
+ */
+static void run_instruction(MIPSSim *mips) {
+  fetch_stage(mips);
+  Instruction *instr = peek_pipeline_stage(&mips->pipeline, IF);
+  mips->clock++;
+  if (mips->icache && instr->ready_clock >= mips->clock) mips->clock = instr->ready_clock + 1;
+
+  instr->stage = ID;
+  decode_stage_not_piped(mips);
+  if (mips->status != SIM_OK) return;
+  mips->clock++;
+
+  instr->stage = EX;
+  execute_stage_not_piped(mips);
+  mips->clock++;
+  if (mips->halt) return;
 
-      }
-      // If pipeline forwarding is enabled and the next instruction is LDW and has reached MEM stage
-      else if (mips->mode == PIPED_FWD && next_instr->opcode == LDW && next_instr->stage >= MEM) {
-        set_forward_reg(instr, check_reg, next_instr->mdr);
-        return;
-
-      } else {
-        stall_pipeline(&mips->pipeline);
-        return;
-      }
-    }
-  }
-}
\ No newline at end of file
+  instr->stage = MEM;
+  memory_stage_not_piped(mips);
+  mips->clock++;
+
+  instr->stage = WB;
+  writeback_stage_not_piped(mips);
+  mips->clock++;
+
+  advance_in_place(&mips->pipeline);
+  mips->done = mips->pc / 4 >= mips->memory_size;
+}
+
+/**
+ * @brief Pick the process() instance of a mode, for callers that step the simulator cycle by cycle
+ *
+ * @param mode  Simulation mode
+ * @return Function processing one clock cycle in that mode
+ */
+ProcessFn select_process(Mode mode) {
+  return mode_cycles[mode].process;
+}
+
+/**
+ * @brief Process the next clock cycle of the simulator
+ *
+ * @param mips  MIPS simulator
+ */
+void process(MIPSSim *mips) {
+  mode_cycles[mips->mode].process(mips);
+}
+
+/**
+ * @brief Execute, decode, fetch and advance the pipeline: the rest of a cycle that stopped at a breakpoint
+ * in EX
+ *
+ * @param mips  MIPS simulator
+ */
+void finish_from_execute(MIPSSim *mips) {
+  mode_cycles[mips->mode].finish_from_execute(mips);
+}
+
+/**
+ * @brief Decode, fetch and advance the pipeline: the rest of a cycle after execute, or of one that
+ * stopped at a breakpoint in ID
+ *
+ * @param mips  MIPS simulator
+ */
+void finish_cycle(MIPSSim *mips) {
+  mode_cycles[mips->mode].finish_cycle(mips);
+}
+
+/**
+ * @brief Decode the instruction (ID stage)
+ *
+ * @param mips  MIPS simulator
+ */
+void decode_stage(MIPSSim *mips) {
+  mode_cycles[mips->mode].decode_stage(mips);
+}
+
+/**
+ * @brief Execute stage of the pipeline (EX stage)
+ *
+ * @param mips  MIPS simulator
+ */
+void execute_stage(MIPSSim *mips) {
+  mode_cycles[mips->mode].execute_stage(mips);
+}
+
+/**
+ * @brief Memory stage of the pipeline (MEM stage)
+ *
+ * @param mips  MIPS simulator
+ */
+void memory_stage(MIPSSim *mips) {
+  mode_cycles[mips->mode].memory_stage(mips);
+}
+
+/**
+ * @brief Writeback stage of the pipeline (WB stage)
+ *
+ * @param mips  MIPS simulator
+ */
+void writeback_stage(MIPSSim *mips) {
+  mode_cycles[mips->mode].writeback_stage(mips);
+}
+
+/**
+ * @brief Run the pipeline model cycle by cycle until the program halts or drains
+ *
+ * @param mips  MIPS simulator
+ */
+void run_pipeline(MIPSSim *mips) {
+  run_pipeline_until(mips, 0);
+}
+
+/**
+ * @brief Run the pipeline model until the program halts or drains, or the clock reaches a given cycle. The
+ * mode's instance of the cycle loop is picked once here.
+ *
+ * @param mips        MIPS simulator
+ * @param stop_clock  Clock value to pause at (0 to run to the end)
+ * @return true if the program finished (or failed), false if it was paused at stop_clock
+ */
+bool run_pipeline_until(MIPSSim *mips, uint32_t stop_clock) {
+  return mode_cycles[mips->mode].run_until(mips, stop_clock);
+}
@@ -0,0 +1,239 @@
+/**
+ * @file  mipssim.c
+ * @brief libmipssim: the public API over the pipeline model, see mipssim.h
+ * @copyright Copyright (c) 2024
+ */
+
+#include "mipssim.h"
+
+#include "common.h"
+#include "image.h"
+#include "mips.h"
+#include "pipeline.h"
+
+struct MipsSimHandle {
+  MIPSSim *mips;
+};
+
+/**
+ * @brief Status of a simulator after a run
+ *
+ * @param mips  MIPS simulator
+ * @return MIPSSIM_OK if it can continue, MIPSSIM_FINISHED if it ended, or the error that stopped it
+ */
+static MipsSimStatus run_status(const MIPSSim *mips) {
+  switch (mips->status) {
+    case SIM_OK:
+      return mips->done || mips->halt ? MIPSSIM_FINISHED : MIPSSIM_OK;
+    case SIM_ERR_INVALID_OPCODE:
+      return MIPSSIM_ERR_INVALID_OPCODE;
+    case SIM_ERR_CYCLE_LIMIT:
+      return MIPSSIM_ERR_CYCLE_LIMIT;
+    default:
+      return MIPSSIM_ERR_IMAGE;
+  }
+}
+
+/**
+ * @brief Create a simulator and load a program into it
+ *
+ * @param image Memory image, text (one hexadecimal word per line) or binary (as written by -x)
+ * @param size  Image size in bytes
+ * @param mode  0: non-pipelined, 1: pipelined without forwarding, 2: pipelined with forwarding
+ * @param sim   Set to the simulator, or NULL on error
+ * @return MIPSSIM_OK, MIPSSIM_ERR_ARGUMENT, MIPSSIM_ERR_NO_MEMORY or MIPSSIM_ERR_IMAGE
+ */
+MipsSimStatus mipssim_create(const void *image, size_t size, int mode, MipsSimHandle **sim) {
+  if (sim == NULL) return MIPSSIM_ERR_ARGUMENT;
+  *sim = NULL;
+  if ((image == NULL && size > 0) || mode < NOT_PIPED || mode > PIPED_FWD) return MIPSSIM_ERR_ARGUMENT;
+
+  MipsSimHandle *handle = malloc(sizeof(MipsSimHandle));
+  MIPSSim *mips = malloc(sizeof(MIPSSim));
+  if (handle == NULL || mips == NULL) {
+    free(handle);
+    free(mips);
+    return MIPSSIM_ERR_NO_MEMORY;
+  }
+  init_simulator(mips, (Mode)mode);
+  if (load_image(mips, "image", image, size) != SIM_OK) {
+    destroy_simulator(mips);
+    free(handle);
+    return MIPSSIM_ERR_IMAGE;
+  }
+  handle->mips = mips;
+  *sim = handle;
+  return MIPSSIM_OK;
+}
+
+/**
+ * @brief Free a simulator
+ *
+ * @param sim Simulator, or NULL
+ */
+void mipssim_destroy(MipsSimHandle *sim) {
+  if (sim == NULL) return;
+  destroy_simulator(sim->mips);
+  free(sim);
+}
+
+/**
+ * @brief Stop the program with MIPSSIM_ERR_CYCLE_LIMIT once the clock passes a number of cycles
+ *
+ * @param sim     Simulator
+ * @param cycles  Cycle limit, 0 for none (the default)
+ * @return MIPSSIM_OK, or MIPSSIM_ERR_ARGUMENT
+ */
+MipsSimStatus mipssim_set_cycle_limit(MipsSimHandle *sim, uint32_t cycles) {
+  if (sim == NULL) return MIPSSIM_ERR_ARGUMENT;
+  sim->mips->cycle_limit = cycles;
+  return MIPSSIM_OK;
+}
+
+/**
+ * @brief Run the program to the end. Once an error has stopped it, this and the other run calls return the
+ * error again and leave the state as it was.
+ *
+ * @param sim Simulator
+ * @return MIPSSIM_FINISHED, or the error that stopped the program
+ */
+MipsSimStatus mipssim_run(MipsSimHandle *sim) {
+  if (sim == NULL) return MIPSSIM_ERR_ARGUMENT;
+  if (sim->mips->status != SIM_OK) return run_status(sim->mips);
+  run_pipeline(sim->mips);
+  return run_status(sim->mips);
+}
+
+/**
+ * @brief Run the program for a number of clock cycles, or to its end if that comes first
+ *
+ * @param sim     Simulator
+ * @param cycles  Cycles to run
+ * @return MIPSSIM_OK if the program can continue, MIPSSIM_FINISHED, or the error that stopped it
+ */
+MipsSimStatus mipssim_run_cycles(MipsSimHandle *sim, uint32_t cycles) {
+  if (sim == NULL) return MIPSSIM_ERR_ARGUMENT;
+  MIPSSim *mips = sim->mips;
+  if (mips->status != SIM_OK) return run_status(mips);
+  if (cycles > 0) run_pipeline_until(mips, cycles < UINT32_MAX - mips->clock ? mips->clock + cycles : UINT32_MAX);
+  return run_status(mips);
+}
+
+/**
+ * @brief Run the program cycle by cycle until it fetches the instruction at an address, or to its end if that
+ * comes first. Runs at least one cycle, so each call stops at the next fetch there, after a taken branch too.
+ *
+ * @param sim Simulator
+ * @param pc  Byte address
+ * @return MIPSSIM_OK if it stopped at pc, MIPSSIM_FINISHED, or the error that stopped the program
+ */
+MipsSimStatus mipssim_run_until(MipsSimHandle *sim, uint32_t pc) {
+  if (sim == NULL) return MIPSSIM_ERR_ARGUMENT;
+  MIPSSim *mips = sim->mips;
+  if (mips->status != SIM_OK) return run_status(mips);
+  ProcessFn step = select_process(mips->mode);
+  while (!mips->done && !mips->halt) {
+    step(mips);
+    if (mips->status != SIM_OK) return run_status(mips);
+    bool fetched = mips->fetch_clock == mips->clock && mips->fetch_pc == pc;
+    mips->clock++;
+    if (mips->cycle_limit && mips->clock > mips->cycle_limit) {
+      sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);
+      return run_status(mips);
+    }
+    if (fetched && !mips->done && !mips->halt) return MIPSSIM_OK;
+  }
+  correct_pc(mips);
+  return run_status(mips);
+}
+
+/**
+ * @brief Get the clock, PC and instruction counts
+ *
+ * @param sim   Simulator
+ * @param stats Filled in
+ * @return MIPSSIM_OK, or MIPSSIM_ERR_ARGUMENT
+ */
+MipsSimStatus mipssim_get_stats(const MipsSimHandle *sim, MipsSimStats *stats) {
+  if (sim == NULL || stats == NULL) return MIPSSIM_ERR_ARGUMENT;
+  const MIPSSim *mips = sim->mips;
+  *stats = (MipsSimStats){
+      .clock = mips->clock,
+      .pc = mips->pc,
+      .stalls = mips->pipeline.total_stalls,
+      .instructions = mips->counts.total,
+      .arithmetic = mips->counts.arithmetic,
+      .logical = mips->counts.logical,
+      .memory = mips->counts.memory,
+      .control = mips->counts.control,
+      .halted = mips->halt,
+      .finished = mips->done || mips->halt,
+  };
+  return MIPSSIM_OK;
+}
+
+/**
+ * @brief Read a register
+ *
+ * @param sim   Simulator
+ * @param reg   Register number (0 to 31)
+ * @param value Set to the register's value
+ * @return MIPSSIM_OK, or MIPSSIM_ERR_ARGUMENT
+ */
+MipsSimStatus mipssim_read_register(const MipsSimHandle *sim, unsigned reg, int32_t *value) {
+  if (sim == NULL || value == NULL || reg >= 32) return MIPSSIM_ERR_ARGUMENT;
+  *value = sim->mips->registers[reg].value;
+  return MIPSSIM_OK;
+}
+
+/**
+ * @brief Read a word of memory
+ *
+ * @param sim     Simulator
+ * @param address Byte address, word aligned
+ * @param value   Set to the word
+ * @return MIPSSIM_OK, or MIPSSIM_ERR_ARGUMENT
+ */
+MipsSimStatus mipssim_read_memory(MipsSimHandle *sim, uint32_t address, int32_t *value) {
+  if (sim == NULL || value == NULL || address % 4 != 0) return MIPSSIM_ERR_ARGUMENT;
+  *value = read_memory(&sim->mips->memory, address / 4);
+  return MIPSSIM_OK;
+}
+
+/**
+ * @brief Message of the error that stopped the program
+ *
+ * @param sim Simulator
+ * @return Message, empty if there was no error
+ */
+const char *mipssim_error(const MipsSimHandle *sim) {
+  if (sim == NULL || sim->mips->status == SIM_OK) return "";
+  return sim->mips->error;
+}
+
+/**
+ * @brief Short name of a status, for reports
+ *
+ * @param status  Status
+ * @return Status name
+ */
+const char *mipssim_status_name(MipsSimStatus status) {
+  switch (status) {
+    case MIPSSIM_OK:
+      return "ok";
+    case MIPSSIM_FINISHED:
+      return "finished";
+    case MIPSSIM_ERR_ARGUMENT:
+      return "invalid_argument";
+    case MIPSSIM_ERR_NO_MEMORY:
+      return "no_memory";
+    case MIPSSIM_ERR_IMAGE:
+      return "image_error";
+    case MIPSSIM_ERR_INVALID_OPCODE:
+      return "invalid_opcode";
+    case MIPSSIM_ERR_CYCLE_LIMIT:
+      return "cycle_limit";
+    default:
+      return "unknown";
+  }
+}
@@ -0,0 +1,228 @@
+/**
+ * @file  multicore.c
+ * @brief Multi-core simulation: cores with private registers and pipelines share one memory, each runs
+ * on its own host thread, and they synchronise every quantum of cycles
+ * @copyright Copyright (c) 2024
+ */
+
+#include "multicore.h"
+
+#include "common.h"
+#include "image.h"
+#include "mips.h"
+#include "pipeline.h"
+
+typedef struct {
+  Multicore *mc;
+  uint32_t id;
+} CoreThread;
+
+/**
+ * @brief Parse a list of cores, "image[@entry_pc],..." (an empty image is the -f one, e.g. "@0,@0x400")
+ *
+ * @param spec    Core list, left as it is: a copy is split, which the image names point into
+ * @param config  Configuration to fill; the quantum is left as it is. Free it with free_multicore_config().
+ * @return true on success, false if the list is empty, too long or has an invalid entry PC
+ */
+bool parse_multicore_config(const char *spec, MulticoreConfig *config) {
+  free_multicore_config(config);
+  config->names = strdup(spec);
+  for (char *next = config->names; next != NULL;) {
+    char *core = next;
+    next = strchr(core, ',');
+    if (next != NULL) *next++ = '\0';
+    if (config->num_cores == MULTICORE_MAX_CORES) {
+      free_multicore_config(config);
+      return false;
+    }
+
+    CoreSpec *c = &config->cores[config->num_cores++];
+    *c = (CoreSpec){0};
+    char *at = strrchr(core, '@');
+    if (at != NULL) {
+      char *end;
+      *at = '\0';
+      unsigned long pc = strtoul(at + 1, &end, 0);
+      if (at[1] == '\0' || *end != '\0' || pc > UINT32_MAX || pc % 4 != 0) {
+        free_multicore_config(config);
+        return false;
+      }
+      c->entry_pc = (uint32_t)pc;
+      c->has_entry_pc = true;
+    }
+    if (*core != '\0') c->image = core;
+  }
+  return config->num_cores > 0;
+}
+
+/**
+ * @brief Free the copy of the core list the image names point into, and forget the cores
+ *
+ * @param config  Configuration filled by parse_multicore_config(), or zeroed
+ */
+void free_multicore_config(MulticoreConfig *config) {
+  free(config->names);
+  config->names = NULL;
+  config->num_cores = 0;
+}
+
+/**
+ * @brief Create the cores. The images are loaded in core order, each once, into one memory that every core
+ * gets a copy of; where they overlap the later image wins.
+ *
+ * @param mc          Multi-core simulator
+ * @param config      Cores and quantum
+ * @param image       Image of the cores that do not name one (may be NULL if they all do)
+ * @param mode        Mode of every core (0 to 2)
+ * @param cycle_limit Cycle limit of each core (0 for no limit)
+ * @param pipeline    Pipeline stages of every core, NULL for the default
+ * @return SIM_OK, or the error that stopped the first core (in cores[0]->error)
+ */
+SimStatus init_multicore(Multicore *mc, const MulticoreConfig *config, char *image, Mode mode, uint32_t cycle_limit,
+                         const PipelineConfig *pipeline) {
+  memset(mc, 0, sizeof(Multicore));
+  mc->config = *config;
+  for (uint32_t i = 0; i < config->num_cores; i++) {
+    mc->cores[i] = malloc(sizeof(MIPSSim));
+    if (mc->cores[i] == NULL) {
+      perror("Failed to allocate core");
+      exit(EXIT_FAILURE);
+    }
+    init_simulator(mc->cores[i], mode);
+    if (pipeline != NULL) configure_pipeline(&mc->cores[i]->pipeline, pipeline);
+    mc->cores[i]->cycle_limit = cycle_limit;
+  }
+
+  // Load each image into the first core, and note the entry PC and size it gives each core
+  MIPSSim *first = mc->cores[0];
+  uint32_t pcs[MULTICORE_MAX_CORES], sizes[MULTICORE_MAX_CORES];
+  for (uint32_t i = 0; i < config->num_cores; i++) {
+    char *file = config->cores[i].image != NULL ? config->cores[i].image : image;
+    uint32_t loaded = i;
+    for (uint32_t j = 0; j < i && loaded == i; j++) {
+      char *other = config->cores[j].image != NULL ? config->cores[j].image : image;
+      if (strcmp(other, file) == 0) loaded = j;
+    }
+    if (loaded == i) {
+      first->pc = 0;
+      if (load_memory(first, file) != SIM_OK) return first->status;
+    }
+    pcs[i] = loaded == i ? first->pc : pcs[loaded];
+    sizes[i] = loaded == i ? first->memory_size : sizes[loaded];
+  }
+
+  for (uint32_t i = 0; i < config->num_cores; i++) {
+    MIPSSim *mips = mc->cores[i];
+    if (i > 0) copy_memory(&mips->memory, &first->memory);
+    mips->pc = config->cores[i].has_entry_pc ? config->cores[i].entry_pc : pcs[i];
+    mips->memory_size = sizes[i];
+    mips->memory.log = &mc->logs[i];
+  }
+  return SIM_OK;
+}
+
+/**
+ * @brief Run one core quantum by quantum until every core has finished. Between the two barriers of each
+ * quantum the core replays every core's stores, its own included, in core order.
+ *
+ * @param arg Core thread
+ * @return NULL
+ */
+static void *core_main(void *arg) {
+  CoreThread *thread = arg;
+  Multicore *mc = thread->mc;
+  MIPSSim *mips = mc->cores[thread->id];
+  uint32_t num_cores = mc->config.num_cores;
+
+  for (uint64_t quantum = 1;; quantum++) {
+    uint64_t stop_clock = quantum * mc->config.quantum + 1;
+    if (!mc->finished[thread->id]) {
+      mc->finished[thread->id] = run_pipeline_until(mips, stop_clock < UINT32_MAX ? (uint32_t)stop_clock : UINT32_MAX);
+    }
+    pthread_barrier_wait(&mc->barrier);
+
+    bool all_finished = true;
+    for (uint32_t i = 0; i < num_cores; i++) {
+      all_finished &= mc->finished[i];
+      apply_memory_log(&mips->memory, &mc->logs[i]);
+    }
+    pthread_barrier_wait(&mc->barrier);
+
+    mc->logs[thread->id].count = 0;
+    if (all_finished) {
+      if (thread->id == 0) mc->quanta = (uint32_t)quantum;
+      return NULL;
+    }
+  }
+}
+
+/**
+ * @brief Run every core on its own host thread until all of them have halted, drained or failed. The
+ * result only depends on the quantum, not on how the host schedules the threads.
+ *
+ * @param mc  Multi-core simulator
+ */
+void run_multicore(Multicore *mc) {
+  uint32_t num_cores = mc->config.num_cores;
+  CoreThread threads[MULTICORE_MAX_CORES];
+  pthread_t handles[MULTICORE_MAX_CORES];
+  pthread_barrier_init(&mc->barrier, NULL, num_cores);
+
+  // The calling thread runs core 0
+  for (uint32_t i = 0; i < num_cores; i++) {
+    threads[i] = (CoreThread){.mc = mc, .id = i};
+  }
+  for (uint32_t i = 1; i < num_cores; i++) {
+    pthread_create(&handles[i], NULL, core_main, &threads[i]);
+  }
+  core_main(&threads[0]);
+  for (uint32_t i = 1; i < num_cores; i++) {
+    pthread_join(handles[i], NULL);
+  }
+  pthread_barrier_destroy(&mc->barrier);
+}
+
+/**
+ * @brief Print the results of every core, then the shared memory
+ *
+ * @param mc    Multi-core simulator, after run_multicore()
+ * @param image Image of the cores that do not name one
+ */
+void print_multicore_results(Multicore *mc, const char *image) {
+  printf("Cores: %u, quantum: %u cycles, %u quanta\n", mc->config.num_cores, mc->config.quantum, mc->quanta);
+  MIPSSim *widest = mc->cores[0];
+  for (uint32_t i = 0; i < mc->config.num_cores; i++) {
+    MIPSSim *mips = mc->cores[i];
+    const CoreSpec *core = &mc->config.cores[i];
+    printf("---- Core %u: %s", i, core->image != NULL ? core->image : image);
+    if (core->has_entry_pc) printf(" @ %u", core->entry_pc);
+    printf(" ----\n");
+    printf("Total clock cycles: %d\n", mips->clock);
+    printf("Final PC: %d\n", mips->pc);
+    printf("Total Stalls: %d\n", mips->pipeline.total_stalls);
+    printf("Instruction counts:\n");
+    printf("\\ Total: %d\n", mips->counts.total);
+    printf("\\ Arithmetic: %d\n", mips->counts.arithmetic);
+    printf("\\ Logical: %d\n", mips->counts.logical);
+    printf("\\ Memory: %d\n", mips->counts.memory);
+    printf("\\ Control: %d\n", mips->counts.control);
+    print_registers(mips);
+    if (mips->halt) printf("PROGRAM HALTED\n");
+    if (mips->memory_size > widest->memory_size) widest = mips;
+  }
+  printf("=====================================\n");
+  // Every copy of the memory is the same once the last quantum's stores are replayed
+  print_memory(widest);
+}
+
+/**
+ * @brief Free every core
+ *
+ * @param mc  Multi-core simulator
+ */
+void destroy_multicore(Multicore *mc) {
+  for (uint32_t i = 0; i < mc->config.num_cores; i++) {
+    if (mc->cores[i] != NULL) destroy_simulator(mc->cores[i]);
+    destroy_memory_log(&mc->logs[i]);
+  }
+}
@@ -5,24 +5,200 @@
 
 #include "pipeline.h"
 #include "common.h"
+#include "trace.h"
 
 #ifdef DEBUG
 static const char *stage_names[] = {"IF", "ID", "EX", "MEM", "WB", "DONE"};
 #endif
 
 /**
- * @brief Initialize the pipeline
+ * @brief Initialize the pipeline, with the build-time stage configuration
  *
  * @param p             Pipeline
  * @param is_pipelined  Use pipelined or non-pipelined mode
  */
 void init_pipeline(Pipeline *p, bool is_pipelined) {
-  for (int i = 0; i < NUM_STAGES; i++) {
+  for (int i = 0; i < PIPELINE_MAX_DEPTH; i++) {
     p->stages[i] = NULL;
   }
+  for (int i = 0; i < PIPELINE_SLOTS; i++) {
+    p->free_slots[i] = &p->slots[PIPELINE_SLOTS - 1 - i];
+  }
+  p->num_free = PIPELINE_SLOTS;
   p->is_pipelined = is_pipelined;
   p->is_stalled = false;
+  p->fetch_busy = false;
+  p->ex_busy = false;
   p->total_stalls = 0;
+  p->step = 0;
+  p->scoreboard.pending = 0;
+  p->tracer = NULL;
+
+  PipelineConfig config;
+  default_pipeline_config(&config);
+  configure_pipeline(p, &config);
+}
+
+/**
+ * @brief Stage configuration the simulator was built with
+ *
+ * @param config  Configuration
+ */
+void default_pipeline_config(PipelineConfig *config) {
+  *config = (PipelineConfig){.cycles = {PIPELINE_IF_CYCLES, 1, PIPELINE_EX_CYCLES, PIPELINE_MEM_CYCLES, 1}, .mul_cycles = PIPELINE_MUL_CYCLES};
+}
+
+/**
+ * @brief Check whether a configuration is the one the simulator was built with
+ *
+ * @param config  Configuration
+ * @return true if it equals default_pipeline_config()
+ */
+bool is_default_pipeline_config(const PipelineConfig *config) {
+  PipelineConfig defaults;
+  default_pipeline_config(&defaults);
+  for (int stage = IF; stage < NUM_STAGES; stage++) {
+    if (config->cycles[stage] != defaults.cycles[stage]) return false;
+  }
+  return config->mul_cycles == defaults.mul_cycles;
+}
+
+/**
+ * @brief Parse a stage configuration: comma-separated key=value pairs, any of which can be left out
+ *
+ * if=1,ex=1,mem=1,mul=1
+ *
+ * @param spec    Description
+ * @param config  Parsed configuration, starting from the build-time defaults
+ * @return true if spec is valid
+ */
+bool parse_pipeline_config(const char *spec, PipelineConfig *config) {
+  default_pipeline_config(config);
+
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer), "%s", spec);
+  char *save = NULL;
+  for (char *item = strtok_r(buffer, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    char *value = strchr(item, '=');
+    if (value == NULL) return false;
+    *value++ = '\0';
+
+    char *end;
+    unsigned long number = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || number < 1) return false;
+
+    if (strcmp(item, "if") == 0 && number <= PIPELINE_MAX_STAGE_CYCLES) {
+      config->cycles[IF] = number;
+    } else if (strcmp(item, "ex") == 0 && number <= PIPELINE_MAX_STAGE_CYCLES) {
+      config->cycles[EX] = number;
+    } else if (strcmp(item, "mem") == 0 && number <= PIPELINE_MAX_STAGE_CYCLES) {
+      config->cycles[MEM] = number;
+    } else if (strcmp(item, "mul") == 0 && number <= PIPELINE_MAX_MUL_CYCLES) {
+      config->mul_cycles = number;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Lay the physical stages out for a stage configuration. Stall, forwarding and flush distances
+ * all follow from this layout. Only an empty pipeline can be reconfigured.
+ *
+ * @param p       Pipeline
+ * @param config  Valid configuration
+ */
+void configure_pipeline(Pipeline *p, const PipelineConfig *config) {
+  p->config = *config;
+  p->depth = 0;
+  for (int stage = IF; stage < NUM_STAGES; stage++) {
+    p->first[stage] = p->depth;
+    for (int i = 0; i < config->cycles[stage]; i++) p->kind[p->depth++] = stage;
+    p->work[stage] = stage == IF ? p->first[stage] : p->depth - 1;
+  }
+}
+
+/**
+ * @brief Print a stage configuration, e.g. "IF 2, ID 1, EX 1, MEM 2, WB 1 (7 stages), MUL/MULI 3 cycles in EX"
+ *
+ * @param config  Configuration
+ * @param file    Output file
+ */
+void print_pipeline_config(const PipelineConfig *config, FILE *file) {
+  static const char *names[] = {"IF", "ID", "EX", "MEM", "WB"};
+  uint32_t depth = 0;
+  for (int stage = IF; stage < NUM_STAGES; stage++) {
+    fprintf(file, "%s%s %u", stage == IF ? "" : ", ", names[stage], config->cycles[stage]);
+    depth += config->cycles[stage];
+  }
+  fprintf(file, " (%u stages), MUL/MULI %u cycle%s in EX\n", depth, config->mul_cycles, config->mul_cycles == 1 ? "" : "s");
+}
+
+/**
+ * @brief Cycles an instruction spends in the last EX stage of a pipelined mode
+ *
+ * @param p     Pipeline
+ * @param instr Decoded instruction
+ * @return Cycles, 1 unless it is a multi-cycle multiply
+ */
+uint8_t execute_cycles(const Pipeline *p, const Instruction *instr) {
+  return instr->opcode == MUL || instr->opcode == MULI ? p->config.mul_cycles : 1;
+}
+
+/**
+ * @brief Check that no instruction occupies a range of physical stages
+ *
+ * @param p     Pipeline
+ * @param from  First physical stage
+ * @param to    Last physical stage (inclusive)
+ * @return true if every stage in the range is empty
+ */
+bool pipeline_range_empty(Pipeline *p, uint8_t from, uint8_t to) {
+  for (int i = from; i <= to; i++) {
+    if (p->stages[i] != NULL) return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Check whether the instruction in ID may still be squashed: an older branch, JR or HALT, or an invalid
+ * word, sits in an EX stage before the one that executes it. Only a split EX has such stages.
+ *
+ * @param p Pipeline
+ * @return true if the instruction in ID is on a path that is not known to be taken yet
+ */
+bool may_be_squashed(const Pipeline *p) {
+  for (int i = p->first[EX]; i < p->work[EX]; i++) {
+    const Instruction *instr = p->stages[i];
+    if (instr != NULL && instr->stage != DONE && (instr->type == J_TYPE || instr->invalid)) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Take a cleared instruction slot from the pipeline's pool
+ *
+ * @param p Pipeline
+ * @return Instruction slot, or NULL if every slot is in flight
+ */
+Instruction *alloc_instruction(Pipeline *p) {
+  if (p->num_free == 0) {
+    return NULL;
+  }
+  Instruction *instr = p->free_slots[--p->num_free];
+  memset(instr, 0, sizeof(Instruction));
+  return instr;
+}
+
+/**
+ * @brief Return an instruction slot to the pipeline's pool
+ *
+ * @param p     Pipeline
+ * @param instr Instruction slot to release
+ */
+void release_instruction(Pipeline *p, Instruction *instr) {
+  p->free_slots[p->num_free++] = instr;
 }
 
 /**
@@ -32,20 +208,20 @@ void init_pipeline(Pipeline *p, bool is_pipelined) {
  * @param instr Instruction to fetch
  */
 void fetch_instruction(Pipeline *p, Instruction *instr) {
-  if (p->stages[IF] == NULL) {
-    p->stages[IF] = instr;
+  if (p->stages[p->work[IF]] == NULL) {
+    p->stages[p->work[IF]] = instr;
   }
 }
 
 /**
- * @brief Peek at the instruction in a pipeline stage
+ * @brief Peek at the instruction a pipeline stage works on (see Pipeline.work)
  *
  * @param p     Pipeline
  * @param stage Pipeline stage
  * @return Instruction in the stage
  */
 Instruction *peek_pipeline_stage(Pipeline *p, PipelineStage stage) {
-  return p->stages[stage];
+  return p->stages[p->work[stage]];
 }
 
 /**
@@ -54,55 +230,114 @@ Instruction *peek_pipeline_stage(Pipeline *p, PipelineStage stage) {
  * @param p Pipeline
  */
 void print_pipeline_state(Pipeline *p) {
-  for (int i = 0; i < NUM_STAGES; i++) {
-    Instruction *instr = peek_pipeline_stage(p, i);
+  for (int i = 0; i < p->depth; i++) {
+    Instruction *instr = p->stages[i];
     if (instr != NULL) {
-      LOG("%s: %08x \t", stage_names[i], instr->instruction);
+      LOG("%s: %08x \t", stage_names[p->kind[i]], instr->instruction);
     } else {
-      LOG("%s: -------- \t", stage_names[i]);
+      LOG("%s: -------- \t", stage_names[p->kind[i]]);
     }
   }
   LOG("\n");
 }
 
 /**
- * @brief Advance the pipeline by moving instructions to the next stage or freeing them
+ * @brief Advance the pipeline by one cycle, in whichever way its mode advances
  *
  * @param p Pipeline
- * @return true if the pipeline is not empty
+ * @return true if the pipeline is empty
  */
 bool advance_pipeline(Pipeline *p) {
+  return p->is_pipelined ? advance_stages(p) : advance_in_place(p);
+}
+
+/**
+ * @brief Release an instruction that has written back or was flushed
+ *
+ * @param p Pipeline
+ * @param i Physical stage it occupies
+ */
+static void retire_stage(Pipeline *p, int i) {
+  LOG("===> Instruction completed: %08x\n", p->stages[i]->instruction);
+  if (p->tracer) trace_instruction(p->tracer, p->stages[i]);
+  release_instruction(p, p->stages[i]);
+  p->stages[i] = NULL;
+}
+
+/**
+ * @brief Advance a pipelined pipeline by moving instructions to the next physical stage or releasing them. A
+ * hold keeps the physical stages up to the one it applies to, and moves the pending writes of the
+ * instructions held past ID back by a step.
+ *
+ * @param p Pipeline
+ * @return true if the pipeline is empty
+ */
+bool advance_stages(Pipeline *p) {
   bool is_empty = true;
+  Instruction *issued = NULL;
 
-  for (int i = NUM_STAGES - 1; i >= 0; i--) {
-    Instruction *instr = peek_pipeline_stage(p, i);
+  // Physical stages below hold keep their instruction
+  uint8_t hold = 0;
+  if (p->fetch_busy) hold = p->work[IF] + 1;
+  if (p->is_stalled) hold = p->work[ID] + 1;
+  if (p->ex_busy) hold = p->work[EX] + 1;
+
+  for (int i = p->depth - 1; i >= 0; i--) {
+    Instruction *instr = p->stages[i];
     if (instr != NULL) {
       if (instr->stage == WB || instr->stage == DONE) {
-        LOG("===> Instruction completed: %08x\n", instr->instruction);
-        free(p->stages[i]);
-        p->stages[i] = NULL;
-        // print_pipeline_state(p);
-      } else if (p->is_stalled && instr->stage <= ID) {
+        retire_stage(p, i);
+      } else if (i < hold) {
         is_empty = false;
-        // LOG("===> Stalling %s: %08x\n", stage_names[i], instr->instruction);
+        // The multi-cycle operation holding EX delayed its own write when it executed
+        if (i >= p->first[EX] && i < p->work[EX]) delay_write(p, instr, 1);
       } else {
         is_empty = false;
-        // LOG("===> Advancing %s: %08x from %s to %s\n", stage_names[i], instr->instruction, stage_names[i], stage_names[i + 1]);
-        instr->stage += 1;
-        if (p->is_pipelined) {
-          p->stages[i + 1] = instr;
-          p->stages[i] = NULL;
-        }
+        instr->stage = p->kind[i + 1];
+        p->stages[i + 1] = instr;
+        p->stages[i] = NULL;
+        if (i + 1 == p->first[EX]) issued = instr;
       }
     }
   }
 
   p->is_stalled = false;
+  p->fetch_busy = false;
+  p->ex_busy = false;
+  p->step++;
+  if (issued != NULL) record_write(p, issued, p->first[EX]);
   return is_empty;
 }
 
 /**
- * @brief Flush the pipeline from a given stage (exclusive) to the beginning. [Only in pipelined mode]
+ * @brief Advance a non-pipelined pipeline: its single instruction, in the first physical stage, goes
+ * through the stages in place
+ *
+ * @param p Pipeline
+ * @return true if the pipeline is empty
+ */
+bool advance_in_place(Pipeline *p) {
+  bool is_empty = true;
+  Instruction *instr = p->stages[0];
+  if (instr != NULL) {
+    if (instr->stage == WB || instr->stage == DONE) {
+      retire_stage(p, 0);
+    } else {
+      is_empty = false;
+      if (!(p->fetch_busy && instr->stage == IF)) instr->stage += 1;
+    }
+  }
+
+  p->is_stalled = false;
+  p->fetch_busy = false;
+  p->ex_busy = false;
+  p->step++;
+  return is_empty;
+}
+
+/**
+ * @brief Flush the pipeline from the physical stage a given stage works on (exclusive) to the beginning.
+ * [Only in pipelined mode]
  *
  * @param p     Pipeline
  * @param stage Stage to flush from
@@ -110,13 +345,14 @@ bool advance_pipeline(Pipeline *p) {
 void flush_pipeline(Pipeline *p, PipelineStage stage) {
   if (!p->is_pipelined) return;
 
-  for (int i = stage - 1; i >= 0; i--) {
+  for (int i = p->work[stage] - 1; i >= 0; i--) {
     if (p->stages[i] != NULL) {
-      // free(p->stages[i]);
-      // p->stages[i] = NULL;
+      // Flushed slots are released by advance_stages() so the IF stage stays occupied this cycle
       p->stages[i]->stage = DONE;
     }
   }
+  // Flushed instructions that were already issued to a split EX write nothing
+  if (p->work[stage] > p->first[EX]) rebuild_scoreboard(p);
 }
 
 /**
@@ -127,4 +363,73 @@ void flush_pipeline(Pipeline *p, PipelineStage stage) {
 void stall_pipeline(Pipeline *p) {
   p->is_stalled = true;
   p->total_stalls++;
-}
\ No newline at end of file
+  if (p->tracer && p->stages[p->work[ID]]) p->stages[p->work[ID]]->trace.stalls++;
+}
+
+/**
+ * @brief Register an instruction holds in the scoreboard: its destination, or a store's data register
+ *
+ * @param instr Decoded instruction
+ * @return Register, -1 if none
+ */
+static int8_t scoreboard_register(const Instruction *instr) {
+  if (instr->invalid) return -1;
+  if (instr->type == R_TYPE) return instr->rd;
+  if (instr->type == I_TYPE_IMM || instr->type == I_TYPE_MEM) return instr->rt;
+  return -1;
+}
+
+/**
+ * @brief Record the register an instruction writes in the scoreboard, with the steps at which its result
+ * can be forwarded (once it has left the last EX stage for ALU results, the last MEM stage for loads) and
+ * reaches the register file. Both follow from the physical stages between the instruction and those stages.
+ * A store holds its data register until it reaches WB, as the reference timing has it, but never forwards it.
+ *
+ * @param p         Pipeline
+ * @param instr     Instruction, in EX or later
+ * @param position  Physical stage it occupies during the current step
+ */
+void record_write(Pipeline *p, Instruction *instr, uint8_t position) {
+  int8_t reg = scoreboard_register(instr);
+  if (reg < 0 || instr->stage > MEM) return;
+
+  uint8_t available = p->work[instr->opcode == LDW ? MEM : instr->opcode == STW ? WB : EX];
+  p->scoreboard.writes[reg] = (PendingWrite){
+      .producer = instr,
+      .forward_step = p->step + (available > position ? available - position : 0),
+      .ready_step = p->step + (p->work[WB] - position),
+  };
+  p->scoreboard.pending |= 1u << reg;
+}
+
+/**
+ * @brief Move the pending write of an instruction held in EX back by some steps
+ *
+ * @param p       Pipeline
+ * @param instr   Instruction
+ * @param cycles  Steps it is held for
+ */
+void delay_write(Pipeline *p, const Instruction *instr, uint32_t cycles) {
+  int8_t reg = scoreboard_register(instr);
+  if (reg < 0 || !(p->scoreboard.pending >> reg & 1) || p->scoreboard.writes[reg].producer != instr) return;
+  p->scoreboard.writes[reg].forward_step += cycles;
+  p->scoreboard.writes[reg].ready_step += cycles;
+}
+
+/**
+ * @brief Rebuild the scoreboard from the instructions in flight, oldest first (after a restore)
+ *
+ * @param p Pipeline
+ */
+void rebuild_scoreboard(Pipeline *p) {
+  p->scoreboard.pending = 0;
+  if (!p->is_pipelined) return;
+  for (int i = p->work[MEM]; i >= p->first[EX]; i--) {
+    Instruction *instr = p->stages[i];
+    if (instr == NULL || instr->stage != p->kind[i]) continue;
+    record_write(p, instr, i);
+    // A multi-cycle operation part way through EX stays there for its remaining cycles (advance_stages()
+    // delays the instructions it holds as it holds them)
+    if (i == p->work[EX] && instr->ex_cycles > 0) delay_write(p, instr, execute_cycles(p, instr) - instr->ex_cycles - 1);
+  }
+}
@@ -0,0 +1,177 @@
+/**
+ * @file  predictor.c
+ * @brief Branch predictors used at fetch: static not-taken and BTFN, bimodal and gshare 2-bit counters,
+ * and a direct-mapped branch target buffer
+ * @copyright Copyright (c) 2024
+ */
+
+#include "predictor.h"
+
+#include "common.h"
+
+#define TABLE_MASK ((1u << PREDICTOR_TABLE_BITS) - 1)
+#define NO_BRANCH 0xFFFFFFFFu
+
+static const char *kind_names[] = {"nt", "btfn", "bimodal", "gshare", "btb"};
+
+/**
+ * @brief Create a predictor from a "kind[:btb_entries]" description, e.g. "gshare" or "bimodal:512"
+ *
+ * @param spec  Kind (nt, btfn, bimodal, gshare or btb), optionally followed by the number of BTB entries
+ *              (a power of two). Without a BTB, BZ/BEQ targets come from the fetched word and JR is never
+ *              predicted taken.
+ * @return Predictor, or NULL if spec is invalid
+ */
+Predictor *create_predictor(const char *spec) {
+  const char *colon = strchr(spec, ':');
+  size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+  int kind = -1;
+  for (int i = PREDICT_NOT_TAKEN; i <= PREDICT_BTB; i++) {
+    if (strlen(kind_names[i]) == len && strncmp(spec, kind_names[i], len) == 0) kind = i;
+  }
+  uint32_t btb_entries = kind == PREDICT_BTB ? PREDICTOR_BTB_ENTRIES : 0;
+  if (colon != NULL) btb_entries = strtoul(colon + 1, NULL, 10);
+  if (kind < 0 || (btb_entries & (btb_entries - 1)) != 0 || (kind == PREDICT_BTB && btb_entries == 0)) return NULL;
+
+  Predictor *predictor = calloc(1, sizeof(Predictor));
+  if (predictor == NULL) return NULL;
+  predictor->kind = kind;
+  predictor->btb_entries = btb_entries;
+  if (kind == PREDICT_BIMODAL || kind == PREDICT_GSHARE) {
+    predictor->counters = malloc(1u << PREDICTOR_TABLE_BITS);
+    if (predictor->counters != NULL) memset(predictor->counters, 1, 1u << PREDICTOR_TABLE_BITS);  // Weakly not taken
+  }
+  if (btb_entries > 0) {
+    predictor->btb = malloc(btb_entries * sizeof(BTBEntry));
+    if (predictor->btb != NULL) memset(predictor->btb, 0xFF, btb_entries * sizeof(BTBEntry));
+  }
+  if ((predictor->counters == NULL && (kind == PREDICT_BIMODAL || kind == PREDICT_GSHARE)) || (predictor->btb == NULL && btb_entries > 0)) {
+    destroy_predictor(predictor);
+    return NULL;
+  }
+  return predictor;
+}
+
+/**
+ * @brief Free a predictor
+ *
+ * @param predictor Predictor
+ */
+void destroy_predictor(Predictor *predictor) {
+  if (predictor == NULL) return;
+  free(predictor->counters);
+  free(predictor->btb);
+  free(predictor);
+}
+
+/**
+ * @brief Name of the predictor's kind (as given to create_predictor)
+ */
+const char *predictor_name(const Predictor *predictor) {
+  return kind_names[predictor->kind];
+}
+
+static inline uint32_t counter_index(const Predictor *predictor, uint32_t pc, uint32_t history) {
+  uint32_t index = pc >> 2;
+  if (predictor->kind == PREDICT_GSHARE) index ^= history;
+  return index & TABLE_MASK;
+}
+
+static inline BTBEntry *btb_entry(const Predictor *predictor, uint32_t pc) {
+  return &predictor->btb[(pc >> 2) & (predictor->btb_entries - 1)];
+}
+
+/**
+ * @brief Predict the address to fetch after an instruction. Only BZ, BEQ and JR are predicted; everything
+ * else (HALT included) continues with the next instruction.
+ *
+ * @param predictor Predictor
+ * @param pc        Address of the fetched instruction
+ * @param word      Fetched instruction
+ * @param history   Global history before the prediction, to pass back to update_predictor()
+ * @return Predicted address of the next instruction
+ */
+uint32_t predict_next_pc(Predictor *predictor, uint32_t pc, int32_t word, uint32_t *history) {
+  *history = predictor->history;
+  Opcode opcode = (word >> 26) & INSTR_MASK;
+  if (opcode != BZ && opcode != BEQ && opcode != JR) return pc + 4;
+
+  bool taken;
+  switch (predictor->kind) {
+    case PREDICT_BTFN:
+      taken = opcode != JR && (int16_t)(word & 0xFFFF) < 0;
+      break;
+    case PREDICT_BIMODAL:
+    case PREDICT_GSHARE:
+      taken = predictor->counters[counter_index(predictor, pc, predictor->history)] >= 2;
+      break;
+    case PREDICT_BTB:
+      taken = true;  // If the BTB knows a target
+      break;
+    default:
+      taken = false;
+      break;
+  }
+  // Later predictions see this one, so a branch fetched before an older one resolves uses the same history
+  // it will be trained with
+  predictor->history = ((predictor->history << 1) | taken) & TABLE_MASK;
+  if (!taken) return pc + 4;
+
+  if (predictor->btb != NULL) {
+    BTBEntry *entry = btb_entry(predictor, pc);
+    return entry->pc == pc ? entry->target : pc + 4;
+  }
+  return opcode == JR ? pc + 4 : pc + ((int16_t)(word & 0xFFFF) << 2);
+}
+
+/**
+ * @brief Train the predictor with a resolved branch and count the outcome
+ *
+ * @param predictor     Predictor
+ * @param pc            Address of the branch
+ * @param history       Global history the branch was predicted with
+ * @param taken         Whether the branch was taken
+ * @param target        Address it jumped to, if taken
+ * @param mispredicted  Whether the fetched path was wrong
+ */
+void update_predictor(Predictor *predictor, uint32_t pc, uint32_t history, bool taken, uint32_t target, bool mispredicted) {
+  predictor->branches++;
+  predictor->mispredictions += mispredicted;
+
+  // The wrong-path branches are flushed: the history continues from this branch's outcome
+  if (mispredicted) predictor->history = ((history << 1) | taken) & TABLE_MASK;
+
+  if (predictor->counters != NULL) {
+    uint8_t *counter = &predictor->counters[counter_index(predictor, pc, history)];
+    if (taken && *counter < 3) (*counter)++;
+    if (!taken && *counter > 0) (*counter)--;
+  }
+
+  if (predictor->btb != NULL) {
+    BTBEntry *entry = btb_entry(predictor, pc);
+    if (taken) {
+      if (entry->pc != pc || entry->target != target) predictor->btb_misses++;
+      *entry = (BTBEntry){.pc = pc, .target = target};
+    } else if (predictor->kind == PREDICT_BTB && entry->pc == pc) {
+      entry->pc = NO_BRANCH;  // A BTB on its own predicts taken on every hit
+    }
+  }
+}
+
+/**
+ * @brief Print the accuracy and mispredictions per thousand instructions
+ *
+ * @param predictor     Predictor
+ * @param instructions  Instructions executed
+ * @param file          Output
+ */
+void print_predictor_stats(const Predictor *predictor, uint32_t instructions, FILE *file) {
+  fprintf(file, "Branch predictor: %s", predictor_name(predictor));
+  if (predictor->btb != NULL) fprintf(file, ", %u-entry BTB", predictor->btb_entries);
+  fprintf(file, "\n\\ Branches: %" PRIu64 "\n", predictor->branches);
+  fprintf(file, "\\ Mispredictions: %" PRIu64 "\n", predictor->mispredictions);
+  fprintf(file, "\\ Accuracy: %.2f%%\n", predictor->branches ? 100.0 * (predictor->branches - predictor->mispredictions) / predictor->branches : 100.0);
+  fprintf(file, "\\ MPKI: %.2f\n", instructions ? 1000.0 * predictor->mispredictions / instructions : 0.0);
+  if (predictor->btb != NULL) fprintf(file, "\\ BTB misses: %" PRIu64 "\n", predictor->btb_misses);
+}
@@ -0,0 +1,282 @@
+/**
+ * @file  profile.c
+ * @brief Hazard profiler: charges every stall cycle to the consuming PC, producing PC and register, and
+ * every branch flush to the branch PC
+ * @copyright Copyright (c) 2024
+ */
+
+#include "profile.h"
+
+#include "common.h"
+#include "decode.h"
+
+#define PROFILE_INITIAL_CAPACITY 256
+
+/**
+ * @brief Create an empty profiler
+ *
+ * @return Profiler (exits if it cannot be allocated)
+ */
+Profiler *create_profiler(void) {
+  Profiler *profiler = calloc(1, sizeof(Profiler));
+  if (profiler != NULL) {
+    profiler->capacity = PROFILE_INITIAL_CAPACITY;
+    profiler->entries = calloc(profiler->capacity, sizeof(ProfileEntry));
+  }
+  if (profiler == NULL || profiler->entries == NULL) {
+    perror("Failed to allocate profiler");
+    exit(EXIT_FAILURE);
+  }
+  return profiler;
+}
+
+/**
+ * @brief Free a profiler
+ *
+ * @param profiler Profiler
+ */
+void destroy_profiler(Profiler *profiler) {
+  if (profiler == NULL) return;
+  free(profiler->entries);
+  free(profiler);
+}
+
+static inline uint32_t hash_key(ProfileKind kind, uint32_t pc, uint32_t producer_pc, int8_t reg) {
+  uint32_t h = pc * 0x9E3779B1u ^ producer_pc * 0x85EBCA6Bu ^ (uint32_t)(reg + 1) * 0xC2B2AE35u ^ kind;
+  return h ^ (h >> 16);
+}
+
+static inline bool same_key(const ProfileEntry *entry, ProfileKind kind, uint32_t pc, uint32_t producer_pc, int8_t reg) {
+  return entry->kind == kind && entry->pc == pc && entry->producer_pc == producer_pc && entry->reg == reg;
+}
+
+/**
+ * @brief Double the table and reinsert every entry
+ *
+ * @param profiler Profiler
+ */
+static void grow_table(Profiler *profiler) {
+  uint32_t capacity = profiler->capacity * 2;
+  ProfileEntry *entries = calloc(capacity, sizeof(ProfileEntry));
+  if (entries == NULL) {
+    perror("Failed to grow profiler");
+    exit(EXIT_FAILURE);
+  }
+  for (uint32_t i = 0; i < profiler->capacity; i++) {
+    ProfileEntry *entry = &profiler->entries[i];
+    if (!entry->used) continue;
+    uint32_t slot = hash_key(entry->kind, entry->pc, entry->producer_pc, entry->reg) & (capacity - 1);
+    while (entries[slot].used) slot = (slot + 1) & (capacity - 1);
+    entries[slot] = *entry;
+  }
+  free(profiler->entries);
+  profiler->entries = entries;
+  profiler->capacity = capacity;
+}
+
+/**
+ * @brief Find the entry of a key, adding an empty one if it is new
+ *
+ * @return Entry (valid until the next call)
+ */
+static ProfileEntry *get_entry(Profiler *profiler, ProfileKind kind, uint32_t pc, uint32_t producer_pc, int8_t reg) {
+  uint32_t mask = profiler->capacity - 1;
+  uint32_t slot = hash_key(kind, pc, producer_pc, reg) & mask;
+  while (profiler->entries[slot].used) {
+    if (same_key(&profiler->entries[slot], kind, pc, producer_pc, reg)) return &profiler->entries[slot];
+    slot = (slot + 1) & mask;
+  }
+
+  // Keep the load factor at or below one half
+  if ((profiler->count + 1) * 2 > profiler->capacity) {
+    grow_table(profiler);
+    return get_entry(profiler, kind, pc, producer_pc, reg);
+  }
+  profiler->count++;
+  ProfileEntry *entry = &profiler->entries[slot];
+  *entry = (ProfileEntry){.kind = kind, .pc = pc, .producer_pc = producer_pc, .reg = reg, .used = true};
+  return entry;
+}
+
+/**
+ * @brief Charge one stall cycle to the instruction waiting in ID and the instruction it waits on
+ *
+ * @param profiler  Profiler
+ * @param consumer  Stalled instruction
+ * @param producer  Instruction that writes the register
+ * @param reg       Register
+ * @param clock     Stalled cycle
+ */
+void profile_stall(Profiler *profiler, const Instruction *consumer, const Instruction *producer, int8_t reg, uint32_t clock) {
+  ProfileEntry *entry = get_entry(profiler, PROFILE_HAZARD, consumer->pc, producer->pc, reg);
+  if (entry->cycles == 0) {
+    entry->instruction = consumer->instruction;
+    entry->producer_instruction = producer->instruction;
+  }
+  entry->cycles++;
+  profiler->stall_cycles++;
+
+  // A stall that goes on from the previous cycle is the same event
+  if (!(profiler->last_stall_clock + 1 == clock && same_key(&profiler->last_stall, PROFILE_HAZARD, consumer->pc, producer->pc, reg))) {
+    entry->events++;
+  }
+  profiler->last_stall = *entry;
+  profiler->last_stall_clock = clock;
+}
+
+/**
+ * @brief Count an executed branch. A branch that flushes the pipeline (every taken branch, or every
+ * misprediction with a predictor) is charged the instructions it flushes plus the cycle the clock skips.
+ *
+ * @param profiler  Profiler
+ * @param p         Pipeline, just flushed if the branch flushed it
+ * @param branch    Branch instruction (in EX)
+ * @param taken     Whether the branch was taken
+ * @param flush     Whether it flushed the pipeline
+ */
+void profile_branch(Profiler *profiler, Pipeline *p, const Instruction *branch, bool taken, bool flush) {
+  ProfileEntry *entry = get_entry(profiler, PROFILE_BRANCH, branch->pc, 0, -1);
+  if (entry->executions == 0) entry->instruction = branch->instruction;
+  entry->executions++;
+  entry->taken += taken;
+  if (!flush) return;
+
+  uint32_t flushed = 0;
+  for (int i = 0; i < p->work[EX]; i++) {
+    if (p->is_pipelined && p->stages[i] != NULL && p->stages[i]->stage == DONE) flushed++;
+  }
+  entry->events++;
+  entry->flushed += flushed;
+  entry->cycles += flushed + 1;
+  profiler->flush_cycles += flushed + 1;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  const ProfileEntry *x = *(const ProfileEntry **)a, *y = *(const ProfileEntry **)b;
+  if (x->cycles != y->cycles) return x->cycles < y->cycles ? 1 : -1;
+  if (x->pc != y->pc) return x->pc < y->pc ? -1 : 1;
+  return x->producer_pc < y->producer_pc ? -1 : x->producer_pc > y->producer_pc;
+}
+
+/**
+ * @brief Collect the entries of one kind, most expensive first
+ *
+ * @param profiler  Profiler
+ * @param kind      Kind of entries
+ * @param count     Number of entries returned
+ * @return Array of entries (free it)
+ */
+static ProfileEntry **sorted_entries(Profiler *profiler, ProfileKind kind, uint32_t *count) {
+  ProfileEntry **sorted = malloc((profiler->count + 1) * sizeof(ProfileEntry *));
+  if (sorted == NULL) {
+    perror("Failed to sort profile");
+    exit(EXIT_FAILURE);
+  }
+  *count = 0;
+  for (uint32_t i = 0; i < profiler->capacity; i++) {
+    if (profiler->entries[i].used && profiler->entries[i].kind == kind) sorted[(*count)++] = &profiler->entries[i];
+  }
+  qsort(sorted, *count, sizeof(ProfileEntry *), compare_entries);
+  return sorted;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * part / whole : 0;
+}
+
+/**
+ * @brief Print the most expensive hazards and branches
+ *
+ * @param profiler  Profiler
+ * @param mips      MIPS simulator, after the run
+ * @param file      Output
+ */
+void print_profile(Profiler *profiler, MIPSSim *mips, FILE *file) {
+  char consumer[32], producer[32];
+  uint32_t count;
+  uint64_t cycles = mips->clock - 1;
+
+  fprintf(file, "\n======== Hazard profile ========\n");
+  fprintf(file, "Stall cycles: %" PRIu64 " (%.1f%% of %" PRIu64 " cycles)\n", profiler->stall_cycles, percent(profiler->stall_cycles, cycles), cycles);
+  fprintf(file, "Branch flush cycles: %" PRIu64 " (%.1f%%)\n", profiler->flush_cycles, percent(profiler->flush_cycles, cycles));
+
+  ProfileEntry **sorted = sorted_entries(profiler, PROFILE_HAZARD, &count);
+  if (count > 0) {
+    fprintf(file, "\nStalls by instruction pair:\n");
+    fprintf(file, "%4s %10s %7s %8s  %-32s %-32s %s\n", "#", "cycles", "%", "stalls", "consumer", "producer", "reg");
+    for (uint32_t i = 0; i < count && i < PROFILE_REPORT_ROWS; i++) {
+      ProfileEntry *e = sorted[i];
+      format_instruction(e->instruction, consumer, sizeof(consumer));
+      format_instruction(e->producer_instruction, producer, sizeof(producer));
+      fprintf(file, "%4u %10" PRIu64 " %6.1f%% %8" PRIu64 "  %08x %-23s %08x %-23s R%d\n", i + 1, e->cycles, percent(e->cycles, profiler->stall_cycles),
+              e->events, e->pc, consumer, e->producer_pc, producer, e->reg);
+    }
+    if (count > PROFILE_REPORT_ROWS) fprintf(file, "     ... %u more pairs\n", count - PROFILE_REPORT_ROWS);
+  }
+  free(sorted);
+
+  sorted = sorted_entries(profiler, PROFILE_BRANCH, &count);
+  if (count > 0) {
+    fprintf(file, "\nBranches:\n");
+    fprintf(file, "%4s %10s %7s %10s %10s %10s %8s  %s\n", "#", "cycles", "%", "executed", "taken", "flushes", "flushed", "branch");
+    for (uint32_t i = 0; i < count && i < PROFILE_REPORT_ROWS; i++) {
+      ProfileEntry *e = sorted[i];
+      format_instruction(e->instruction, consumer, sizeof(consumer));
+      fprintf(file, "%4u %10" PRIu64 " %6.1f%% %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %8" PRIu64 "  %08x %s\n", i + 1, e->cycles,
+              percent(e->cycles, profiler->flush_cycles), e->executions, e->taken, e->events, e->flushed, e->pc, consumer);
+    }
+    if (count > PROFILE_REPORT_ROWS) fprintf(file, "     ... %u more branches\n", count - PROFILE_REPORT_ROWS);
+  }
+  free(sorted);
+}
+
+/**
+ * @brief Write the whole profile as JSON, most expensive entries first
+ *
+ * @param profiler  Profiler
+ * @param mips      MIPS simulator, after the run
+ * @param filename  Output file, or "-" for stdout
+ * @return true on success, false if the file cannot be written
+ */
+bool write_profile_json(Profiler *profiler, MIPSSim *mips, const char *filename) {
+  bool to_stdout = strcmp(filename, "-") == 0;
+  FILE *file = to_stdout ? stdout : fopen(filename, "w");
+  if (!file) {
+    perror("Failed to open profile file");
+    return false;
+  }
+
+  char consumer[32], producer[32];
+  uint32_t count;
+  fprintf(file, "{\"mode\": %d, \"cycles\": %u, \"instructions\": %u, \"stall_cycles\": %" PRIu64 ", \"flush_cycles\": %" PRIu64 ",\n", mips->mode,
+          mips->clock - 1, mips->counts.total, profiler->stall_cycles, profiler->flush_cycles);
+
+  ProfileEntry **sorted = sorted_entries(profiler, PROFILE_HAZARD, &count);
+  fprintf(file, " \"hazards\": [\n");
+  for (uint32_t i = 0; i < count; i++) {
+    ProfileEntry *e = sorted[i];
+    format_instruction(e->instruction, consumer, sizeof(consumer));
+    format_instruction(e->producer_instruction, producer, sizeof(producer));
+    fprintf(file, "  {\"pc\": %u, \"instruction\": \"%s\", \"producer_pc\": %u, \"producer_instruction\": \"%s\", \"register\": %d, ", e->pc, consumer,
+            e->producer_pc, producer, e->reg);
+    fprintf(file, "\"stall_cycles\": %" PRIu64 ", \"stalls\": %" PRIu64 "}%s\n", e->cycles, e->events, i + 1 < count ? "," : "");
+  }
+  free(sorted);
+
+  sorted = sorted_entries(profiler, PROFILE_BRANCH, &count);
+  fprintf(file, " ],\n \"branches\": [\n");
+  for (uint32_t i = 0; i < count; i++) {
+    ProfileEntry *e = sorted[i];
+    format_instruction(e->instruction, consumer, sizeof(consumer));
+    fprintf(file, "  {\"pc\": %u, \"instruction\": \"%s\", \"executions\": %" PRIu64 ", \"taken\": %" PRIu64 ", \"flushes\": %" PRIu64 ", \"flushed\": %" PRIu64 ", ", e->pc,
+            consumer, e->executions, e->taken, e->events, e->flushed);
+    fprintf(file, "\"flush_cycles\": %" PRIu64 "}%s\n", e->cycles, i + 1 < count ? "," : "");
+  }
+  free(sorted);
+  fprintf(file, " ]}\n");
+
+  bool ok = !ferror(file);
+  if (to_stdout ? fflush(file) != 0 : fclose(file) != 0) ok = false;
+  if (!ok) perror("Failed to write profile");
+  return ok;
+}
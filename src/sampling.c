@@ -0,0 +1,140 @@
+/**
+ * @file  sampling.c
+ * @brief Sampled simulation: the functional engine fast-forwards between short detailed pipeline
+ * intervals, and the timing of the whole program is extrapolated from the measured intervals
+ * @copyright Copyright (c) 2024
+ */
+
+#include "sampling.h"
+
+#include <math.h>
+
+#include "common.h"
+#include "functional.h"
+#include "pipeline.h"
+
+/**
+ * @brief Two-sided 95% Student's t quantile for a number of degrees of freedom
+ *
+ * @param df Degrees of freedom
+ * @return t value (the normal quantile past 30 degrees of freedom)
+ */
+static double t_quantile(uint32_t df) {
+  static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                 2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                 2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  if (df == 0) return 0;
+  return df <= 30 ? table[df - 1] : 1.960;
+}
+
+/**
+ * @brief Simulate cycle by cycle until a number of instructions have executed or the program ends
+ *
+ * @param mips          MIPS simulator
+ * @param instructions  Instructions to execute
+ */
+static void run_detailed(MIPSSim *mips, uint64_t instructions) {
+  uint32_t start = mips->counts.total;
+  ProcessFn step = select_process(mips->mode);
+  while (!mips->done && !mips->halt && (uint32_t)(mips->counts.total - start) < instructions) {
+    step(mips);
+    if (mips->status != SIM_OK) return;
+    mips->clock++;
+    print_pipeline_state(&mips->pipeline);
+  }
+}
+
+/**
+ * @brief Half-width of the confidence interval of a ratio estimate sum(y) / sum(x) over n samples
+ *
+ * The variance of the ratio estimator is s^2 / (n * mean(x)^2), where s^2 is the sample variance of the
+ * residuals y - ratio * x, so samples of different lengths are weighted as in the estimate itself.
+ *
+ * @param ratio   Estimate, sum(y) / sum(x)
+ * @param sum_x   Sum of x
+ * @param sum_xx  Sum of x * x
+ * @param sum_yy  Sum of y * y
+ * @param sum_xy  Sum of x * y
+ * @param n       Number of samples
+ * @return Half-width of the 95% confidence interval
+ */
+static double ratio_confidence(double ratio, double sum_x, double sum_xx, double sum_yy, double sum_xy, uint32_t n) {
+  if (n < 2 || sum_x <= 0) return 0;
+  double mean_x = sum_x / n;
+  double residuals = (sum_yy - 2 * ratio * sum_xy + ratio * ratio * sum_xx) / (n - 1);
+  return residuals > 0 ? t_quantile(n - 1) * sqrt(residuals / n) / mean_x : 0;
+}
+
+/**
+ * @brief Run the program with sampled timing in the simulator's mode
+ *
+ * Every period simulates config->warmup instructions in detail to refill the pipeline, measures the next
+ * config->measure instructions, drains the pipeline and executes config->fast_forward instructions
+ * functionally. The first period starts in detail, so programs shorter than one period are timed exactly.
+ * The architectural state at the end is the same as with a full run; the clock is not, use the estimates.
+ *
+ * @param mips    MIPS simulator, loaded
+ * @param config  Interval lengths
+ * @param result  Measurements and estimates
+ */
+void run_sampled(MIPSSim *mips, const SamplingConfig *config, SamplingResult *result) {
+  memset(result, 0, sizeof(SamplingResult));
+
+  // The simulator's own counters are 32 bits wide, so only differences over one period are taken from them
+  while (!mips->done && !mips->halt && mips->status == SIM_OK) {
+    uint32_t start = mips->counts.total;
+    run_detailed(mips, config->warmup);
+
+    uint32_t clock = mips->clock, stalls = mips->pipeline.total_stalls, measured = mips->counts.total;
+    run_detailed(mips, config->measure);
+    if (mips->status != SIM_OK) break;
+
+    uint64_t instructions = (uint32_t)(mips->counts.total - measured);
+    uint64_t cycles = (uint32_t)(mips->clock - clock);
+    uint64_t stall_cycles = (uint32_t)(mips->pipeline.total_stalls - stalls);
+    if (instructions > 0) {
+      result->samples++;
+      result->measured_instructions += instructions;
+      result->measured_cycles += cycles;
+      result->measured_stalls += stall_cycles;
+      result->instructions_sq += (double)instructions * instructions;
+      result->cycles_sq += (double)cycles * cycles;
+      result->stalls_sq += (double)stall_cycles * stall_cycles;
+      result->cycles_instructions += (double)cycles * instructions;
+      result->stalls_instructions += (double)stall_cycles * instructions;
+    }
+    result->detailed_instructions += (uint32_t)(mips->counts.total - start);
+    result->instructions += (uint32_t)(mips->counts.total - start);
+    if (mips->done || mips->halt) break;
+
+    drain_pipeline(mips);
+    start = mips->counts.total;
+    run_functional_for(mips, NULL, config->fast_forward);
+    result->instructions += (uint32_t)(mips->counts.total - start);
+  }
+  if (mips->status == SIM_OK) correct_pc(mips);
+
+  // A program that ends before its first fast-forward has been timed in full
+  if (result->detailed_instructions == result->instructions && mips->status == SIM_OK) {
+    result->exact = true;
+    result->cycles = mips->clock;
+    result->stalls = mips->pipeline.total_stalls;
+    result->cpi = result->instructions > 0 ? result->cycles / result->instructions : 0;
+    return;
+  }
+
+  // CPI and stalls per instruction are both ratio estimates over the samples, with the matching variance
+  if (result->measured_instructions > 0) {
+    double measured = result->measured_instructions;
+    result->cpi = result->measured_cycles / measured;
+    result->cpi_error = ratio_confidence(result->cpi, measured, result->instructions_sq, result->cycles_sq, result->cycles_instructions,
+                                         result->samples);
+    result->cycles = result->cpi * result->instructions;
+    result->cycles_error = result->cpi_error * result->instructions;
+    double spi = result->measured_stalls / measured;
+    result->stalls = spi * result->instructions;
+    result->stalls_error = ratio_confidence(spi, measured, result->instructions_sq, result->stalls_sq, result->stalls_instructions,
+                                            result->samples) *
+                           result->instructions;
+  }
+}
@@ -0,0 +1,357 @@
+/**
+ * @file  superscalar.c
+ * @brief In-order N-wide superscalar pipeline with forwarding: every stage holds a group of up to N instructions
+ *
+ * The timing rules are those of PIPED_FWD, applied to groups: branches resolve in EX (a taken branch flushes the
+ * younger instructions, its own group's included, and costs one more cycle), and an instruction that needs a load
+ * still in EX waits one cycle. A store holds its data register as mode 2 does: an instruction reading it waits until
+ * the store reaches WB. On top of them, an instruction cannot issue with an older instruction of its group that
+ * writes one of its sources, and at most mem_ports loads and stores issue per cycle. Issue stops at the first
+ * instruction that cannot go, so instructions always issue in program order. With a width of 1 the clock and stall
+ * counts are those of mode 2.
+ * @copyright Copyright (c) 2024
+ */
+
+#include "superscalar.h"
+
+#include "common.h"
+#include "decode.h"
+#include "memory.h"
+
+/**
+ * @brief Parse an issue configuration "width[:mem_ports]"
+ *
+ * @param spec    Configuration
+ * @param config  Parsed configuration (one memory port unless given)
+ * @return true if spec is valid
+ */
+bool parse_superscalar_config(const char *spec, SuperscalarConfig *config) {
+  char *end;
+  config->width = strtoul(spec, &end, 10);
+  config->mem_ports = 1;
+  if (*end == ':') config->mem_ports = strtoul(end + 1, &end, 10);
+  return *end == '\0' && config->width >= 1 && config->width <= SUPERSCALAR_MAX_WIDTH && config->mem_ports >= 1 &&
+         config->mem_ports <= config->width;
+}
+
+/**
+ * @brief Register an instruction writes, -1 if none
+ */
+static int8_t destination(const Instruction *instr) {
+  if (instr->type == R_TYPE) return instr->rd;
+  if (instr->type == I_TYPE_IMM || instr->opcode == LDW) return instr->rt;
+  return -1;
+}
+
+/**
+ * @brief Register an instruction holds until it writes back, -1 if none: its destination, or the data register of
+ * a store, which is never written or forwarded but holds back its readers as in mode 2
+ */
+static int8_t held_register(const Instruction *instr) {
+  return instr->opcode == STW ? instr->rt : destination(instr);
+}
+
+/**
+ * @brief Registers an instruction reads in EX. A store's data register is only read in MEM, where it is
+ * forwarded from the older instructions of the group, so it never holds the store back.
+ */
+static uint32_t source_mask(const Instruction *instr) {
+  switch (instr->opcode) {
+    case LDW:
+    case STW:
+    case BZ:
+    case JR:
+      return 1u << instr->rs;
+    case BEQ:
+      return (1u << instr->rs) | (1u << instr->rt);
+    case HALT:
+      return 0;
+    default:
+      return (1u << instr->rs) | (instr->type == R_TYPE ? 1u << instr->rt : 0);
+  }
+}
+
+/**
+ * @brief Value of a register as seen by an instruction of a group: the result of the youngest older instruction
+ * of the group that writes it, or the register file
+ *
+ * @param mips    MIPS simulator
+ * @param group   Group holding the producers (the MEM group, whose results are all known by then)
+ * @param before  Number of instructions of the group older than the reader
+ * @param reg     Register
+ * @return Register value
+ */
+static int32_t forwarded_value(MIPSSim *mips, IssueGroup *group, uint32_t before, uint8_t reg) {
+  for (uint32_t i = before; i-- > 0;) {
+    Instruction *producer = group->instrs[i];
+    if (destination(producer) == reg) return producer->opcode == LDW ? producer->mdr : producer->alu_out;
+  }
+  return mips->registers[reg].value;
+}
+
+/**
+ * @brief Move the oldest instructions of a group to the end of the next stage's group
+ */
+static void move_instructions(IssueGroup *from, IssueGroup *to, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) to->instrs[to->count++] = from->instrs[i];
+  for (uint32_t i = count; i < from->count; i++) from->instrs[i - count] = from->instrs[i];
+  from->count -= count;
+}
+
+/**
+ * @brief Return the instructions of a group from a position on to the free slots
+ */
+static void release_group(Superscalar *s, IssueGroup *group, uint32_t from) {
+  for (uint32_t i = from; i < group->count; i++) {
+    s->free_slots[s->num_free++] = group->instrs[i];
+  }
+  if (group->count > from) group->count = from;
+}
+
+/**
+ * @brief Decode an instruction that has just entered ID
+ *
+ * @return false if its opcode is invalid (it is left undecoded)
+ */
+static bool decode(MIPSSim *mips, Instruction *instr) {
+  DecodedInstr *entries = get_decoded_page(&mips->memory, instr->pc / 4);
+  const DecodedInstr *decoded = lookup_decoded(&entries[(instr->pc / 4) & MEMORY_WORD_MASK], instr->instruction);
+  if (decoded == NULL) return false;
+
+  instr->opcode = decoded->opcode;
+  instr->type = decoded->type;
+  instr->rs = decoded->rs;
+  instr->rt = decoded->rt;
+  instr->rd = decoded->rd;
+  instr->imm = decoded->imm;
+  instr->stage = ID;
+  return true;
+}
+
+/**
+ * @brief Write the results of a group back in program order, so the youngest of several writers of a register wins
+ */
+static void writeback_group(MIPSSim *mips, IssueGroup *group) {
+  for (uint32_t i = 0; i < group->count; i++) {
+    Instruction *instr = group->instrs[i];
+    int8_t reg = destination(instr);
+    if (reg < 0) continue;
+    mips->registers[reg].value = instr->opcode == LDW ? instr->mdr : instr->alu_out;
+    mips->registers[reg].modified = true;
+  }
+}
+
+/**
+ * @brief Perform the loads and stores of a group in program order
+ */
+static void memory_group(MIPSSim *mips, IssueGroup *group) {
+  for (uint32_t i = 0; i < group->count; i++) {
+    Instruction *instr = group->instrs[i];
+    if (instr->opcode == LDW) {
+      instr->mdr = read_memory(&mips->memory, (uint32_t)instr->alu_out / 4);
+    } else if (instr->opcode == STW) {
+      write_memory(&mips->memory, (uint32_t)instr->alu_out / 4, forwarded_value(mips, group, i, instr->rt));
+    }
+  }
+}
+
+/**
+ * @brief Execute the EX group in program order. A taken branch squashes the rest of its group and flushes ID and
+ * IF; its target is fetched in the same cycle.
+ */
+static void execute_group(Superscalar *s, MIPSSim *mips) {
+  IssueGroup *mem = &s->stages[MEM], *ex = &s->stages[EX];
+
+  for (uint32_t i = 0; i < ex->count; i++) {
+    Instruction *instr = ex->instrs[i];
+    // Older groups have left EX: results of the MEM group are forwarded, WB has already written the register file
+    int32_t rs = forwarded_value(mips, mem, mem->count, instr->rs);
+    int32_t rt = forwarded_value(mips, mem, mem->count, instr->rt);
+    count_instruction(mips, instr->opcode);
+
+    switch (instr->type) {
+      case R_TYPE:
+        instr->alu_out = perform_operation(rs, rt, instr->opcode);
+        break;
+      case I_TYPE_IMM:
+        instr->alu_out = perform_operation(rs, instr->imm, instr->opcode);
+        break;
+      case I_TYPE_MEM:
+        instr->alu_out = rs + instr->imm;
+        break;
+      case J_TYPE:
+        instr->alu_out = (int32_t)instr->pc + (instr->imm << 2);
+        if (control_flow(mips, instr, rs, rt)) {
+          s->result->squashed += ex->count - (i + 1);
+          release_group(s, ex, i + 1);
+          release_group(s, &s->stages[ID], 0);
+          release_group(s, &s->stages[IF], 0);
+          if (mips->halt) mips->pc = instr->pc + 4;
+          mips->clock++;
+          return;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/**
+ * @brief Pick the instructions of the ID group that issue this cycle and account for the unused slots
+ *
+ * @return Number of instructions issued (the oldest ones of the group)
+ */
+static uint32_t issue_group(Superscalar *s, MIPSSim *mips) {
+  IssueGroup *id = &s->stages[ID];
+
+  // Registers whose youngest holder is a load still in EX, or a store still in EX or MEM: not ready next cycle
+  uint32_t pending_loads = 0, held_stores = 0;
+  for (int stage = MEM; stage >= EX; stage--) {
+    for (uint32_t i = 0; i < s->stages[stage].count; i++) {
+      const Instruction *instr = s->stages[stage].instrs[i];
+      int8_t reg = held_register(instr);
+      if (reg < 0) continue;
+      pending_loads &= ~(1u << reg);
+      held_stores &= ~(1u << reg);
+      if (instr->opcode == LDW && stage == EX) pending_loads |= 1u << reg;
+      if (instr->opcode == STW) held_stores |= 1u << reg;
+    }
+  }
+
+  uint32_t issued = 0, mem_used = 0, group_writes = 0;
+  LostSlotReason reason = LOST_FRONT_END;
+  for (; issued < id->count; issued++) {
+    Instruction *instr = id->instrs[issued];
+    if (instr->stage != ID && !decode(mips, instr)) {
+      // Only an error once every older instruction has executed: a taken branch may still flush it
+      if (issued == 0) sim_error(mips, SIM_ERR_INVALID_OPCODE, "Invalid opcode: %08x", instr->instruction);
+      break;
+    }
+
+    uint32_t sources = source_mask(instr);
+    bool is_memory = instr->opcode == LDW || instr->opcode == STW;
+    if (sources & group_writes) {
+      reason = LOST_GROUP;
+      break;
+    }
+    if (sources & pending_loads) {
+      reason = LOST_LOAD_USE;
+      break;
+    }
+    if (sources & held_stores) {
+      reason = LOST_STORE_DATA;
+      break;
+    }
+    if (is_memory && mem_used == s->config.mem_ports) {
+      reason = LOST_MEM_PORT;
+      break;
+    }
+    mem_used += is_memory;
+    int8_t reg = held_register(instr);
+    if (reg >= 0) group_writes |= 1u << reg;
+  }
+
+  SuperscalarResult *result = s->result;
+  result->issued += issued;
+  result->issue_cycles[issued]++;
+  result->lost_slots[reason] += id->count - issued;
+  result->lost_slots[LOST_FRONT_END] += s->config.width - id->count;
+  if (issued == 0 && (reason == LOST_LOAD_USE || reason == LOST_STORE_DATA)) mips->pipeline.total_stalls++;
+  return issued;
+}
+
+/**
+ * @brief Simulate one clock cycle: WB, MEM, EX, issue and fetch, then move the groups along
+ *
+ * @param s     Superscalar pipeline
+ * @param mips  MIPS simulator
+ */
+static void superscalar_cycle(Superscalar *s, MIPSSim *mips) {
+  IssueGroup *wb = &s->stages[WB], *mem = &s->stages[MEM], *ex = &s->stages[EX], *id = &s->stages[ID], *fetch = &s->stages[IF];
+
+  writeback_group(mips, wb);
+  memory_group(mips, mem);
+  execute_group(s, mips);
+  if (mips->halt) {
+    // The run ends in the cycle the HALT executes, but the instructions ahead of it still complete
+    writeback_group(mips, mem);
+    memory_group(mips, ex);
+    writeback_group(mips, ex);
+    return;
+  }
+
+  uint32_t issued = issue_group(s, mips);
+  if (mips->status != SIM_OK) return;
+
+  while (fetch->count < s->config.width && mips->pc / 4 < mips->memory_size) {
+    Instruction *instr = s->free_slots[--s->num_free];
+    memset(instr, 0, sizeof(Instruction));
+    instr->instruction = read_memory(&mips->memory, mips->pc / 4);
+    instr->pc = mips->pc;
+    instr->stage = IF;
+    fetch->instrs[fetch->count++] = instr;
+    mips->pc += 4;
+  }
+
+  // Whole groups move on from EX; ID keeps what did not issue and fills up with fetched instructions
+  release_group(s, wb, 0);
+  move_instructions(mem, wb, mem->count);
+  move_instructions(ex, mem, ex->count);
+  move_instructions(id, ex, issued);
+  uint32_t room = s->config.width - id->count;
+  move_instructions(fetch, id, fetch->count < room ? fetch->count : room);
+  mips->done = mem->count == 0 && ex->count == 0 && id->count == 0 && fetch->count == 0 && wb->count == 0;
+}
+
+/**
+ * @brief Run the program on an N-wide pipeline until it halts, drains or hits the cycle limit
+ *
+ * @param mips    MIPS simulator, in mode PIPED_SUPERSCALAR
+ * @param config  Issue width and memory ports
+ * @param result  Issue statistics
+ */
+void run_superscalar(MIPSSim *mips, const SuperscalarConfig *config, SuperscalarResult *result) {
+  Superscalar s = {.config = *config, .result = result};
+  for (uint32_t i = 0; i < NUM_STAGES * SUPERSCALAR_MAX_WIDTH; i++) {
+    s.free_slots[s.num_free++] = &s.slots[i];
+  }
+  memset(result, 0, sizeof(SuperscalarResult));
+
+  while (!mips->done && !mips->halt) {
+    superscalar_cycle(&s, mips);
+    if (mips->status != SIM_OK) return;
+    mips->clock++;
+    if (mips->cycle_limit && mips->clock > mips->cycle_limit) {
+      sim_error(mips, SIM_ERR_CYCLE_LIMIT, "Cycle limit of %u reached", mips->cycle_limit);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Print IPC, issue slot utilisation and where the unused slots went
+ *
+ * @param mips    MIPS simulator, after run_superscalar()
+ * @param config  Issue width and memory ports
+ * @param result  Issue statistics
+ * @param file    Output
+ */
+void print_superscalar_stats(MIPSSim *mips, const SuperscalarConfig *config, const SuperscalarResult *result, FILE *file) {
+  static const char *reasons[] = {"front end", "load-use", "store data", "dependent in group", "memory ports"};
+  uint64_t cycles = mips->clock - 1;
+  uint64_t slots = 0;  // Slots of the cycles that reached issue (not the extra cycle of a taken branch)
+  for (uint32_t k = 0; k <= config->width; k++) slots += result->issue_cycles[k] * config->width;
+
+  fprintf(file, "Issue width: %u (%u memory port%s)\n", config->width, config->mem_ports, config->mem_ports > 1 ? "s" : "");
+  fprintf(file, "\\ IPC: %.3f\n", cycles ? (double)mips->counts.total / cycles : 0.0);
+  fprintf(file, "\\ Issue slot utilisation: %.1f%% (%" PRIu64 " of %" PRIu64 " slots, %" PRIu64 " squashed by taken branches)\n",
+          slots ? 100.0 * result->issued / slots : 0.0, result->issued, slots, result->squashed);
+  fprintf(file, "\\ Cycles issuing");
+  for (uint32_t k = 0; k <= config->width; k++) fprintf(file, " %u: %" PRIu64 "%s", k, result->issue_cycles[k], k < config->width ? "," : "\n");
+  fprintf(file, "\\ Unused slots:");
+  for (int r = 0; r < NUM_LOST_REASONS; r++) {
+    fprintf(file, " %s %" PRIu64 " (%.1f%%)%s", reasons[r], result->lost_slots[r], slots ? 100.0 * result->lost_slots[r] / slots : 0.0,
+            r < NUM_LOST_REASONS - 1 ? "," : "\n");
+  }
+}
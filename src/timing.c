@@ -0,0 +1,177 @@
+/**
+ * @file  timing.c
+ * @brief Timing models driven by the functional core's retired-instruction stream
+ *
+ * Each model reproduces the clock and stall counts process() reports for its mode, from the
+ * instructions in program order alone, so one functional run can time all modes at once.
+ * @copyright Copyright (c) 2024
+ */
+
+#include "timing.h"
+#include "common.h"
+
+/* Cycles an instruction spends in the non-pipelined datapath, and the cycles of a final HALT */
+#define NOT_PIPED_CYCLES NUM_STAGES
+#define NOT_PIPED_HALT_CYCLES 3
+
+/**
+ * @brief Non-pipelined timing: every instruction goes through all five stages before the next one is fetched
+ *
+ * @param model Timing model
+ * @param instr Retired instruction
+ */
+static void not_piped_retire(TimingModel *model, const RetiredInstr *instr) {
+  model->instructions++;
+  if (instr->taken) model->taken++;
+}
+
+static void not_piped_finish(TimingModel *model, bool halted) {
+  model->clock = 1 + model->instructions * NOT_PIPED_CYCLES + model->taken;
+  if (halted) model->clock -= NOT_PIPED_CYCLES - NOT_PIPED_HALT_CYCLES;
+  if (model->instructions == 0) model->clock++;  // The cycle that finds nothing to fetch, as in piped_finish()
+  model->stalls = 0;
+}
+
+/**
+ * @brief Check whether an instruction sitting in ID has a RAW hazard in the given cycle, with the same
+ * rules as check_hazards(): each register it reads waits on its youngest producer in EX or MEM, and the
+ * instruction stalls if any of them cannot forward yet
+ *
+ * @param model Timing model
+ * @param instr Instruction in ID
+ * @param cycle Cycle to check
+ * @return true if the instruction stalls in that cycle
+ */
+static bool has_hazard(TimingModel *model, const RetiredInstr *instr, uint64_t cycle) {
+  // A store's data register is read in MEM, once the instructions ahead of it have written back
+  uint32_t sources = instr->opcode == STW ? 1u << instr->rs : instr->reads;
+  for (int stage = EX; stage < WB; stage++) {
+    const TimedInstr *producer = NULL;
+    for (int i = 0; i < 2; i++) {
+      if (model->recent[i].hazard_reg >= 0 && model->recent[i].ex_cycle + (stage - EX) == cycle) {
+        producer = &model->recent[i];
+      }
+    }
+    if (producer == NULL || !(sources >> producer->hazard_reg & 1)) continue;
+    sources &= ~(1u << producer->hazard_reg);  // An older producer of the same register is not waited on
+
+    bool forwards = model->mode == PIPED_FWD &&
+                    (producer->type == R_TYPE || producer->type == I_TYPE_IMM || (producer->opcode == LDW && stage == MEM));
+    if (!forwards) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Pipelined timing: tracks the cycle each instruction reaches EX
+ *
+ * An instruction enters ID once it has been fetched and its predecessor has moved on to EX, and stays there
+ * while it has a hazard. The next instruction is fetched as soon as IF is free, or in the cycle a taken branch
+ * executes (at its target). A taken branch also adds one cycle to the clock, like execute_stage() does.
+ *
+ * @param model Timing model
+ * @param instr Retired instruction
+ */
+static void piped_retire(TimingModel *model, const RetiredInstr *instr) {
+  uint64_t id_cycle = model->fetch_cycle + 1;
+  if (model->last_ex_cycle > id_cycle) id_cycle = model->last_ex_cycle;
+
+  uint64_t cycle = id_cycle;
+  while (has_hazard(model, instr, cycle)) {
+    cycle++;
+    model->stalls++;
+  }
+  uint64_t ex_cycle = cycle + 1;
+
+  if (instr->taken) {
+    model->taken++;
+    model->fetch_cycle = ex_cycle;
+  } else {
+    model->fetch_cycle = id_cycle;
+  }
+
+  model->recent[1] = model->recent[0];
+  model->recent[0] = (TimedInstr){
+      .ex_cycle = ex_cycle,
+      .hazard_reg = (instr->type == J_TYPE) ? -1 : (instr->type == R_TYPE) ? instr->rd : instr->rt,
+      .type = instr->type,
+      .opcode = instr->opcode,
+  };
+  model->last_ex_cycle = ex_cycle;
+  model->instructions++;
+}
+
+static void piped_finish(TimingModel *model, bool halted) {
+  // A HALT ends the simulation in the cycle it executes; otherwise the last instruction drains through WB
+  uint64_t cycles = halted ? model->last_ex_cycle : model->last_ex_cycle + 2;
+  if (model->instructions == 0) cycles = 1;
+  model->clock = 1 + cycles + model->taken;
+}
+
+/**
+ * @brief Initialize a timing model for a mode
+ *
+ * @param model Timing model
+ * @param mode  Mode to model
+ */
+void init_timing_model(TimingModel *model, Mode mode) {
+  static const char *names[] = {"Non-pipelined", "Pipelined without forwarding", "Pipelined with forwarding"};
+
+  memset(model, 0, sizeof(TimingModel));
+  model->name = names[mode];
+  model->mode = mode;
+  model->retire = (mode == NOT_PIPED) ? not_piped_retire : piped_retire;
+  model->finish = (mode == NOT_PIPED) ? not_piped_finish : piped_finish;
+  model->fetch_cycle = 1;  // The first instruction is fetched in the first cycle
+  model->recent[0].hazard_reg = model->recent[1].hazard_reg = -1;
+}
+
+/**
+ * @brief Initialize an empty retired-instruction stream
+ *
+ * @param stream  Retire stream
+ */
+void init_retire_stream(RetireStream *stream) {
+  stream->count = 0;
+  stream->num_models = 0;
+}
+
+/**
+ * @brief Attach a timing model to a stream
+ *
+ * @param stream  Retire stream
+ * @param model   Timing model
+ */
+void attach_timing_model(RetireStream *stream, TimingModel *model) {
+  if (stream->num_models < MAX_TIMING_MODELS) {
+    stream->models[stream->num_models++] = model;
+  }
+}
+
+/**
+ * @brief Hand the buffered instructions to every attached model and empty the buffer
+ *
+ * @param stream  Retire stream
+ */
+void flush_retire_stream(RetireStream *stream) {
+  for (int m = 0; m < stream->num_models; m++) {
+    TimingModel *model = stream->models[m];
+    for (uint32_t i = 0; i < stream->count; i++) {
+      model->retire(model, &stream->buffer[i]);
+    }
+  }
+  stream->count = 0;
+}
+
+/**
+ * @brief Flush the stream and let every model compute its final results
+ *
+ * @param stream  Retire stream
+ * @param halted  Whether the program ended with a HALT
+ */
+void finish_retire_stream(RetireStream *stream, bool halted) {
+  flush_retire_stream(stream);
+  for (int m = 0; m < stream->num_models; m++) {
+    stream->models[m]->finish(stream->models[m], halted);
+  }
+}
@@ -0,0 +1,140 @@
+/**
+ * @file  trace.c
+ * @brief Per-instruction pipeline trace, written as fixed-size binary records through a large buffer
+ * @copyright Copyright (c) 2024
+ */
+
+#include "trace.h"
+
+#include "common.h"
+
+/**
+ * @brief Write the buffered records to the trace file
+ *
+ * @param tracer Tracer
+ */
+static void flush_records(Tracer *tracer) {
+  if (tracer->count > 0 && fwrite(tracer->records, sizeof(TraceRecord), tracer->count, tracer->file) != tracer->count) {
+    tracer->ok = false;
+  }
+  tracer->count = 0;
+}
+
+/**
+ * @brief Create a trace file and write its header
+ *
+ * @param filename  Trace file
+ * @param mode      Simulation mode (recorded in the header)
+ * @return Tracer, or NULL if the file cannot be created
+ */
+Tracer *open_trace(const char *filename, int mode) {
+  Tracer *tracer = calloc(1, sizeof(Tracer));
+  if (tracer == NULL) return NULL;
+  tracer->records = malloc(TRACE_BUFFER_RECORDS * sizeof(TraceRecord));
+  tracer->file = fopen(filename, "wb");
+  if (tracer->records == NULL || tracer->file == NULL) {
+    perror("Failed to open trace file");
+    if (tracer->file) fclose(tracer->file);
+    free(tracer->records);
+    free(tracer);
+    return NULL;
+  }
+
+  TraceHeader header = {.version = TRACE_VERSION, .mode = mode};
+  memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  tracer->ok = fwrite(&header, sizeof(header), 1, tracer->file) == 1;
+  tracer->next_seq = 0;
+  return tracer;
+}
+
+/**
+ * @brief Cycles from an instruction's fetch to a later cycle, saturated below TRACE_NONE
+ */
+static inline uint16_t trace_offset(uint32_t fetch, uint32_t cycle) {
+  return cycle - fetch < TRACE_NONE ? cycle - fetch : TRACE_NONE - 1;
+}
+
+/**
+ * @brief Record an instruction leaving the pipeline
+ *
+ * @param tracer  Tracer
+ * @param instr   Instruction, completed, flushed or squashed (skipped if fetched before tracing started)
+ */
+void trace_instruction(Tracer *tracer, const Instruction *instr) {
+  const InstrTrace *t = &instr->trace;
+  if (t->cycles[IF] == 0) return;
+
+  TraceRecord *record = &tracer->records[tracer->count];
+  *record = (TraceRecord){.seq = t->seq, .pc = instr->pc, .instruction = instr->instruction, .fetch_cycle = t->cycles[IF],
+                          .stalls = t->stalls, .flags = t->flags, .forward_stage = t->forward_stage};
+
+  uint32_t end = t->end_cycle ? t->end_cycle : t->cycles[IF];
+  for (int i = ID; i < NUM_STAGES; i++) {
+    record->stage_offset[i - 1] = t->cycles[i] ? trace_offset(t->cycles[IF], t->cycles[i]) : TRACE_NONE;
+    if (!t->end_cycle && t->cycles[i]) end = t->cycles[i];
+  }
+  record->end_offset = trace_offset(t->cycles[IF], end);
+
+  if (++tracer->count == TRACE_BUFFER_RECORDS) flush_records(tracer);
+}
+
+/**
+ * @brief Mark the instructions just flushed or squashed (stage DONE) as leaving the pipeline this cycle
+ *
+ * @param p     Pipeline
+ * @param clock Current cycle
+ * @param flag  TRACE_FLUSHED or TRACE_SQUASHED
+ */
+void trace_flush(Pipeline *p, uint32_t clock, uint8_t flag) {
+  for (int i = 0; i < p->depth; i++) {
+    Instruction *instr = p->stages[i];
+    if (instr != NULL && instr->stage == DONE && instr->trace.end_cycle == 0) {
+      instr->trace.flags |= flag;
+      instr->trace.end_cycle = clock;
+    }
+  }
+}
+
+/**
+ * @brief Record the stage every instruction in flight occupies this cycle. The stage functions only see the
+ * physical stage they work on, which is not the first one of a stage split into several. Instructions fetched
+ * before tracing started are left out, as in trace_instruction().
+ *
+ * @param p     Pipeline
+ * @param clock Current cycle
+ */
+void trace_stages(Pipeline *p, uint32_t clock) {
+  for (int i = 0; i < p->depth; i++) {
+    Instruction *instr = p->stages[i];
+    if (instr != NULL && instr->stage != DONE && instr->trace.cycles[IF] != 0) trace_stage(p, instr, instr->stage, clock);
+  }
+}
+
+/**
+ * @brief Record the instructions still in the pipeline, write the buffered records and close the trace.
+ * An instruction that has already written back is recorded as completed; the others as in flight.
+ *
+ * @param tracer  Tracer (freed)
+ * @param p       Pipeline the tracer is attached to (detached)
+ * @param clock   Clock at the end of the run (one past the last simulated cycle)
+ * @return true if the whole trace was written
+ */
+bool close_trace(Tracer *tracer, Pipeline *p, uint32_t clock) {
+  for (int i = p->depth - 1; i >= 0; i--) {
+    Instruction *instr = p->stages[i];
+    if (instr == NULL) continue;
+    if (instr->trace.cycles[WB] == 0 && instr->trace.end_cycle == 0) {
+      instr->trace.flags |= TRACE_IN_FLIGHT;
+      instr->trace.end_cycle = clock - 1;
+    }
+    trace_instruction(tracer, instr);
+  }
+  p->tracer = NULL;
+
+  flush_records(tracer);
+  bool ok = tracer->ok && fclose(tracer->file) == 0;
+  if (!ok) perror("Failed to write trace file");
+  free(tracer->records);
+  free(tracer);
+  return ok;
+}
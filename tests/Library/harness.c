@@ -0,0 +1,73 @@
+/**
+ * @file  harness.c
+ * @brief Runs a memory image through libmipssim and prints what the library reports. The images of this suite
+ * loop back to byte 8, where mipssim_run_until() stops on every iteration.
+ * @copyright Copyright (c) 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mipssim.h"
+
+/**
+ * @brief Print the status of a call and the simulator's statistics after it
+ *
+ * @param sim     Simulator
+ * @param call    Name of the call
+ * @param status  Status it returned
+ */
+static void report(MipsSimHandle *sim, const char *call, MipsSimStatus status) {
+  MipsSimStats stats;
+  mipssim_get_stats(sim, &stats);
+  printf("%s: %s, clock %u, PC %u, stalls %u, instructions %u (%u/%u/%u/%u), halted %d, finished %d\n", call,
+         mipssim_status_name(status), stats.clock, stats.pc, stats.stalls, stats.instructions, stats.arithmetic, stats.logical,
+         stats.memory, stats.control, stats.halted, stats.finished);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s image mode\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  FILE *file = fopen(argv[1], "rb");
+  if (file == NULL) {
+    perror("Failed to open image");
+    return EXIT_FAILURE;
+  }
+  static char image[1 << 20];
+  size_t size = fread(image, 1, sizeof(image), file);
+  fclose(file);
+
+  MipsSimHandle *sim;
+  MipsSimStatus status = mipssim_create(image, size, atoi(argv[2]), &sim);
+  if (status != MIPSSIM_OK) {
+    printf("mipssim_create: %s\n", mipssim_status_name(status));
+    return EXIT_FAILURE;
+  }
+  mipssim_set_cycle_limit(sim, 120);
+
+  while ((status = mipssim_run_until(sim, 8)) == MIPSSIM_OK) report(sim, "mipssim_run_until(8)", status);
+  report(sim, "mipssim_run_until(8)", status);
+  report(sim, "mipssim_run_cycles(5)", mipssim_run_cycles(sim, 5));
+  report(sim, "mipssim_run", mipssim_run(sim));
+  if (status != MIPSSIM_FINISHED) printf("Error: %s\n", mipssim_error(sim));
+
+  printf("Registers:");
+  for (unsigned reg = 0; reg < 32; reg++) {
+    int32_t value;
+    if (mipssim_read_register(sim, reg, &value) == MIPSSIM_OK && value != 0) printf(" [%u:%d]", reg, value);
+  }
+  printf("\nMemory:");
+  for (uint32_t address = 0; address < 64; address += 4) {
+    int32_t value;
+    if (mipssim_read_memory(sim, address, &value) == MIPSSIM_OK) printf(" %d", value);
+  }
+  printf("\nRegister 32: %s\n", mipssim_status_name(mipssim_read_register(sim, 32, &(int32_t){0})));
+  printf("Unaligned read: %s\n", mipssim_status_name(mipssim_read_memory(sim, 2, &(int32_t){0})));
+  mipssim_destroy(sim);
+
+  printf("Mode 3: %s\n", mipssim_status_name(mipssim_create(image, size, 3, &sim)));
+  printf("Cut-short binary image: %s\n", mipssim_status_name(mipssim_create("MIPSIMG", 8, 2, &sim)));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+#!/bin/bash
+# Runs every test suite under tests/ and compares the output of each N.txt with N_results.txt.
+# Usage: tests/run_tests.sh [suite ...]   (from the repository root, after make and make lib)
+#
+# Pipeline_No_Forward holds the original reference traces of a DEBUG build and is not run here.
+
+SIM=${SIM:-./mips_sim}
+TESTS=$(dirname "$0")
+WORK=$(mktemp -d)
+trap '[ -n "$DAEMON" ] && kill $DAEMON; rm -rf "$WORK"' EXIT
+
+passed=0
+failed=0
+
+# check <name> <expected file> <actual file>
+check() {
+  if cmp -s "$2" "$3"; then
+    passed=$((passed + 1))
+  else
+    failed=$((failed + 1))
+    echo "FAIL $1"
+    diff "$2" "$3" | head -20
+  fi
+}
+
+# A store over a word that was already decoded must be seen by the next fetch of that word
+suite_Decode_Cache() {
+  for mode in 0 1 2; do
+    "$SIM" -f "$1" -m $mode -c 100000
+  done > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# Engines 1 and 2 must produce the mode 0 results
+suite_Functional() {
+  for engine in 0 1 2; do
+    "$SIM" -f "$1" -m 0 -e $engine -c 100000 > "$WORK/out" 2>&1
+    check "$1 -e $engine" "$2" "$WORK/out"
+  done
+}
+
+# The clock and stalls of -a are followed by those of separate runs of each mode, which must be the same
+suite_All_Modes() {
+  "$SIM" -f "$1" -a -c 100000 > "$WORK/out" 2>&1
+  for mode in 0 1 2; do
+    "$SIM" -f "$1" -m $mode -c 100000 2>&1 | grep -E '^Total (clock cycles|Stalls):'
+  done >> "$WORK/out"
+  check "$1" "$2" "$WORK/out"
+}
+
+# A run resumed from a checkpoint saved at cycle 10, with instructions in flight, must end as the
+# uninterrupted run. The checkpoint cut short, and one taken with a cache, must be rejected.
+suite_Checkpoint() {
+  rm -f "$WORK/ckpt"
+  "$SIM" -f "$1" -m 2 -c 100000 -s 10:"$WORK/ckpt" > /dev/null 2>&1
+  "$SIM" -r "$WORK/ckpt" -c 100000 > "$WORK/out" 2>&1
+  head -c 6000 "$WORK/ckpt" > "$WORK/short"
+  "$SIM" -r "$WORK/short" 2>&1 | sed "s|$WORK/||" >> "$WORK/out"
+  "$SIM" -f "$1" -m 2 -D "" -s 10:"$WORK/ckpt" >> "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# The binary image made by -x must run as the text image, from a file and from stdin, and be rejected
+# once cut short
+suite_Image() {
+  "$SIM" -f "$1" -x "$WORK/image.bin" > /dev/null 2>&1
+  head -c 30 "$WORK/image.bin" > "$WORK/short.bin"
+  {
+    "$SIM" -f "$WORK/image.bin" -m 2 -c 100000
+    "$SIM" -f - -m 2 -c 100000 < "$WORK/image.bin"
+    "$SIM" -f "$WORK/short.bin" -m 2 2>&1 | sed "s|$WORK/||"
+  } > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# N.txt is a manifest of images under images/, run with a limit of 60 cycles. The results hold the CSV
+# report with the exit status, then the JSON report of a successful batch.
+suite_Batch() {
+  "$SIM" -b "$1" -j 2 -c 60 > "$WORK/out" 2>&1
+  echo "exit $?" >> "$WORK/out"
+  "$SIM" -b "$1" -j 2 -c 60 -o "$WORK/out.json" > /dev/null 2>&1 && cat "$WORK/out.json" >> "$WORK/out"
+  check "$1" "$2" "$WORK/out"
+}
+
+# Several samples in mode 2, a single one in mode 1, then the full mode 2 run the estimates are checked against
+suite_Sampling() {
+  {
+    "$SIM" -f "$1" -m 2 -S 200:20:50 -c 100000
+    "$SIM" -f "$1" -m 1 -S 100000:20:50 -c 100000 | sed -n '2,5p'
+    "$SIM" -f "$1" -m 2 -c 100000 | sed -n '2,4p'
+  } > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# The text view of the trace in every mode; a traced run must print what an untraced one does
+suite_Trace() {
+  for mode in 0 1 2; do
+    "$SIM" -f "$1" -m $mode -c 100000 > "$WORK/plain" 2>&1
+    "$SIM" -f "$1" -m $mode -c 100000 -t "$WORK/trace.bin" 2>&1 | cmp -s - "$WORK/plain" || echo "mode $mode: output changed by -t"
+    python3 "$TESTS/../trace_view.py" "$WORK/trace.bin" --text
+  done > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# The profile printed after the results and the JSON written by -p, in modes 1 and 2
+suite_Profile() {
+  for mode in 1 2; do
+    "$SIM" -f "$1" -m $mode -c 100000 -p "$WORK/profile.json"
+    cat "$WORK/profile.json"
+  done > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# Every predictor in mode 2 and one in mode 1. The clock of a run without -B comes first: nt must match it.
+suite_Predictor() {
+  {
+    "$SIM" -f "$1" -m 2 -c 100000 | sed -n '2p'
+    for predictor in nt btfn bimodal gshare btb:16 bimodal:2; do
+      "$SIM" -f "$1" -m 2 -c 100000 -B $predictor
+    done
+    "$SIM" -f "$1" -m 1 -c 100000 -B gshare:16
+  } > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# Default, conflicting, write-through and FIFO caches in mode 2, and the default D-cache in mode 0. The
+# registers and memory must be those of a run without caches.
+suite_Cache() {
+  {
+    "$SIM" -f "$1" -m 2 -c 100000 -D ""
+    "$SIM" -f "$1" -m 2 -c 100000 -D size=64,assoc=1
+    "$SIM" -f "$1" -m 2 -c 100000 -D write=wt
+    "$SIM" -f "$1" -m 2 -c 100000 -I size=64,assoc=1 -D size=1k,line=32,miss=20,policy=fifo
+    "$SIM" -f "$1" -m 0 -c 100000 -D ""
+  } > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# Widths 1, 2 and 4 with two memory ports, then the clock and stalls of mode 2, which -w 1 must match
+suite_Superscalar() {
+  for width in 1 2 4:2; do
+    "$SIM" -f "$1" -m 3 -w $width -c 100000
+  done > "$WORK/out" 2>&1
+  "$SIM" -f "$1" -m 2 -c 100000 2>&1 | grep -E '^Total (clock cycles|Stalls):' >> "$WORK/out"
+  check "$1" "$2" "$WORK/out"
+}
+
+# Mode 2 with the five stages, then modes 1 and 2 with MEM, EX and every stage split: the registers and memory
+# must stay those of the five-stage pipeline
+suite_Pipeline_Depth() {
+  {
+    "$SIM" -f "$1" -m 2 -c 100000
+    for mode in 1 2; do
+      for config in mem=2 ex=2 if=2,ex=3,mem=2,mul=4; do
+        "$SIM" -f "$1" -m $mode -P $config -c 100000
+      done
+    done
+  } > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# Two cores on a copy of the image, one starting at 0 and one at 24, with stores exchanged after every cycle
+# and after 1000 cycles, then with the second core naming the image itself
+suite_Multicore() {
+  cp "$1" "$WORK/image.txt"
+  {
+    "$SIM" -f "$WORK/image.txt" -n @0,@24 -m 2 -q 1 -c 100000
+    "$SIM" -f "$WORK/image.txt" -n @0,@24 -m 2 -q 1000 -c 100000
+    "$SIM" -f "$WORK/image.txt" -n @0,"$WORK/image.txt"@24 -m 1 -q 5 -c 100000
+  } 2>&1 | sed "s|$WORK/||g" > "$WORK/out"
+  check "$1" "$2" "$WORK/out"
+}
+
+# The functional engine against mode 2 at every instruction, the JIT against mode 1, and the functional engine
+# against mode 0 every three instructions, each followed by the exit status
+suite_Cosim() {
+  for run in "-m 2 -V 1" "-m 1 -V 2" "-m 0 -V 1:3"; do
+    "$SIM" -f "$1" $run -c 100000
+    echo "exit $?"
+  done > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# tests/Library/harness.c drives libmipssim.a through run_until, run_cycles and run, built once per run
+suite_Library() {
+  [ -x "$WORK/harness" ] || gcc -Wall -Iinclude "$TESTS/Library/harness.c" libmipssim.a -o "$WORK/harness" -pthread -lm
+  for mode in 0 1 2; do
+    "$WORK/harness" "$1" $mode
+  done > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# Jobs for a daemon started by the first test: the image and a copy of it twice over (all but the first job start
+# from the cached image), the JIT with binary results, an invalid mode and a cycle limit
+suite_Daemon() {
+  if [ -z "$DAEMON" ]; then
+    "$SIM" -d "$WORK/sock" -j 1 > /dev/null 2>&1 &
+    DAEMON=$!
+    for _ in $(seq 50); do [ -S "$WORK/sock" ] && break; sleep 0.1; done
+  fi
+  cp "$1" "$WORK/image.txt"
+  for run in "-m 2 --repeat 2" "-e jit --binary" "-m 7" "-m 1 -c 10"; do
+    python3 "$TESTS/../daemon_client.py" "$WORK/sock" "$1" "$WORK/image.txt" $run 2> /dev/null
+    echo "exit $?"
+  done | sed "s|$WORK/||g" > "$WORK/out"
+  check "$1" "$2" "$WORK/out"
+}
+
+# Operands forwarded to both sides of BEQ Rn Rn and to the base of LDW and STW
+suite_Pipeline_Forward() {
+  "$SIM" -f "$1" -m 2 -c 100000 > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+# Debugger commands are read from N_input.txt
+suite_Debugger() {
+  "$SIM" -f "$1" -m 2 -g -c 100000 < "${1%.txt}_input.txt" > "$WORK/out" 2>&1
+  check "$1" "$2" "$WORK/out"
+}
+
+if [ $# -gt 0 ]; then
+  suites="$*"
+else
+  suites=$(declare -F | sed -n 's/^declare -f suite_//p')
+fi
+for suite in $suites; do
+  for test in "$TESTS/$suite"/[0-9]*.txt; do
+    case $test in *_results.txt | *_input.txt) continue ;; esac
+    "suite_$suite" "$test" "${test%.txt}_results.txt"
+  done
+done
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
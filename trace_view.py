@@ -0,0 +1,173 @@
+import argparse
+import struct
+import sys
+
+# Must match include/trace.h
+TRACE_MAGIC = b'MIPSTRC\0'
+TRACE_VERSION = 1
+HEADER = struct.Struct('<8sII')
+RECORD = struct.Struct('<IIiI4HHHBB2x')
+TRACE_NONE = 0xFFFF
+
+TRACE_FLUSHED = 0x01
+TRACE_FORWARDED = 0x02
+TRACE_SQUASHED = 0x04
+TRACE_IN_FLIGHT = 0x08
+
+STAGES = ['F', 'D', 'X', 'M', 'W']
+STAGE_NAMES = ['IF', 'ID', 'EX', 'MEM', 'WB']
+MODES = ['non-pipelined', 'pipelined without forwarding', 'pipelined with forwarding']
+
+OPCODES = ['ADD', 'ADDI', 'SUB', 'SUBI', 'MUL', 'MULI', 'OR', 'ORI', 'AND', 'ANDI',
+           'XOR', 'XORI', 'LDW', 'STW', 'BZ', 'BEQ', 'JR', 'HALT']
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Convert a pipeline trace recorded with mips_sim -t to a Konata (Kanata 0004) log or a text pipeline view.')
+    parser.add_argument('trace', help='trace file written by mips_sim -t')
+    parser.add_argument('-o', '--output', help='output file (default: stdout)')
+    parser.add_argument('--text', action='store_true', help='write a text pipeline view instead of a Konata log')
+    parser.add_argument('--width', type=int, default=64, help='cycles per row of the text view (default: 64)')
+    args = parser.parse_args()
+
+    mode, records = read_trace(args.trace)
+    output = open(args.output, 'w') if args.output else sys.stdout
+    with output:
+        if args.text:
+            write_text(records, mode, args.width, output)
+        else:
+            write_kanata(records, output)
+
+
+def read_trace(filename):
+    with open(filename, 'rb') as file:
+        data = file.read()
+
+    if len(data) < HEADER.size:
+        sys.exit(f'{filename}: not a trace file')
+    magic, version, mode = HEADER.unpack_from(data)
+    if magic != TRACE_MAGIC:
+        sys.exit(f'{filename}: not a trace file')
+    if version != TRACE_VERSION:
+        sys.exit(f'{filename}: unsupported trace version {version}')
+
+    records = []
+    for offset in range(HEADER.size, len(data) - RECORD.size + 1, RECORD.size):
+        seq, pc, word, fetch, id_, ex, mem, wb, end, stalls, flags, forward_stage = RECORD.unpack_from(data, offset)
+        cycles = [fetch] + [fetch + delay if delay != TRACE_NONE else None for delay in (id_, ex, mem, wb)]
+        records.append({'seq': seq, 'pc': pc, 'word': word, 'cycles': cycles, 'end': fetch + end,
+                        'stalls': stalls, 'flags': flags, 'forward_stage': forward_stage})
+
+    # Records are written as instructions leave the pipeline; views want fetch order
+    records.sort(key=lambda r: r['seq'])
+    return mode, records
+
+
+def disassemble(word):
+    opcode = (word >> 26) & 0x3F
+    rs = (word >> 21) & 0x1F
+    rt = (word >> 16) & 0x1F
+    rd = (word >> 11) & 0x1F
+    imm = word & 0xFFFF
+    if imm & 0x8000:
+        imm -= 0x10000
+
+    if opcode >= len(OPCODES):
+        return f'.word 0x{word & 0xFFFFFFFF:08x}'
+    name = OPCODES[opcode]
+    if name in ['ADD', 'SUB', 'MUL', 'OR', 'AND', 'XOR']:
+        return f'{name} R{rd} R{rs} R{rt}'
+    if name == 'BZ':
+        return f'{name} R{rs} {imm}'
+    if name == 'BEQ':
+        return f'{name} R{rs} R{rt} {imm}'
+    if name == 'JR':
+        return f'{name} R{rs}'
+    if name == 'HALT':
+        return name
+    return f'{name} R{rt} R{rs} {imm}'
+
+
+def describe(record):
+    notes = []
+    if record['stalls']:
+        notes.append(f"stalled {record['stalls']}")
+    if record['flags'] & TRACE_FORWARDED:
+        notes.append(f"forwarded from {STAGE_NAMES[record['forward_stage']]}")
+    if record['flags'] & TRACE_FLUSHED:
+        notes.append('flushed')
+    if record['flags'] & TRACE_SQUASHED:
+        notes.append('squashed')
+    if record['flags'] & TRACE_IN_FLIGHT:
+        notes.append('in flight at end')
+    return ', '.join(notes)
+
+
+def stage_spans(record):
+    """(stage, first cycle, last cycle) of every stage the instruction entered."""
+    entered = [(i, cycle) for i, cycle in enumerate(record['cycles']) if cycle is not None]
+    spans = []
+    for n, (stage, start) in enumerate(entered):
+        last = entered[n + 1][1] - 1 if n + 1 < len(entered) else max(start, record['end'])
+        spans.append((stage, start, last))
+    return spans
+
+
+def write_kanata(records, output):
+    events = []  # (cycle, order, command); order keeps the commands of a cycle valid
+    retired = 0
+    for id_, record in enumerate(records):
+        fetch = record['cycles'][0]
+        events.append((fetch, 0, f"I\t{id_}\t{record['seq']}\t0"))
+        events.append((fetch, 1, f"L\t{id_}\t0\t{record['pc']:08x}: {disassemble(record['word'])}"))
+        notes = describe(record)
+        if notes:
+            events.append((fetch, 1, f'L\t{id_}\t1\t{notes}'))
+
+        for stage, start, last in stage_spans(record):
+            events.append((start, 2, f'S\t{id_}\t0\t{STAGES[stage]}'))
+            events.append((last + 1, 0, f'E\t{id_}\t0\t{STAGES[stage]}'))
+
+        squashed = record['flags'] & (TRACE_FLUSHED | TRACE_SQUASHED | TRACE_IN_FLIGHT)
+        events.append((max(fetch, record['end']) + 1, 1, f"R\t{id_}\t{retired}\t{1 if squashed else 0}"))
+        if not squashed:
+            retired += 1
+
+    events.sort(key=lambda e: (e[0], e[1]))
+    output.write('Kanata\t0004\n')
+    if not events:
+        return
+    cycle = events[0][0]
+    output.write(f'C=\t{cycle}\n')
+    for event_cycle, _, command in events:
+        if event_cycle != cycle:
+            output.write(f'C\t{event_cycle - cycle}\n')
+            cycle = event_cycle
+        output.write(command + '\n')
+
+
+def write_text(records, mode, width, output):
+    name = MODES[mode] if mode < len(MODES) else f'mode {mode}'
+    output.write(f'# {len(records)} instructions, {name}\n')
+    output.write('# f/d/x/m/w: cycle spent in IF/ID/EX/MEM/WB, *: flushed or squashed\n')
+    if not records:
+        return
+
+    base = records[0]['cycles'][0]
+    for record in records:
+        fetch = record['cycles'][0]
+        row_start = base + (fetch - base) // width * width
+        timeline = [' '] * (fetch - row_start)
+        for stage, start, last in stage_spans(record):
+            timeline += [STAGES[stage].lower()] * (last - start + 1)
+        if record['flags'] & (TRACE_FLUSHED | TRACE_SQUASHED):
+            timeline[-1] = '*'
+
+        text = f"{fetch:>8}  {record['pc']:08x}  {disassemble(record['word']):<20} [{''.join(timeline):<{width}}]"
+        notes = describe(record)
+        output.write(f'{text} {notes}\n' if notes else text + '\n')
+
+
+if __name__ == '__main__':
+    main()